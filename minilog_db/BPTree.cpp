@@ -19,20 +19,47 @@ CNode::CNode(const char* filename, KEY_KIND key_kind, size_t max_size,off_t offt
     this->fname[strlen((char*)filename)] = '\0';
     this->key_kind = key_kind;
     this->max_size = max_size;
+    this->m_Order = NODE_ORDER(max_size);
     this->offt_self = offt;
+    this->offt_father = INVALID;
     node_Type = NODE_TYPE_LEAF;
     m_Count = 0;
     m_pFather = NULL;
+    m_Block = NULL;
+    m_Spare = NULL;
 }
 CNode::~CNode()
 {
-    DeleteChildren();
+    // Children live in the file, a node object owns nothing but the pin on its block
+    delete[] m_Spare;
+}
+char* CNode::AttachBlock(bool fresh)
+{
+    // Blocks up to LOC_GRAPH are the table header and graph root, never a node
+    if (this->offt_self > LOC_GRAPH)
+    {
+        m_Page = BufferPool::getInstance()->pinPage(this->fname, this->offt_self);
+    }
+    if (!m_Page.valid())
+    {
+        m_Spare = new char[DB_BLOCK_SIZE]();
+        m_Block = m_Spare;
+        return m_Block;
+    }
+    m_Block = m_Page.data();
+    if (fresh)
+    {
+        // The block may still hold a freed node
+        std::unique_lock<std::shared_mutex> latch(m_Page.latch());
+        memset(m_Block, 0, DB_BLOCK_SIZE);
+    }
+    return m_Block;
 }
 
 // Get the nearest brother node
 CNode* CNode::GetBrother(int& flag)
 {
-    CNode* pFather = GetFather();   // Get father node pointer
+    CInternalNode* pFather = (CInternalNode*)GetFather();   // Get father node pointer
     if (NULL == pFather)
     {
         return NULL;
@@ -42,7 +69,7 @@ CNode* CNode::GetBrother(int& flag)
     for (int i = 1; i <= pFather->GetCount() + 1; i++)   // GetCount() returns number of data or keys, which is 1 less than number of pointers.
     {
         // Find position of current node
-        if (pFather->GetPointer(i)->getPtSelf() == this->offt_self)
+        if (pFather->getPointer(i - 1) == this->offt_self)
         {
             if (i == (pFather->GetCount() + 1))   // It is the rightmost child of the father node.
             {
@@ -54,9 +81,11 @@ CNode* CNode::GetBrother(int& flag)
                 pBrother = pFather->GetPointer(i + 1);    // Prioritize looking for the next pointer
                 flag = FLAG_RIGHT;
             }
+            break;
         }
     }
 
+    delete pFather;
     return pBrother;
 }
 
@@ -76,7 +105,7 @@ void CNode::DeleteChildren()   // Question: Should pointer index here start from
     }
 }
 CNode* CNode::GetFather(){
-    if(this->offt_father<=LOC_GRAPH||this->offt_father>NUM_ALL_BLOCK) return NULL;
+    if(this->offt_father<=LOC_GRAPH||this->offt_father>=NUM_ALL_BLOCK) return NULL;
     char type=FileManager::getInstance()->get_BlockType(this->fname, this->offt_father);
     if(type==BLOCK_INTER)return new CInternalNode(this->fname, this->key_kind, this->max_size, this->offt_father);
 
@@ -89,44 +118,35 @@ CNode* CNode::GetFather(){
 }
 
 
-// Initialize keys and pointers of internal node to 0 and NULL respectively
+// Initialize keys and pointers of internal node to 0 and INVALID respectively
 CInternalNode::CInternalNode(const char* filename, KEY_KIND key_kind, size_t max_size,off_t offt):CNode(filename,  key_kind,  max_size,  offt)
 {
 
     node_Type = NODE_TYPE_INTERNAL;
-    // Actually offt here is a bit unsafe, might change later
-    for(int i=0; i < MAXNUM_KEY; i++) {
-        this->m_Keys[i] = Invalid(this->key_kind);
-    }
-    for(int i = 0; i < MAXNUM_POINTER; i++)
-    {
-        this->offt_pointers[i] = INT_MIN;
+    bool fresh = (this->offt_self == NEW_OFFT);
+    if(fresh){
+        // getFreeBlock marks the block as BLOCK_INTER
+        this->offt_self=FileManager::getInstance()->getFreeBlock(filename, BLOCK_INTER);
     }
-    if(this->offt_self != NEW_OFFT){
+    // Child pointers follow the node structure, keys follow the pointers
+    char* block = AttachBlock(fresh);
+    this->offt_pointers = (off_t*)(block + sizeof(inter_node));
+    this->m_Keys = (char*)(this->offt_pointers + GetMaxCount() + 1);
+    if(!fresh){
         this->get_file();
     }
-    else{
-        this->offt_self=FileManager::getInstance()->getFreeBlock(filename, BLOCK_INTER);
-        
-    
-    }
-    FileManager::getInstance()->flushBlock(fname, this->offt_self, BLOCK_INTER);
 
 }
 
 CInternalNode::~CInternalNode()
 {
-    for (int i = 0; i < MAXNUM_POINTER; i++)
-    {
-        this->offt_pointers[i] = 0;
-    }
 }
 
 void* CInternalNode::GetElement(int i)
 {
-        if ((i > 0) && (i <= MAXNUM_KEY))
+        if ((i > 0) && (i <= GetMaxCount()))
         {
-            return m_Keys[i - 1];
+            return m_Keys + (i - 1) * this->max_size;
         }
         else
         {
@@ -135,60 +155,45 @@ void* CInternalNode::GetElement(int i)
 }
 void CInternalNode::SetElement(int i, void* key)
 {
-        if ((i > 0) && (i <= MAXNUM_KEY))
+        if ((i > 0) && (i <= GetMaxCount()))
         {
-            //m_Keys[i - 1] = key;
-            if(this->key_kind==INT_KEY){
-                this->m_Keys[i - 1] = (void*)(new int(*(int*)key));
-            }
-            else if(this->key_kind==LL_KEY){
-                this->m_Keys[i - 1] = (void*)(new long long(*(long long*)key));
-            }
-            else if(this->key_kind==STRING_KEY){
-                this->m_Keys[i - 1] = (void*)((char*)key);
-            }
+            // memmove: key may be another slot of this node
+            memmove(m_Keys + (i - 1) * this->max_size, key, this->max_size);
         }
 }
 void CInternalNode::SetPointer(int i, CNode* pointer)
 {
-        if ((i > 0) && (i <= MAXNUM_POINTER))
+        if ((i > 0) && (i <= GetMaxCount() + 1))
         {
             if(pointer != NULL)offt_pointers[i - 1] = pointer->getPtSelf();
             else offt_pointers[i - 1] = INVALID;
         }
 }
 bool CInternalNode::flush_file() {
+        // The decoded copy of this node is now stale
+        NodeCache::getInstance()->invalidate(this->fname, this->offt_self);
         inter_node node;
-        /* This part will be changed according to data requirements later */
-        //memcpy(node.m_Keys, this->m_Keys, sizeof(this->m_Keys));
-        memcpy(node.offt_pointers, this->offt_pointers, sizeof(this->offt_pointers));
         node.offt_self = this->offt_self;
         node.offt_father = this->offt_father;
         node.count = this->m_Count;
         node.node_type = this->node_Type;
         
-        Index index(this->fname, this->offt_self,  this->max_size,this->key_kind);
-        FileManager::getInstance()->flushInterNode(node,index,this->m_Keys);
-
-        return true;
+        return FileManager::getInstance()->flushNode(m_Page, this->fname, this->offt_self, &node, sizeof(inter_node));
 }
 bool CInternalNode::get_file() {
-        Index index(this->fname, this->offt_self,  this->max_size,this->key_kind);
-        // getCInternalNode below to be modified
-        inter_node node=FileManager::getInstance()->getCInternalNode(index,this->m_Keys ,this->offt_self);
+        // Pointers and keys are read in place, only the node structure is picked up
+        const inter_node* node = (const inter_node*)m_Block;
 
-        memcpy(this->offt_pointers, node.offt_pointers, sizeof(node.offt_pointers));
-        this->m_Count = node.count;
-        this->node_Type = node.node_type;
-        this->offt_father=node.offt_father;
+        this->m_Count = node->count;
+        this->node_Type = node->node_type;
+        this->offt_father=node->offt_father;
 
         return true;
 }
 CNode* CInternalNode::GetPointer(int i)
 {
-    if ((i > 0) && (i <= MAXNUM_POINTER))
+    if ((i > 0) && (i <= GetMaxCount() + 1))
     {
-            // Change to pointer reading later
         char type=FileManager::getInstance()->get_BlockType(this->fname, this->offt_pointers[i - 1]);
         if(type==BLOCK_INTER)return new CInternalNode(this->fname, this->key_kind, this->max_size, this->offt_pointers[i - 1]);
         else if(type==BLOCK_LEAF)return new CLeafNode(this->fname, this->key_kind, this->max_size, this->offt_pointers[i - 1]);
@@ -199,6 +204,39 @@ CNode* CInternalNode::GetPointer(int i)
     return NULL;
         
 }
+// Point the father of the children in pointers [from, to] at this node and write them back.
+// pLoaded is a child the caller already holds in memory, it is updated in place instead of reloaded
+void CInternalNode::AdoptChildren(int from, int to, CNode* pLoaded)
+{
+    for (int i = from; i <= to; i++)
+    {
+        if (pLoaded != NULL && this->offt_pointers[i - 1] == pLoaded->getPtSelf())
+        {
+            pLoaded->SetFather(this);
+            pLoaded->flush_file();
+            continue;
+        }
+        CNode* pChild = GetPointer(i);
+        if (pChild == NULL) continue;
+        pChild->SetFather(this);
+        updateNode(pChild);
+    }
+}
+// Copy the smallest key of the i-th subtree to key
+bool CInternalNode::GetSubtreeMin(int i, void* key)
+{
+    CNode* node = GetPointer(i);
+    while (node != NULL && node->GetType() != NODE_TYPE_LEAF)
+    {
+        CNode* next = node->GetPointer(1);
+        delete node;
+        node = next;
+    }
+    if (node == NULL) return false;
+    memcpy(key, node->GetElement(1), this->max_size);
+    delete node;
+    return true;
+}
 // Insert key into internal node.
 /* Question: Does internal node need to insert value? Usually insertion happens after finding position in leaf node.
 Internal node usually inserts two child nodes after splitting when leaf node needs splitting */
@@ -206,32 +244,22 @@ bool CInternalNode::Insert(void* value, CNode* pNode)
 {
     int i;
     // If internal node is full, return failure directly
-    if (GetCount() >= MAXNUM_KEY)
+    if (GetCount() >= GetMaxCount())
     {
         return false;
     }
 
-    int j = 0;
-
-    // Find position to insert key, comparison rule here needs change, here it's equivalent to >=
-    for (i = 0;  (i < m_Count)&&(cmp(value , m_Keys[i],this->key_kind)||eql(value , m_Keys[i],this->key_kind)) ; i++)
-    {
-    }
+    // Find position to insert key, after every key not greater than it
+    i = keyUpperBound(m_Keys, m_Count, value, this->key_kind, this->max_size);
 
     // Current position and subsequent keys shift backward, clearing current position
-    for (j = m_Count; j > i; j--)
-    {
-        m_Keys[j] = (void*)(new int(*(int*)m_Keys[j - 1]));
-    }
+    memmove(m_Keys + (i + 1) * this->max_size, m_Keys + i * this->max_size, (m_Count - i) * this->max_size);
 
     // Current position and subsequent pointers shift backward
-    for (j = m_Count + 1; j > i + 1; j--)
-    {
-        this->offt_pointers[j] = this->offt_pointers[j - 1];
-    }
+    memmove(this->offt_pointers + i + 2, this->offt_pointers + i + 1, (m_Count - i) * sizeof(off_t));
 
     // Store key and pointer in current position
-    m_Keys[i] = value;
+    memcpy(m_Keys + i * this->max_size, value, this->max_size);
     this->offt_pointers[i + 1] = pNode->getPtSelf();    // Note it is the (i+1)-th pointer not the i-th
     pNode->SetFather(this);      // Very important. This function means inserting keyword 'value' and the subtree it points to
     pNode->flush_file();
@@ -245,22 +273,16 @@ bool CInternalNode::Insert(void* value, CNode* pNode)
 // Delete key in internal node, and the pointer after the key
 bool CInternalNode::Delete(void* key)
 {
-    int i, j, k;
-    for (i = 0; (i < m_Count)&&(cmp(key ,m_Keys[i],this->key_kind)||eql(key , m_Keys[i],this->key_kind))  ; i++)
+    int i = keyUpperBound(m_Keys, m_Count, key, this->key_kind, this->max_size);
+    // key is smaller than every key, there is no key in front of its pointer
+    if (i == 0)
     {
+        return false;
     }
 
-    for (j = i - 1; j < m_Count - 1; j++)
-    {
-        m_Keys[j] = m_Keys[j + 1];
-    }
-    m_Keys[j] = Invalid(this->key_kind);
-
-    for (k = i; k < m_Count; k++)
-    {
-        this->offt_pointers[k] = this->offt_pointers[k + 1];
-    }
-    this->offt_pointers[k] = 0;
+    memmove(m_Keys + (i - 1) * this->max_size, m_Keys + i * this->max_size, (m_Count - i) * this->max_size);
+    memmove(this->offt_pointers + i, this->offt_pointers + i + 1, (m_Count - i) * sizeof(off_t));
+    this->offt_pointers[m_Count] = INVALID;
 
     m_Count--;
     this->flush_file();
@@ -268,122 +290,68 @@ bool CInternalNode::Delete(void* key)
 }
 
 /* Split internal node
-Splitting internal node is completely different from splitting leaf node, because internal node has 2V keys and 2V+1 pointers. If simply split into 2, pointers cannot be distributed.
-So according to http://www.seanster.com/BplusTree/BplusTree.html, algorithm for splitting internal node is:
-Based on the key to be inserted:
-(1) If key < V-th key, extract V-th key, its left and right keys are distributed to two nodes respectively
-(2) If key > (V+1)-th key, extract (V+1)-th key, its left and right keys are distributed to two nodes respectively
-(3) If key is between V-th and (V+1)-th key, extract key, original keys are split half into two nodes
-The extracted RetKey is used for subsequent insertion into ancestor node
+A full internal node has 2V keys and 2V+1 pointers, with the new key and its right subtree that is
+2V+1 keys and 2V+2 pointers. The middle one of the 2V+1 keys is extracted and returned in RetKey for
+insertion into the father node, the V keys to its left stay in this node and the V keys to its right
+move to pNode together with their pointers. Moved children get their new father written back.
 */
-void* CInternalNode::Split(CInternalNode* pNode, void* key)  // key is the newly inserted value, pNode is the split node
+bool CInternalNode::Split(CInternalNode* pNode, void* key, CNode* pRightSon, void* RetKey)  // key is the newly inserted value, pNode is the split node
 {
-    int i = 0, j = 0;
-
-    // If key to insert is between V-th and (V+1)-th key, need to flip, so handle this case first
-    if (cmp(key , this->GetElement(ORDER_V),this->key_kind) && cmp( this->GetElement(ORDER_V + 1),key,this->key_kind))
-    {
-        // Move keys V+1 -- 2V to specified node
-
-        for (i = ORDER_V + 1; i <= MAXNUM_KEY; i++)
-        {
-            j++;
-            pNode->SetElement(j, this->GetElement(i));
-            this->SetElement(i, Invalid(this->key_kind));
-        }
-
-        // Move pointers V+2 -- 2V+1 to specified node
-        j = 0;
-        for (i = ORDER_V + 2; i <= MAXNUM_POINTER; i++)
-        {
-            j++;
-            this->GetPointer(i)->SetFather(pNode);    // Reset father of child node
-            pNode->SetPointer(j, this->GetPointer(i));
-            this->SetPointer(i, INVALID);
-        }
-
-        // Set Count
-        this->SetCount(ORDER_V);
-        pNode->SetCount(ORDER_V);
-
-        // Return original key
-        return key;
-    }
-
-    // Handle cases where key < V-th key or key > (V+1)-th key
-
-    // Determine whether to extract V-th or (V+1)-th key
-    int position = 0;
-    // if (key < this->GetElement(ORDER_V))
-    // {
-    //      position = ORDER_V;
-    // }
-    if(cmp(this->GetElement(ORDER_V + 1),key,this->key_kind)){
-        position = ORDER_V;
-    }
-    else
-    {
-        position = ORDER_V + 1;
-    }
-
-    // Extract position-th key, return as new key
-    void* RetKey = this->GetElement(position);
-
-    // Move keys position+1 -- 2V to specified node
-    j = 0;
-    for (i = position + 1; i <= MAXNUM_KEY; i++)
-    {
-        j++;
-        pNode->SetElement(j, this->GetElement(i));
-        this->SetElement(i, Invalid(this->key_kind));
-    }
-
-    // Move pointers position+1 -- 2V+1 to specified node (note pointers are one more than keys)
-    j = 0;
-    for (i = position + 1; i <= MAXNUM_POINTER; i++)
-    {
-        j++;
-        this->GetPointer(i)->SetFather(pNode);    // Reset father of child node
-        pNode->SetPointer(j, this->GetPointer(i));
-        this->SetPointer(i, INVALID);
-    }
-
-    // Clear extracted position
-    this->SetElement(position, Invalid(this->key_kind));
-
-    // Set Count
-    this->SetCount(position - 1);
-    pNode->SetCount(MAXNUM_KEY - position);
-
+    int total = m_Count + 1;
+    vector<char> keys(total * this->max_size);
+    vector<off_t> pointers(total + 1);
+
+    // Lay out all keys and pointers including the new ones in order
+    int i = keyUpperBound(m_Keys, m_Count, key, this->key_kind, this->max_size);
+    memcpy(keys.data(), m_Keys, i * this->max_size);
+    memcpy(keys.data() + i * this->max_size, key, this->max_size);
+    memcpy(keys.data() + (i + 1) * this->max_size, m_Keys + i * this->max_size, (m_Count - i) * this->max_size);
+    memcpy(pointers.data(), this->offt_pointers, (i + 1) * sizeof(off_t));
+    pointers[i + 1] = pRightSon->getPtSelf();
+    memcpy(pointers.data() + i + 2, this->offt_pointers + i + 1, (m_Count - i) * sizeof(off_t));
+
+    // Keys [0, mid) stay, key mid goes up, keys (mid, total) move
+    int mid = total / 2;
+    memcpy(RetKey, keys.data() + mid * this->max_size, this->max_size);
+
+    memset(m_Keys, 0, GetMaxCount() * this->max_size);
+    memcpy(m_Keys, keys.data(), mid * this->max_size);
+    for (int j = 0; j <= GetMaxCount(); j++) this->offt_pointers[j] = (j <= mid) ? pointers[j] : INVALID;
+    this->SetCount(mid);
+
+    int moved = total - mid - 1;
+    memcpy(pNode->m_Keys, keys.data() + (mid + 1) * this->max_size, moved * this->max_size);
+    memcpy(pNode->offt_pointers, pointers.data() + mid + 1, (moved + 1) * sizeof(off_t));
+    pNode->SetCount(moved);
+
+    // Reset father of child nodes
+    if (i + 1 <= mid) this->AdoptChildren(i + 2, i + 2, pRightSon);
+    pNode->AdoptChildren(1, moved + 1, pRightSon);
 
-    return RetKey;
+    return true;
 }
 
 // Combine node, cut all data from specified internal node to this internal node
 bool CInternalNode::Combine(CNode* pNode)
 {
     // Parameter check
-    if (this->GetCount() + pNode->GetCount() + 1 > MAXNUM_DATA)    // Reserve a position for new key
+    if (this->GetCount() + pNode->GetCount() + 1 > GetMaxCount())    // Reserve a position for new key
     {
         return false;
     }
+    CInternalNode* pRight = (CInternalNode*)pNode;
 
     // Take the first element of the first child of the node to be merged as the new key value
-    void* NewKey=NULL;
-    CNode* node=pNode->GetPointer(1);
-    while(node->GetType()!=NODE_TYPE_LEAF)node=node->GetPointer(1);
-    NewKey = node->GetElement(1);
-    //assign(NewKey,pNode->GetPointer(1)->GetElement(1) , this->key_kind);
-    m_Keys[m_Count] = NewKey;
+    int first = m_Count + 1;
+    pRight->GetSubtreeMin(1, GetElement(m_Count + 1));
     m_Count++;
-    this->offt_pointers[m_Count] = pNode->GetPointer(1)->getPtSelf();   // Question: Seems it should be m_Pointers[m_Count+1] = pNode->GetPointer(1);
+    this->offt_pointers[m_Count] = pRight->getPointer(0);
 
-    for (int i = 1; i <= pNode->GetCount(); i++)
-    {
-        m_Keys[m_Count] = pNode->GetElement(i);
-        m_Count++;
-        this->offt_pointers[m_Count] = pNode->GetPointer(i + 1)->getPtSelf();
-    }
+    memcpy(m_Keys + m_Count * this->max_size, pRight->m_Keys, pRight->GetCount() * this->max_size);
+    memcpy(this->offt_pointers + m_Count + 1, pRight->offt_pointers + 1, pRight->GetCount() * sizeof(off_t));
+    m_Count += pRight->GetCount();
+
+    this->AdoptChildren(first + 1, m_Count + 1, NULL);
     pNode->FreeBlock();
     return true;
 }
@@ -392,64 +360,49 @@ bool CInternalNode::Combine(CNode* pNode)
 bool CInternalNode::MoveOneElement(CNode* pNode)
 {
     // Parameter check
-    if (this->GetCount() >= MAXNUM_DATA)
+    if (this->GetCount() >= GetMaxCount())
     {
         return false;
     }
-
-    int i, j;
+    CInternalNode* pBrother = (CInternalNode*)pNode;
 
 
     // Brother node is on the left of this node
     
-    if (cmp(this->GetElement(1), pNode->GetElement(1),this->key_kind))
+    if (cmp(this->GetElement(1), pNode->GetElement(1),this->key_kind,this->max_size))
     {
         // Make space first
-        for (i = m_Count; i > 0; i--)
-        {
-            m_Keys[i] = m_Keys[i - 1];
-        }
-        for (j = m_Count + 1; j > 0; j--)
-        {
-            this->offt_pointers[j] = this->offt_pointers[j - 1];
-        }
+        memmove(m_Keys + this->max_size, m_Keys, m_Count * this->max_size);
+        memmove(this->offt_pointers + 1, this->offt_pointers, (m_Count + 1) * sizeof(off_t));
 
         // Assignment
         // The first key value is not the last key value of the brother node, but the value of the first element of the first child node of this node
-        m_Keys[0] = GetPointer(1)->GetElement(1);
+        this->GetSubtreeMin(2, GetElement(1));
         // The first child node becomes the last child node of the brother node
-        this->offt_pointers[0] = pNode->GetPointer(pNode->GetCount() + 1)->getPtSelf();
+        this->offt_pointers[0] = pBrother->getPointer(pBrother->GetCount());
 
         // Modify brother node
-        pNode->SetElement(pNode->GetCount(), Invalid(this->key_kind));
-        pNode->SetPointer(pNode->GetCount() + 1, INVALID);
+        pBrother->offt_pointers[pBrother->GetCount()] = INVALID;
+        this->SetCount(this->GetCount() + 1);
+        this->AdoptChildren(1, 1, NULL);
     }
     else    // Brother node is on the right of this node
     {
         // Assignment
         // The last key value is not the first key value of the brother node, but the value of the first element of the first child node of the brother node
-        m_Keys[m_Count] = pNode->GetPointer(1)->GetElement(1);
+        pBrother->GetSubtreeMin(1, GetElement(m_Count + 1));
         // The last child node becomes the first child node of the brother node
-        this->offt_pointers[m_Count + 1] = pNode->GetPointer(1)->getPtSelf();
+        this->offt_pointers[m_Count + 1] = pBrother->getPointer(0);
 
         // Modify brother node
-        // for (i = 1; i < pNode->GetCount() - 1; i++)
-        // {
-        //      pNode->SetElement(i, pNode->GetElement(i + 1));
-        // }
-        for (i = 1; i < pNode->GetCount(); i++)
-        {
-            pNode->SetElement(i, pNode->GetElement(i + 1));
-        }
-        pNode->SetElement(pNode->GetCount(), Invalid(this->key_kind));
-        for (j = 1; j <= pNode->GetCount(); j++)
-        {
-            pNode->SetPointer(j, pNode->GetPointer(j + 1));
-        }
+        memmove(pBrother->m_Keys, pBrother->m_Keys + this->max_size, (pBrother->GetCount() - 1) * this->max_size);
+        memmove(pBrother->offt_pointers, pBrother->offt_pointers + 1, pBrother->GetCount() * sizeof(off_t));
+        pBrother->offt_pointers[pBrother->GetCount()] = INVALID;
+        this->SetCount(this->GetCount() + 1);
+        this->AdoptChildren(m_Count + 1, m_Count + 1, NULL);
     }
 
     // Set count
-    this->SetCount(this->GetCount() + 1);
     pNode->SetCount(pNode->GetCount() - 1);
     this->flush_file();
     pNode->flush_file();
@@ -464,27 +417,28 @@ CLeafNode::CLeafNode(const char* fname,KEY_KIND key_kind,size_t max_size,off_t o
     m_pNextNode = NULL;
     this->offt_NextNode=0;
     this->offt_PrevNode=0;
-    for (int i = 0; i < MAXNUM_DATA; i++)m_Datas[i] = Invalid(this->key_kind);
-    for(int i=0;i<MAXNUM_DATA;i++)this->offt_data[i]=INVALID;
-    if(this->offt_self != NEW_OFFT){
+    bool fresh = (this->offt_self == NEW_OFFT);
+    if(fresh){
+        // getFreeBlock marks the block as BLOCK_LEAF
+        this->offt_self=FileManager::getInstance()->getFreeBlock(fname, BLOCK_LEAF);
+    }
+    // Record ids follow the node structure, keys follow the record ids
+    char* block = AttachBlock(fresh);
+    this->offt_data = (off_t*)(block + sizeof(leaf_node));
+    this->m_Datas = (char*)(this->offt_data + GetMaxCount());
+    if(!fresh){
         this->get_file();
     }
-    else{
-        this->offt_self=FileManager::getInstance()->getFreeBlock(fname, BLOCK_LEAF);
-        // Must remember to update later
-        }
-    FileManager::getInstance()->flushBlock(fname, this->offt_self, BLOCK_LEAF);
     
 }
 CLeafNode::~CLeafNode()
 {
-
 }
 void* CLeafNode::GetElement(int i)
 {
-        if ((i > 0) && (i <= MAXNUM_DATA))
+        if ((i > 0) && (i <= GetMaxCount()))
         {
-            return m_Datas[i - 1];
+            return m_Datas + (i - 1) * this->max_size;
         }
         else
         {
@@ -492,7 +446,7 @@ void* CLeafNode::GetElement(int i)
         }
 }
 off_t CLeafNode::GetElement_offt(int i){
-        if ((i > 0) && (i <= MAXNUM_DATA))
+        if ((i > 0) && (i <= GetMaxCount()))
         {
             return this->offt_data[i - 1];
         }
@@ -503,70 +457,46 @@ off_t CLeafNode::GetElement_offt(int i){
 }
 void CLeafNode::SetElement(int i, void* data)
 {
-        if ((i > 0) && (i <= MAXNUM_KEY))
+        if ((i > 0) && (i <= GetMaxCount()))
         {
-            //m_Keys[i - 1] = key;
-            if(this->key_kind==INT_KEY){
-                this->m_Datas[i - 1] = (void*)(new int(*(int*)data));
-            }
-            else if(this->key_kind==LL_KEY){
-                this->m_Datas[i - 1] = (void*)(new long long(*(long long*)data));
-            }
-            else if(this->key_kind==STRING_KEY){
-                this->m_Datas[i - 1] = (void*)((char*)data);
-            }
+            memmove(m_Datas + (i - 1) * this->max_size, data, this->max_size);
         }
 }
 bool CLeafNode::flush_file() {
         
-        leaf_node node(this->offt_self,this->GetCount(),NODE_TYPE_LEAF,this->offt_father,this->offt_PrevNode,this->offt_NextNode,this->offt_data);
-        Index index(this->fname,this->offt_self,this->max_size,this->key_kind);
-        FileManager::getInstance()->flushLeafNode(node, index,this->m_Datas);
-
-        return true;
+        leaf_node node(this->offt_self,this->GetCount(),NODE_TYPE_LEAF,this->offt_father,this->offt_PrevNode,this->offt_NextNode);
+        return FileManager::getInstance()->flushNode(m_Page, this->fname, this->offt_self, &node, sizeof(leaf_node));
 }
 bool CLeafNode::get_file() {
-        
-        Index index(this->fname,this->offt_self,this->max_size,this->key_kind);
-
-        leaf_node node = FileManager::getInstance()->getLeafNode(index,this->m_Datas,this->offt_self);
-
-        //memcmp(this->m_Datas, node.m_Datas, sizeof(node.m_Datas));
-        this->offt_PrevNode = node.offt_PrevNode;
-        this->offt_NextNode = node.offt_NextNode;
-        this->offt_father = node.offt_father;
-        this->m_Count = node.count;
-        this->node_Type = node.node_type;
-        this->offt_self=node.offt_self;
-        for(int i=0;i<MAXNUM_DATA;i++){
-            this->offt_data[i]=node.offt_data[i];
-        }
+        // Record ids and keys are read in place, only the node structure is picked up
+        const leaf_node* node = (const leaf_node*)m_Block;
+
+        this->offt_PrevNode = node->offt_PrevNode;
+        this->offt_NextNode = node->offt_NextNode;
+        this->offt_father = node->offt_father;
+        this->m_Count = node->count;
+        this->node_Type = node->node_type;
         return true;
 }
 // Insert data into leaf node
 bool CLeafNode::Insert(void* value,off_t offt_data)
 {
-    int i, j;
+    int i;
     // If leaf node is full, return failure directly
-    if (GetCount() >= MAXNUM_DATA)
+    if (GetCount() >= GetMaxCount())
     {
         return false;
     }
 
-    // Find position to insert data
-    for (i = 0; (i < m_Count)&&cmp(value , m_Datas[i],this->key_kind) ; i++)
-    {
-    }
+    // Find position to insert data, before the first key not less than it
+    i = keyLowerBound(m_Datas, m_Count, value, this->key_kind, this->max_size);
 
     // Current position and subsequent data shift backward, clearing current position
-    for (j = m_Count; j > i; j--)
-    {
-        m_Datas[j] = m_Datas[j - 1];
-        this->offt_data[j]=this->offt_data[j-1];
-    }
+    memmove(m_Datas + (i + 1) * this->max_size, m_Datas + i * this->max_size, (m_Count - i) * this->max_size);
+    memmove(this->offt_data + i + 1, this->offt_data + i, (m_Count - i) * sizeof(off_t));
 
     // Store data in current position, the only place for insertion
-    m_Datas[i] = value;
+    memcpy(m_Datas + i * this->max_size, value, this->max_size);
     this->offt_data[i]=offt_data;
 
     m_Count++;
@@ -578,37 +508,22 @@ bool CLeafNode::Insert(void* value,off_t offt_data)
 
 bool CLeafNode::Delete(void* value,bool deleteo_offtData)
 {
-    int i, j;
-    bool found = false;
-    for (i = 0; i < m_Count; i++)
-    {
-        if (eql(value, this->m_Datas[i], this->key_kind))
-        {
-            found = true;
-            break;
-        }
-    }
+    int i = keyFind(m_Datas, m_Count, value, this->key_kind, this->max_size);
     // If not found, return failure
-    if (false == found)
+    if (i < 0)
     {
         return false;
     }
-    if(deleteo_offtData)FileManager::getInstance()->flushBlock(this->fname, this->offt_data[i], BLOCK_FREE);
+    if(deleteo_offtData)FileManager::getInstance()->free_record(this->fname, this->offt_data[i]);
     // Subsequent data shift forward
-    for (j = i; j < m_Count - 1; j++)
-    {
-        m_Datas[j] = m_Datas[j + 1];
-    }
-    for(j=i;j<m_Count-1;j++){
-        this->offt_data[j]=this->offt_data[j+1];
-    }
+    memmove(m_Datas + i * this->max_size, m_Datas + (i + 1) * this->max_size, (m_Count - i - 1) * this->max_size);
+    memmove(this->offt_data + i, this->offt_data + i + 1, (m_Count - i - 1) * sizeof(off_t));
     // Set the last data as invalid
-    m_Datas[j] = Invalid(this->key_kind);
-    this->offt_data[j]=INVALID;
-    // Release this data block
+    memset(m_Datas + (m_Count - 1) * this->max_size, 0, this->max_size);
+    this->offt_data[m_Count - 1]=INVALID;
     
-    this->flush_file();
     m_Count--;
+    this->flush_file();
     
     
     // Return success
@@ -620,18 +535,16 @@ bool CLeafNode::Delete(void* value,bool deleteo_offtData)
 void* CLeafNode::Split(CNode* pNode)
 {
     // Move the second half of data of this leaf node to specified node
-    int j = 0;
-    for (int i = ORDER_V + 1; i <= MAXNUM_DATA; i++)
-    {
-        j++;
-        pNode->SetElement(j, this->GetElement(i));
-        ((CLeafNode*)pNode)->SetElement_offt(j, this->GetElement_offt(i));
-        this->SetElement(i, Invalid(this->key_kind));
-        this->SetElement_offt(i, INVALID);
-    }
+    CLeafNode* pLeaf = (CLeafNode*)pNode;
+    int keep = GetOrder();
+    int moved = this->GetCount() - keep;
+    memcpy(pLeaf->m_Datas + pLeaf->GetCount() * this->max_size, m_Datas + keep * this->max_size, moved * this->max_size);
+    memcpy(pLeaf->offt_data + pLeaf->GetCount(), this->offt_data + keep, moved * sizeof(off_t));
+    memset(m_Datas + keep * this->max_size, 0, moved * this->max_size);
+    for (int i = keep; i < keep + moved; i++) this->offt_data[i] = INVALID;
     // Set Count
-    this->SetCount(this->GetCount() - j);
-    pNode->SetCount(pNode->GetCount() + j);
+    this->SetCount(keep);
+    pNode->SetCount(pNode->GetCount() + moved);
 
     // Return the first element of the new node as key
     return pNode->GetElement(1);
@@ -641,7 +554,7 @@ void* CLeafNode::Split(CNode* pNode)
 bool CLeafNode::Combine(CNode* pNode)
 {
     // Parameter check
-    if (this->GetCount() + pNode->GetCount() > MAXNUM_DATA)
+    if (this->GetCount() + pNode->GetCount() > GetMaxCount())
     {
         return false;
     }
@@ -682,7 +595,8 @@ BPlusTree::BPlusTree()
     m_pLeafHead = NULL;
     m_pLeafTail = NULL;
     this->offt_self = 0;
-    
+    this->offt_data_tail = INVALID;
+    this->joinBp = NULL;
 }
 BPlusTree::BPlusTree(const std::string& fname)
 {
@@ -692,17 +606,13 @@ BPlusTree::BPlusTree(const std::string& fname)
     this->m_Root=NULL;
     this->m_pLeafHead=NULL;
     this->m_pLeafTail=NULL;
-    FileManager::getInstance()->get_BlockGraph(this->fpath, this->Block_GRAPH);
-    // cout<<"Initialize bitmap: "<<endl;
-    // for(int i=0;i<30;i++){
-    //      cout<<this->Block_GRAPH[i]<<" ";
-    // }
-    // cout<<endl;
-    if(this->Block_GRAPH[offt_root]==BLOCK_LEAF){
+    this->joinBp=NULL;
+    char root_type = FileManager::getInstance()->get_BlockType(this->fpath, this->offt_root);
+    if(root_type==BLOCK_LEAF){
         this->m_Root=new CLeafNode(this->fpath, this->key_kind, this->max_key_size, this->offt_root);
 
     }
-    else if(this->Block_GRAPH[offt_root]==BLOCK_INTER){
+    else if(root_type==BLOCK_INTER){
         this->m_Root=new CInternalNode(this->fpath, this->key_kind, this->max_key_size, this->offt_root);
     }
     
@@ -714,12 +624,12 @@ BPlusTree::BPlusTree(const std::string& fname1, const std::string& fname2){
     this->m_Root=NULL;
     this->m_pLeafHead=NULL;
     this->m_pLeafTail=NULL;
-    FileManager::getInstance()->get_BlockGraph(this->fpath, this->Block_GRAPH);
-    if(this->Block_GRAPH[offt_root]==BLOCK_LEAF){
+    char root_type = FileManager::getInstance()->get_BlockType(this->fpath, this->offt_root);
+    if(root_type==BLOCK_LEAF){
         this->m_Root=new CLeafNode(this->fpath, this->key_kind, this->max_key_size, this->offt_root);
 
     }
-    else if(this->Block_GRAPH[offt_root]==BLOCK_INTER){
+    else if(root_type==BLOCK_INTER){
         this->m_Root=new CInternalNode(this->fpath, this->key_kind, this->max_key_size, this->offt_root);
     }
     bool has_ref = parser_ref_table(fname2);
@@ -733,7 +643,9 @@ BPlusTree::BPlusTree(const std::string& fname1, const std::string& fname2){
 
 BPlusTree::~BPlusTree()
 {
-    ClearTree();
+    delete m_Root;
+    // The joined table's tree pins its root too
+    delete joinBp;
 }
 bool BPlusTree::parser_ref_table(const std::string& ref_table_name){
     string a="";
@@ -767,14 +679,13 @@ CNode* BPlusTree::GetRoot(){
         return NULL;
 }
 void BPlusTree::SetRoot(CNode* root)
-{   // Sync update file
-        m_Root = root;
-        if( m_Root != NULL){
-            m_Root->flush_file();
-        this->offt_root = m_Root->getPtSelf();
-        m_Root->setPtFather(INVALID);
-        //cout<<"root offt"<<this->offt_root<<endl;
+{   // Sync update file, the caller keeps ownership of root
+        if( root != NULL){
+            root->setPtFather(INVALID);
+            root->flush_file();
+            this->offt_root = root->getPtSelf();
         }
+        else this->offt_root = INVALID;
         
 }
 bool BPlusTree::flush_file(){
@@ -790,6 +701,9 @@ bool BPlusTree::flush_file(){
     t.m_Depth = this->m_Depth;
     t.max_key_size = this->max_key_size;
     t.attr_num = this->attr_num;
+    t.offt_data_tail = this->offt_data_tail;
+    memcpy(t.pool, this->pool, sizeof(t.pool));
+    t.storage = this->storage;
     for(int i=0;i<ATTR_MAX_NUM;i++){
         t.attr[i] = this->attr[i];
     }
@@ -811,6 +725,9 @@ bool BPlusTree::get_file() {
         this->max_key_size = t.max_key_size;
         this->key_kind = t.key_kind;
         this->attr_num = t.attr_num;
+        this->offt_data_tail = t.offt_data_tail;
+        memcpy(this->pool, t.pool, sizeof(this->pool));
+        this->storage = t.storage;
         for(int i=0;i<this->attr_num;i++){
             this->attr[i] = t.attr[i];
             if(_stricmp(t.attr[i].constraint, "PRIMARY KEY")==0){
@@ -834,47 +751,19 @@ CLeafNode* BPlusTree::GetLeafTail(){
     return NULL;
 }
 void BPlusTree::SetLeafHead(CLeafNode* node){
-    this->m_pLeafHead = node;
-    if(node!=NULL)this->offt_leftHead = node->getPtSelf();
+    this->m_pLeafHead = NULL;    // Leaf objects are short-lived, only the offset is kept
+    this->offt_leftHead = (node!=NULL) ? node->getPtSelf() : INVALID;
 }
 void BPlusTree::SetLeafTail(CLeafNode* node){
-    this->m_pLeafTail = node;
-    if(node!=NULL)this->offt_rightHead = node->getPtSelf();
+    this->m_pLeafTail = NULL;
+    this->offt_rightHead = (node!=NULL) ? node->getPtSelf() : INVALID;
 }
 // Search data in tree
 off_t BPlusTree::Search(void* data)
 {
     int i = 0;
-    int offset = 0;
-    // if (NULL != sPath)
-    // {
-    //      (void)sprintf(sPath + offset, "The serach path is:");
-    //      offset += 19;
-    // }
-
-    CNode* pNode = GetRoot();
-    // Loop to find corresponding leaf node
-    while (NULL != pNode)
-    {
-        // Node is leaf node, loop ends
-        if (NODE_TYPE_LEAF == pNode->GetType())
-        {
-            break;
-        }
 
-        // Find first key value greater than or equal to key
-        for (i = 1;  (i <= pNode->GetCount())&&(cmp(data , pNode->GetElement(i),this->key_kind)|| eql(data,pNode->GetElement(i),this->key_kind)); i++)
-        {
-        }
-
-        // if (NULL != sPath)
-        // {
-        //      (void)sprintf(sPath + offset, " %3d -->", pNode->GetElement(1));
-        //      offset += 8;
-        // }
-
-        pNode = pNode->GetPointer(i);
-    }
+    CNode* pNode = SearchLeafNode(data);
 
     // Not found, there might be cases where pNode is null
     if (NULL == pNode)
@@ -882,20 +771,12 @@ off_t BPlusTree::Search(void* data)
         return INVALID;
     }
 
-    // if (NULL != sPath)
-    // {
-    //      (void)sprintf(sPath + offset, "%3d", pNode->GetElement(1));
-    //      offset += 3;
-    // }
-
     // Continue searching in leaf node
     off_t found = INVALID;
-    for (i = 1; (i <= pNode->GetCount()); i++)
+    i = keyFind((char*)pNode->GetElement(1), pNode->GetCount(), data, this->key_kind, this->max_key_size);
+    if (i >= 0)
     {
-        if (eql(data,pNode->GetElement(i),this->key_kind))
-        {
-            found = ((CLeafNode*)pNode)->GetElement_offt(i);
-        }
+        found = ((CLeafNode*)pNode)->GetElement_offt(i + 1);
     }
 
     // Release memory
@@ -903,6 +784,93 @@ off_t BPlusTree::Search(void* data)
     return found;
 }
 
+CRangeCursor::CRangeCursor(BPlusTree* tree, const KeyRange& range, bool descending)
+    : tree(tree), range(range), descending(descending), leaf(NULL), pos(1)
+{
+    if (descending)
+    {
+        if (range.high == NULL)
+        {
+            this->leaf = tree->GetLeafTail();
+            this->pos = (this->leaf != NULL) ? this->leaf->GetCount() : 0;
+            return;
+        }
+        // The keys up to high come first, the last of them is the start
+        this->leaf = tree->SearchLeafNode(range.high);
+        if (this->leaf != NULL)
+        {
+            char* keys = (char*)this->leaf->GetElement(1);
+            int count = this->leaf->GetCount();
+            this->pos = range.high_inclusive
+                ? keyUpperBound(keys, count, range.high, tree->key_kind, tree->max_key_size)
+                : keyLowerBound(keys, count, range.high, tree->key_kind, tree->max_key_size);
+        }
+        return;
+    }
+    if (range.low == NULL)
+    {
+        this->leaf = tree->GetLeafHead();
+        return;
+    }
+    // Keys equal to a separator are on its right, so the descent ends at the leaf holding low
+    this->leaf = tree->SearchLeafNode(range.low);
+    if (this->leaf != NULL)
+    {
+        char* keys = (char*)this->leaf->GetElement(1);
+        int count = this->leaf->GetCount();
+        this->pos = (range.low_inclusive
+            ? keyLowerBound(keys, count, range.low, tree->key_kind, tree->max_key_size)
+            : keyUpperBound(keys, count, range.low, tree->key_kind, tree->max_key_size)) + 1;
+    }
+}
+
+CRangeCursor::~CRangeCursor()
+{
+    delete this->leaf;
+}
+
+off_t CRangeCursor::Next()
+{
+    KEY_KIND key_kind = this->tree->key_kind;
+    size_t key_size = this->tree->max_key_size;
+    while (this->leaf != NULL && (this->descending ? this->pos < 1 : this->pos > this->leaf->GetCount()))
+    {
+        CLeafNode* pNext = this->descending ? this->leaf->GetPrevNode() : this->leaf->GetNextNode();
+        delete this->leaf;
+        this->leaf = pNext;
+        this->pos = this->descending ? (pNext != NULL ? pNext->GetCount() : 0) : 1;
+    }
+    if (this->leaf == NULL)
+    {
+        return INVALID;
+    }
+
+    // Stop at the bound the walk runs towards
+    void* key = this->leaf->GetElement(this->pos);
+    bool past;
+    if (this->descending)
+    {
+        past = this->range.low != NULL
+            && (cmp(this->range.low, key, key_kind, key_size)
+                || (!this->range.low_inclusive && eql(key, this->range.low, key_kind, key_size)));
+    }
+    else
+    {
+        past = this->range.high != NULL
+            && (cmp(key, this->range.high, key_kind, key_size)
+                || (!this->range.high_inclusive && eql(key, this->range.high, key_kind, key_size)));
+    }
+    if (past)
+    {
+        delete this->leaf;
+        this->leaf = NULL;
+        return INVALID;
+    }
+    off_t rid = this->leaf->GetElement_offt(this->pos);
+    this->pos += this->descending ? -1 : 1;
+    return rid;
+}
+
 /* Insert data into B+ Tree
 Inserting data first requires finding the theoretical leaf node for insertion, then there are three cases:
 (1) Leaf node not full. Directly insert into the node;
@@ -913,45 +881,83 @@ Inserting data first requires finding the theoretical leaf node for insertion, t
 */
 off_t BPlusTree::Insert(void* data)  //
 {
-    // Check for duplicate insertion
-    off_t found = Search(data);
-    if (found!=INVALID)
+    // One descent finds the leaf and remembers the way back up for splits
+    vector<off_t> path;
+    CLeafNode* pOldNode = SearchLeafNode(data, &path);
+
+    // Check for duplicate insertion, the key can only be in this leaf
+    if (NULL != pOldNode && keyFind((char*)pOldNode->GetElement(1), pOldNode->GetCount(), data, this->key_kind, this->max_key_size) >= 0)
     {
+        delete pOldNode;
         return INVALID;
     }
 
-    // Get a free block in file
-    off_t offt_data = FileManager::getInstance()->getFreeBlock(this->fpath, BLOCK_DATA);
+    // Reserve a record slot in a data block
+    size_t record_size = FileManager::getInstance()->get_RecordSize(this->attr, this->attr_num);
+    off_t offt_data = FileManager::getInstance()->alloc_record(this->fpath, record_size, this->offt_data_tail);
+    if (offt_data == INVALID)
+    {
+        delete pOldNode;
+        return INVALID;
+    }
 
-    // Find the ideal leaf node
-    CLeafNode* pOldNode = SearchLeafNode(data);
     // If not found, tree is empty, generate root node
     if (NULL == pOldNode)
     {
         pOldNode = new CLeafNode(this->fpath, this->key_kind, this->max_key_size, NEW_OFFT);
+        if (pOldNode->getPtSelf() == INVALID)
+        {
+            delete pOldNode;
+            FileManager::getInstance()->free_record(this->fpath, offt_data);
+            return INVALID;
+        }
         this->SetLeafHead(pOldNode);
         this->SetLeafTail(pOldNode);
         SetRoot(pOldNode);
     }
 
     // Leaf node not full, corresponding to case 1, insert directly
-    if (pOldNode->GetCount() < MAXNUM_DATA)
+    if (pOldNode->GetCount() < pOldNode->GetMaxCount())
     {
         bool success= pOldNode->Insert(data,offt_data);
         pOldNode->flush_file();
-        if(pOldNode->getPtSelf()==this->offt_root)this->SetRoot(pOldNode);
-        // Update data immediately after insertion
-        //SetRoot(pOldNode);
         delete pOldNode;
         if(success)return offt_data;
+        FileManager::getInstance()->free_record(this->fpath, offt_data);
         return INVALID;
     }
 
-    // Original leaf node full, create new leaf node, and move the second half of data from original node to new node
+    // Original leaf node full, create new leaf node, and move the second half of data from original node to new node.
+    // Every block the split can need is taken before the tree changes: the new leaf, a brother
+    // for each full internal node on the way up and a new root if all of them split
+    size_t splits = 0;
+    while (splits < path.size())
+    {
+        CInternalNode node(this->fpath, this->key_kind, this->max_key_size, path[path.size() - 1 - splits]);
+        if (node.GetCount() < node.GetMaxCount()) break;
+        splits++;
+    }
+    size_t blocks = splits + (splits == path.size() ? 1 : 0);
     CLeafNode* pNewNode = new CLeafNode(this->fpath, this->key_kind, this->max_key_size, NEW_OFFT);
-    void* key = INVALID;
-    off_t offt_key = INVALID;
-    key = pOldNode->Split(pNewNode);
+    vector<CInternalNode*> spare;
+    bool reserved = pNewNode->getPtSelf() != INVALID;
+    while (reserved && spare.size() < blocks)
+    {
+        spare.push_back(new CInternalNode(this->fpath, this->key_kind, this->max_key_size, NEW_OFFT));
+        reserved = spare.back()->getPtSelf() != INVALID;
+    }
+    if (!reserved)
+    {
+        if (pNewNode->getPtSelf() != INVALID) pNewNode->FreeBlock();
+        FreeSpare(spare);
+        delete pNewNode;
+        delete pOldNode;
+        FileManager::getInstance()->free_record(this->fpath, offt_data);
+        return INVALID;
+    }
+    // The split key is copied out, the node buffers shift on insertion
+    vector<char> key(this->max_key_size);
+    memcpy(key.data(), pOldNode->Split(pNewNode), this->max_key_size);
 
     CLeafNode* pOldNext = pOldNode->GetNextNode();
     pOldNode->SetNextNode(pNewNode);
@@ -960,65 +966,70 @@ off_t BPlusTree::Insert(void* data)  //
 
     if (NULL == pOldNext)
     {
-        //m_pLeafTail = pNewNode;
         this->SetLeafTail(pNewNode);
     }
     else
     {
-        //pOldNext->m_pPrevNode = pNewNode;
         pOldNext->SetPrevNode(pNewNode);
+        updateNode(pOldNext);
     }
 
 
     // Determine whether to insert into original node or new node, ensuring sorting by data value
-    if (cmp(key, data, this->key_kind))
-    {
-        pOldNode->Insert(data,offt_data);    // Insert into original node
-    }
-    else
-    {
-        pNewNode->Insert(data,offt_data);    // Insert into new node
-    }
-
-    // Father node
-    CInternalNode* pFather = (CInternalNode*)(pOldNode->GetFather());
+    CLeafNode* pTarget = cmp(key.data(), data, this->key_kind, this->max_key_size) ? pOldNode : pNewNode;
+    pTarget->Insert(data,offt_data);
 
     // If original node is root node, corresponding to case 2
-    if (NULL == pFather)
+    if (path.empty())
     {
-        CNode* pNode1 = new CInternalNode(this->fpath, this->key_kind, this->max_key_size, NEW_OFFT);
+        CNode* pNode1 = spare.back();
+        spare.pop_back();
         pNode1->SetPointer(1, pOldNode);                            // Pointer 1 points to original node
-        pNode1->SetElement(1, key);                                // Set key
+        pNode1->SetElement(1, key.data());                         // Set key
         pNode1->SetPointer(2, pNewNode);                            // Pointer 2 points to new node
         pOldNode->SetFather(pNode1);                               // Set father node
         pNewNode->SetFather(pNode1);                               // Set father node
         pNode1->SetCount(1);
 
-        SetRoot(pNode1);
-        delete pNode1;                                      // Set new root node
+        SetRoot(pNode1);                                    // Set new root node
+        delete pNode1;
         pOldNode->flush_file();
         pNewNode->flush_file();
-        delete pFather;
         delete pNewNode;
         delete pOldNode;
-        delete pOldNext;
         return offt_data;
     }
     
-    // Case 3 and Case 4 implemented here
-    bool ret = InsertInternalNode(pFather, key, pNewNode);
-    pFather->flush_file();
+    // Father node, the last internal node of the descent
+    CInternalNode* pFather = new CInternalNode(this->fpath, this->key_kind, this->max_key_size, path.back());
+    path.pop_back();
+
+    // Case 3 and Case 4 implemented here. Both leaves are written first, a split of the
+    // father may move them to another internal node and rewrites their father on disk
     pOldNode->flush_file();
     pNewNode->flush_file();
-    pOldNode->flush_file();
+    bool ret = InsertInternalNode(pFather, key.data(), pNewNode, path, spare);
+    FreeSpare(spare);
     delete pFather;
+    if(!ret){
+        // Only a damaged tree gets here. The key leaves again with its record, so it can't
+        // point at a freed slot
+        pTarget->Delete(data, true);
+    }
     delete pNewNode;
     delete pOldNode;
-    delete pOldNext;
-    if(ret){
-        return offt_data;
+    return ret ? offt_data : INVALID;
+}
+
+// Give back the blocks Insert reserved and did not use
+void BPlusTree::FreeSpare(vector<CInternalNode*>& spare)
+{
+    for (CInternalNode* node : spare)
+    {
+        if (node->getPtSelf() != INVALID) node->FreeBlock();
+        delete node;
     }
-    return INVALID;
+    spare.clear();
 }
 bool BPlusTree::Insert_Data(vector<vector<string>> value){
     void* data[ATTR_MAX_NUM];
@@ -1060,8 +1071,8 @@ bool BPlusTree::Insert_Data(vector<vector<string>> value){
     
     return true;
 }
-void BPlusTree::Get_Data(void* data[ATTR_MAX_NUM],off_t offt){
-    FileManager::getInstance()->get_data(this->fpath, data, this->attr, this->attr_num, offt);
+bool BPlusTree::Get_Data(void* data[ATTR_MAX_NUM],off_t offt){
+    return FileManager::getInstance()->get_data(this->fpath, data, this->attr, this->attr_num, offt);
 }
 void BPlusTree::Print_Data(void* data[ATTR_MAX_NUM]){
     for(int i=0;i<attr_num;i++){
@@ -1092,9 +1103,9 @@ bool BPlusTree::Delete(void* data)
 
     // Delete data, if failed it must be not found, return failure directly
     bool success = pOldNode->Delete(data,true);
-    pOldNode->flush_file();
     if (false == success)
     {
+        delete pOldNode;
         return false;
     }
 
@@ -1102,7 +1113,6 @@ bool BPlusTree::Delete(void* data)
     CInternalNode* pFather = (CInternalNode*)(pOldNode->GetFather());
     if (NULL == pFather)
     {
-        pOldNode->flush_file();
         // If no data left, delete root node (only root node can have this situation)
         if (0 == pOldNode->GetCount())
         {
@@ -1110,8 +1120,6 @@ bool BPlusTree::Delete(void* data)
             pOldNode->FreeBlock();
             this->SetLeafHead(NULL);
             this->SetLeafTail(NULL);
-            //m_pLeafHead = NULL;
-            //m_pLeafTail = NULL;
             SetRoot(NULL);
         }
         delete pOldNode;
@@ -1120,18 +1128,17 @@ bool BPlusTree::Delete(void* data)
 
 
     // If leaf node fill factor >= 50% after deletion, corresponding to case 1
-    if (pOldNode->GetCount() >= ORDER_V)
+    if (pOldNode->GetCount() >= pOldNode->GetOrder())
     {
-        for (int i = 1; (i <= pFather->GetCount())&& (cmp(data , pFather->GetElement(i),this->key_kind)||eql(data, pFather->GetElement(i), this->key_kind)) ; i++)
+        // If father node's key value is deleted, need to change that key
+        int i = keyFind((char*)pFather->GetElement(1), pFather->GetCount(), data, this->key_kind, this->max_key_size);
+        if (i >= 0)
         {
-            // If father node's key value is deleted, need to change that key
-            if (eql(pFather->GetElement(i) ,data,this->key_kind))
-            {
-                pFather->SetElement(i, pOldNode->GetElement(1));    // Change to new first element of leaf node
-            }
+            pFather->SetElement(i + 1, pOldNode->GetElement(1));    // Change to new first element of leaf node
+            pFather->flush_file();
         }
-        updateNode(pFather);
-        updateNode(pOldNode);
+        delete pFather;
+        delete pOldNode;
         return true;
     }
 
@@ -1142,119 +1149,104 @@ bool BPlusTree::Delete(void* data)
     if (pBrother == NULL){
         // Fix correct father node
         bool b=this->SetCorrentFather(pOldNode);
-        if(b)CLeafNode* pBrother = (CLeafNode*)(pOldNode->GetBrother(flag));
+        if(b)pBrother = (CLeafNode*)(pOldNode->GetBrother(flag));
     }
     if(NULL == pBrother)
     {
+        delete pFather;
+        delete pOldNode;
         return true;// Nothing can be done, cannot propagate upwards.
     }
     // Brother node fill factor > 50%, corresponding to case 2A
-    void* NewData = INVALID;
+    vector<char> NewData(this->max_key_size);
     off_t NewDataPos = 0;
-    if (pBrother->GetCount() > ORDER_V)
+    if (pBrother->GetCount() > pBrother->GetOrder())
     {
         if (FLAG_LEFT == flag)    // Brother on left, move last data here
         {
-            NewData = pBrother->GetElement(pBrother->GetCount());
+            memcpy(NewData.data(), pBrother->GetElement(pBrother->GetCount()), this->max_key_size);
             NewDataPos = pBrother->GetElement_offt( pBrother->GetCount());
         }
         else    // Brother on right, move first data here
         {
-            NewData = pBrother->GetElement(1);
+            memcpy(NewData.data(), pBrother->GetElement(1), this->max_key_size);
             NewDataPos = pBrother->GetElement_offt(1);
         }
 
-        pOldNode->Insert(NewData, NewDataPos);
-        pBrother->Delete(NewData,false);
+        pOldNode->Insert(NewData.data(), NewDataPos);
+        pBrother->Delete(NewData.data(),false);
         pOldNode->flush_file();
-        pBrother->flush_file();
         // Modify father node's key value
-        if (FLAG_LEFT == flag)
+        for (int i = 2; i <= pFather->GetCount() + 1; i++)
         {
-            for (int i = 1; i <= pFather->GetCount() + 1; i++)
+            if (pFather->getPointer(i - 1) == pOldNode->getPtSelf())
             {
-                if (pFather->GetPointer(i)->getPtSelf()== pOldNode->getPtSelf()&&i > 1)
-                {
-                    pFather->SetElement(i - 1, pOldNode->GetElement(1));    // Change key corresponding to this node
-                }
+                pFather->SetElement(i - 1, pOldNode->GetElement(1));    // Change key corresponding to this node
             }
-        }
-        else
-        {
-            for (int i = 1; i <= pFather->GetCount() + 1; i++)
+            if (FLAG_RIGHT == flag && pFather->getPointer(i - 1) == pBrother->getPtSelf())
             {
-                if (pFather->GetPointer(i)->getPtSelf()==pOldNode->getPtSelf() &&i > 1)
-                {
-                    pFather->SetElement(i - 1, pOldNode->GetElement(1));    // Change key corresponding to this node
-                }
-                if (pFather->GetPointer(i)->getPtSelf()==pBrother->getPtSelf() && i > 1)
-                {
-                    pFather->SetElement(i - 1, pBrother->GetElement(1));    // Change key corresponding to brother node
-                }
+                pFather->SetElement(i - 1, pBrother->GetElement(1));    // Change key corresponding to brother node
             }
         }
 
         updateNode(pFather);
-        updateNode(pOldNode);
-        updateNode(pBrother);
+        delete pOldNode;
+        delete pBrother;
         return true;
     }
 
     // Case 2B
 
     // Key to delete in father node
-    void* NewKey = NULL;
+    vector<char> NewKey(this->max_key_size);
 
     // Combine this node with brother node, combine into the node with smaller data anyway, so father node doesn't need to modify pointer
 
     if (FLAG_LEFT == flag)
     {
         pBrother->Combine(pOldNode);
-        NewKey = pOldNode->GetElement(1);
-        //print_key(NewKey, this->key_kind);
+        memcpy(NewKey.data(), pOldNode->GetElement(1), this->max_key_size);
         CLeafNode* pOldNext = pOldNode->GetNextNode();
-        pBrother->SetPrevNode(pOldNext);
-        //pBrother->m_pNextNode = pOldNext;
+        pBrother->SetNextNode(pOldNext);
         // Delete node in doubly linked list
         if (NULL == pOldNext)
         {
             this->SetLeafTail(pBrother);
-            //m_pLeafTail = pBrother;
         }
         else
         {
             pOldNext->SetPrevNode(pBrother);
-            //pOldNext->m_pPrevNode = pBrother;
+            updateNode(pOldNext);
         }
         // Delete this node
         pBrother->flush_file();
-        delete pOldNode;
     }
     else
     {
         pOldNode->Combine(pBrother);
-        NewKey = pBrother->GetElement(1);
+        memcpy(NewKey.data(), pBrother->GetElement(1), this->max_key_size);
 
         CLeafNode* pOldNext = pBrother->GetNextNode();
         pOldNode->SetNextNode(pOldNext);
-        //pOldNode->m_pNextNode = pOldNext;
         // Delete node in doubly linked list
         if (NULL == pOldNext)
         {
             this->SetLeafTail(pOldNode);
-            //m_pLeafTail = pOldNode;
         }
         else
         {
             pOldNext->SetPrevNode(pOldNode);
-            //pOldNext->m_pPrevNode = pOldNode;
+            updateNode(pOldNext);
         }
         // Delete this node
         pOldNode->flush_file();
-        delete pBrother;
     }
+    delete pOldNode;
+    delete pBrother;
 
-    return DeleteInternalNode(pFather, NewKey);
+    bool ret = DeleteInternalNode(pFather, NewKey.data());
+    delete pFather;
+    return ret;
 }
 
 // Clear the whole tree, delete all nodes
@@ -1325,7 +1317,7 @@ bool BPlusTree::CheckNode(CNode* pNode)
     bool ret = false;
 
     // Check if 50% fill factor is satisfied
-    if ((pNode->GetCount() < ORDER_V) && (pNode != GetRoot()))
+    if ((pNode->GetCount() < pNode->GetOrder()) && (pNode->getPtSelf() != this->offt_root))
     {
         return false;
     }
@@ -1333,7 +1325,7 @@ bool BPlusTree::CheckNode(CNode* pNode)
     // Check if key or data are sorted
     for (i = 1; i < pNode->GetCount(); i++)
     {
-        if (pNode->GetElement(i) > pNode->GetElement(i + 1))
+        if (cmp(pNode->GetElement(i), pNode->GetElement(i + 1), this->key_kind, this->max_key_size))
         {
             return false;
         }
@@ -1347,7 +1339,9 @@ bool BPlusTree::CheckNode(CNode* pNode)
     // For internal nodes, recursively check subtrees
     for (i = 1; i <= pNode->GetCount() + 1; i++)
     {
-        ret = CheckNode(pNode->GetPointer(i));
+        CNode* pChild = pNode->GetPointer(i);
+        ret = CheckNode(pChild);
+        delete pChild;
         // If any one is invalid, return invalid
         if (false == ret)
         {
@@ -1373,7 +1367,7 @@ void BPlusTree::PrintTree()
     PrintNode(pRoot);
     total = 0;
     printf("\nLevel 2\n | ");
-    for (i = 1; i <= MAXNUM_POINTER; i++)
+    for (i = 1; i <= pRoot->GetCount() + 1; i++)
     {
         p1 = pRoot->GetPointer(i);
         if (NULL == p1) continue;
@@ -1383,11 +1377,11 @@ void BPlusTree::PrintTree()
     }
     total = 0;
     printf("\nLevel 3\n | ");
-    for (i = 1; i <= MAXNUM_POINTER; i++)
+    for (i = 1; i <= pRoot->GetCount() + 1; i++)
     {
         p1 = pRoot->GetPointer(i);
         if (NULL == p1) continue;
-        for (j = 1; j <= MAXNUM_POINTER; j++)
+        for (j = 1; j <= p1->GetCount() + 1; j++)
         {
             p2 = p1->GetPointer(j);
             if (NULL == p2) continue;
@@ -1398,15 +1392,15 @@ void BPlusTree::PrintTree()
     }
     total = 0;
     printf("\nLevel 4\n | ");
-    for (i = 1; i <= MAXNUM_POINTER; i++)
+    for (i = 1; i <= pRoot->GetCount() + 1; i++)
     {
         p1 = pRoot->GetPointer(i);
         if (NULL == p1) continue;
-        for (j = 1; j <= MAXNUM_POINTER; j++)
+        for (j = 1; j <= p1->GetCount() + 1; j++)
         {
             p2 = p1->GetPointer(j);
             if (NULL == p2) continue;
-            for (k = 1; k <= MAXNUM_POINTER; k++)
+            for (k = 1; k <= p2->GetCount() + 1; k++)
             {
                 p3 = p2->GetPointer(k);
                 if (NULL == p3) continue;
@@ -1426,7 +1420,7 @@ void BPlusTree::PrintNode(CNode* pNode)
         return;
     }
 
-    for (int i = 1; i <= MAXNUM_KEY; i++)
+    for (int i = 1; i <= pNode->GetCount(); i++)
     {
         if(this->key_kind==INT_KEY){
             cout<<*(int*)pNode->GetElement(i)<<" ";
@@ -1438,19 +1432,35 @@ void BPlusTree::PrintNode(CNode* pNode)
             cout<<(char*)pNode->GetElement(i)<<" ";
         }
         
-        if (i >= MAXNUM_KEY)
+        if (i >= pNode->GetCount())
         {
             printf(" | ");
         }
     }
 }
 
+off_t BPlusTree::SearchCached(void* data, vector<off_t>* path)
+{
+    return NodeCache::getInstance()->descend(this->fpath, this->offt_root, data, this->key_kind, this->max_key_size, path);
+}
+
 // Search for corresponding leaf node
-CLeafNode* BPlusTree::SearchLeafNode(void* data)
+CLeafNode* BPlusTree::SearchLeafNode(void* data, vector<off_t>* path)
 {
     int i = 0;
 
-    CNode* pNode = GetRoot();
+    // The upper levels come from the node cache, the rest is read from the pool
+    off_t offt = SearchCached(data, path);
+    CNode* pNode = NULL;
+    char type = FileManager::getInstance()->get_BlockType(this->fpath, offt);
+    if (type == BLOCK_INTER)
+    {
+        pNode = new CInternalNode(this->fpath, this->key_kind, this->max_key_size, offt);
+    }
+    else if (type == BLOCK_LEAF)
+    {
+        pNode = new CLeafNode(this->fpath, this->key_kind, this->max_key_size, offt);
+    }
     // Loop to find corresponding leaf node
     while (NULL != pNode)
     {
@@ -1460,17 +1470,13 @@ CLeafNode* BPlusTree::SearchLeafNode(void* data)
             break;
         }
 
-        // Find first key value greater than or equal to key
-        for (i = 1; i <= pNode->GetCount(); i++)
-        {
-            
-            if (cmp(pNode->GetElement(i), data,this->key_kind))
-            {
-                break;
-            }
-        }
+        // Find first key value greater than key
+        i = keyUpperBound((char*)pNode->GetElement(1), pNode->GetCount(), data, this->key_kind, this->max_key_size) + 1;
 
-        pNode = pNode->GetPointer(i);
+        if (path) path->push_back(pNode->getPtSelf());
+        CNode* pNext = pNode->GetPointer(i);
+        delete pNode;
+        pNode = pNext;
     }
 
     return (CLeafNode*)pNode;
@@ -1542,8 +1548,8 @@ bool BPlusTree::SetCorrentFather(CInternalNode* node){
     }
 }
 
-// Recursive function: Insert key into internal node
-bool BPlusTree::InsertInternalNode(CInternalNode* pNode, void* key, CNode* pRightSon)
+// Recursive function: Insert key into internal node, a split takes its blocks from spare
+bool BPlusTree::InsertInternalNode(CInternalNode* pNode, void* key, CNode* pRightSon, vector<off_t>& path, vector<CInternalNode*>& spare)
 {
     if (NULL == pNode || NODE_TYPE_LEAF == pNode->GetType())
     {
@@ -1551,39 +1557,38 @@ bool BPlusTree::InsertInternalNode(CInternalNode* pNode, void* key, CNode* pRigh
     }
 
     // Node is not full, insert directly
-    if (pNode->GetCount() < MAXNUM_KEY)
+    if (pNode->GetCount() < pNode->GetMaxCount())
     {
         bool ans=pNode->Insert(key, pRightSon);
         pNode->flush_file();
         return ans;
     }
 
-    CInternalNode* pBrother = new CInternalNode(this->fpath, this->key_kind, this->max_key_size, NEW_OFFT);  // In C++, new ClassName allocates memory space required for a class and returns its starting address
-    void* NewKey = INVALID;
-    // Split this node
-    NewKey = pNode->Split(pBrother, key);
-    //print_key(NewKey, this->key_kind);
-    if (pNode->GetCount() < pBrother->GetCount())
+    // Splitting the root also needs a new root
+    if (spare.size() < (path.empty() ? 2u : 1u))
     {
-        pNode->Insert(key, pRightSon);
-    }
-    else if (pNode->GetCount() > pBrother->GetCount())
-    {
-        pBrother->Insert(key, pRightSon);
+        return false;
     }
-    else    // Both are equal, i.e., the key is between the V-th and (V+1)-th keys, attach the child node to the first pointer of the new node
+    CInternalNode* pBrother = spare.back();
+    spare.pop_back();
+    CInternalNode* pNewRoot = NULL;
+    if (path.empty())
     {
-        pBrother->SetPointer(1, pRightSon);
-        pRightSon->SetFather(pBrother);
+        pNewRoot = spare.back();
+        spare.pop_back();
     }
-    pRightSon->flush_file();
-    CInternalNode* pFather = (CInternalNode*)(pNode->GetFather());
+    vector<char> NewKey(this->max_key_size);
+    // Split this node, the new key and its subtree go to whichever half they belong to
+    pNode->Split(pBrother, key, pRightSon, NewKey.data());
+    pNode->flush_file();
+    pBrother->flush_file();
+
     // Until root node is full, generate new root node
-    if (NULL == pFather)
+    if (NULL != pNewRoot)
     {
-        pFather = new CInternalNode(this->fpath, this->key_kind, this->max_key_size, NEW_OFFT);
+        CInternalNode* pFather = pNewRoot;
         pFather->SetPointer(1, pNode);        // Pointer 1 points to original node
-        pFather->SetElement(1, NewKey);       // Set key
+        pFather->SetElement(1, NewKey.data());    // Set key
         pFather->SetPointer(2, pBrother);     // Pointer 2 points to new node
         pNode->SetFather(pFather);            // Specify father node
         pBrother->SetFather(pFather);         // Specify father node
@@ -1596,12 +1601,16 @@ bool BPlusTree::InsertInternalNode(CInternalNode* pNode, void* key, CNode* pRigh
         delete pFather;
         return true;
     }
-    pNode->flush_file();
     // Recursion
-    return InsertInternalNode(pFather, NewKey, pBrother);
+    CInternalNode* pFather = new CInternalNode(this->fpath, this->key_kind, this->max_key_size, path.back());
+    path.pop_back();
+    bool ret = InsertInternalNode(pFather, NewKey.data(), pBrother, path, spare);
+    delete pBrother;
+    delete pFather;
+    return ret;
 }
 
-// Recursive function: Delete key in internal node
+// Recursive function: Delete key in internal node, the caller keeps ownership of pNode
 bool BPlusTree::DeleteInternalNode(CInternalNode* pNode, void* key)
 {
     // Delete key, if failed it must be not found, return failure directly
@@ -1619,29 +1628,19 @@ bool BPlusTree::DeleteInternalNode(CInternalNode* pNode, void* key)
         // If no data left, make the first node of the root node the new root
         if (0 == pNode->GetCount())
         {
-            SetRoot(pNode->GetPointer(1));
+            CNode* pRoot = pNode->GetPointer(1);
+            SetRoot(pRoot);
             pNode->FreeBlock(); // Free node
-            delete pNode;
+            delete pRoot;
         }
-        else SetRoot(pNode);
 
         return true;
     }
 
-    // Fill factor still >= 50% after deletion
-    if (pNode->GetCount() >= ORDER_V)
+    // Fill factor still >= 50% after deletion. A stale key in an ancestor still separates
+    // its subtrees correctly, so nothing above needs to change
+    if (pNode->GetCount() >= pNode->GetOrder())
     {
-        for (int i = 1; (i <= pFather->GetCount())&&(cmp(key , pFather->GetElement(i),this->key_kind) || eql(key, pFather->GetElement(i), this->key_kind)) ; i++)
-        {
-            // If the deleted key is from the father node, need to change that key
-            if (eql(pFather->GetElement(i) , key,this->key_kind))
-            {
-                CNode* node= pNode->GetPointer(i+1);
-                while(node->GetType()!=NODE_TYPE_LEAF)node=node->GetPointer(1);
-                pFather->SetElement(i, node->GetElement(1));    // Change to the new first element of the leaf node
-                pFather->flush_file();
-            }
-        }
         delete pFather;
         return true;
     }
@@ -1656,87 +1655,61 @@ bool BPlusTree::DeleteInternalNode(CInternalNode* pNode, void* key)
         if(a)pBrother = (CInternalNode*)(pNode->GetBrother(flag));
         
     }
-    if(pBrother==NULL)return true;// Return helplessly
+    if(pBrother==NULL)
+    {
+        delete pFather;
+        return true;// Return helplessly
+    }
     // Brother node fill factor > 50%
-    void* NewData = INVALID;
-    if (pBrother->GetCount() > ORDER_V)
+    if (pBrother->GetCount() > pBrother->GetOrder())
     {
         pNode->MoveOneElement(pBrother);
-        // Modify key value of father node
-        if (FLAG_LEFT == flag)
-        {
-            for (int i = 1; i <= pFather->GetCount() + 1; i++)
-            {
-                // if (pFather->GetPointer(i)->getPtSelf() == pNode->getPtSelf() && i > 1)
-                // {
-                //      pFather->SetElement(i - 1, pNode->GetElement(1));    // Change key corresponding to this node
-                // }
-                 if (pFather->GetPointer(i)->getPtSelf() == pNode->getPtSelf() && i > 1)
-                {
-                    CNode* node= pNode->GetPointer(1);
-                    while(node->GetType()!=NODE_TYPE_LEAF)node=node->GetPointer(1);
-                    pFather->SetElement(i - 1, node->GetElement(1));    // Change key corresponding to this node
-                }
-            }
-        }
-        else
+        // Modify key value of father node, the key in front of the right one of the two nodes
+        off_t offt_right = (FLAG_LEFT == flag) ? pNode->getPtSelf() : pBrother->getPtSelf();
+        CInternalNode* pRight = (FLAG_LEFT == flag) ? pNode : pBrother;
+        for (int i = 2; i <= pFather->GetCount() + 1; i++)
         {
-            for (int i = 1; i <= pFather->GetCount() + 1; i++)
+            if (pFather->getPointer(i - 1) == offt_right)
             {
-                // if (pFather->GetPointer(i)->getPtSelf() == pNode->getPtSelf() && i > 1)
-                // {
-                //      pFather->SetElement(i - 1, pNode->GetElement(1));    // Change key corresponding to this node
-                // }
-                // if (pFather->GetPointer(i)->getPtSelf() == pBrother->getPtSelf() && i > 1)
-                // {
-                //      pFather->SetElement(i - 1, pBrother->GetElement(1));    // Change key corresponding to brother node
-                // }
-                if (pFather->GetPointer(i)->getPtSelf() == pNode->getPtSelf() && i > 1)
-                {
-                    CNode* node= pNode->GetPointer(1);
-                    while(node->GetType()!=NODE_TYPE_LEAF)node=node->GetPointer(1);
-                    pFather->SetElement(i - 1, node->GetElement(1));    // Change key corresponding to this node
-                    //pFather->SetElement(i - 1, pNode->GetPointer(1)->GetElement(1));    // Change key corresponding to this node
-                }
-                if (pFather->GetPointer(i)->getPtSelf() == pBrother->getPtSelf() && i > 1)
-                {
-                    CNode* node= pBrother->GetPointer(1);
-                    while(node->GetType()!=NODE_TYPE_LEAF)node=node->GetPointer(1);
-                    pFather->SetElement(i - 1, node->GetElement(1));    // Change key corresponding to brother node
-                }
+                pRight->GetSubtreeMin(1, pFather->GetElement(i - 1));
             }
         }
         updateNode(pFather);
-        updateNode(pBrother);
-        pNode->flush_file();
+        delete pBrother;
         return true;
     }
 
     // Key to delete in father node: brother nodes are not > 50%, need to merge nodes, father node needs to delete key
-    void* NewKey = NULL;
+    vector<char> NewKey(this->max_key_size);
 
     // Merge this node with brother node, strictly merge into the node with smaller data, so father node pointer doesn't need modification
     if (FLAG_LEFT == flag)
     {
+        memcpy(NewKey.data(), pNode->GetElement(1), this->max_key_size);
         pBrother->Combine(pNode);
-        NewKey = pNode->GetElement(1);
         pBrother->flush_file();
-        pNode->FreeBlock();
-        delete pNode;
     }
     else
     {
+        memcpy(NewKey.data(), pBrother->GetElement(1), this->max_key_size);
         pNode->Combine(pBrother);
-        NewKey = pBrother->GetElement(1);
         pNode->flush_file();
-        //pBrother->FreeBlock();
-        delete pBrother;
     }
+    delete pBrother;
 
     // Recursion
-    return DeleteInternalNode(pFather, NewKey);
+    bool ret = DeleteInternalNode(pFather, NewKey.data());
+    delete pFather;
+    return ret;
 }
-void BPlusTree::Select_Data(vector<string>attributenames,vector<LOGIC>Logics,vector<WhereCondition>w){
+void BPlusTree::Select_Data(vector<string>attributenames,vector<LOGIC>Logics,vector<WhereCondition>w,OrderLimit order){
+    // The leaf chain gives key order without a sort, other orders are not supported
+    bool by_key=!order.attribute.empty();
+    if(by_key&&_stricmp(order.attribute.c_str(),this->key_attr)!=0){
+        cout<<"error:ORDER BY supports only the primary key"<<endl;
+        return;
+    }
+    long long printed=0;
     // First write the detection only for id
     if(w.size()==1&&_stricmp(w[0].attribute.c_str(),this->key_attr)==0&&w[0].operatorSymbol=="="){
         void* key;
@@ -1744,23 +1717,46 @@ void BPlusTree::Select_Data(vector<string>attributenames,vector<LOGIC>Logics,vec
             key=str2value(w[0].value, this->key_kind);
         }
         off_t offt_data=this->Search(key);
-        if(offt_data==INVALID){
+        void* data[ATTR_MAX_NUM];
+        if(offt_data==INVALID||order.limit==0||!this->Get_Data(data, offt_data)){
             this->Print_Header(attributenames);
             return;
         }
-        void* data[ATTR_MAX_NUM];
-        this->Get_Data(data, offt_data);
         this->Print_Header(attributenames);
         this->Print_Data(data,attributenames);
         return;
     }
+    // A range on the primary key reads only its part of the leaf chain. ORDER BY the key walks
+    // the chain even without one, and LIMIT stops the walk early
+    KeyRange range;
+    if(this->GetKeyRange(w, Logics, range)||by_key){
+        this->Print_Header(attributenames);
+        CRangeCursor cursor(this, range, order.descending);
+        for(off_t rid=cursor.Next(); rid!=INVALID&&(order.limit<0||printed<order.limit); rid=cursor.Next()){
+            void* data[ATTR_MAX_NUM];
+            if(!this->Get_Data(data, rid))continue;
+            if(this->SatisfyConditions(w, Logics, data)){
+                this->Print_Data(data,attributenames);
+                printed++;
+            }
+        }
+        return;
+    }
     // Write other cases after finishing traversal
     this->Print_Header(attributenames);
-    for(int i=0;i<NUM_ALL_BLOCK;i++){
-        if(this->Block_GRAPH[i]==BLOCK_DATA){
+    FileManager* fm = FileManager::getInstance();
+    vector<off_t> rids;
+    fm->scan_hint(this->fpath);
+    for(off_t i=fm->next_Block(this->fpath, 0, BLOCK_DATA); i!=INVALID&&(order.limit<0||printed<order.limit); i=fm->next_Block(this->fpath, i+1, BLOCK_DATA)){
+        rids.clear();
+        fm->get_records(this->fpath, i, rids);
+        for(int j=0;j<rids.size()&&(order.limit<0||printed<order.limit);j++){
             void* data[ATTR_MAX_NUM];
-            this->Get_Data(data, i);
-            if(this->SatisfyConditions(w, Logics, data))this->Print_Data(data,attributenames);
+            if(!this->Get_Data(data, rids[j]))continue;
+            if(this->SatisfyConditions(w, Logics, data)){
+                this->Print_Data(data,attributenames);
+                printed++;
+            }
         }
     }
 
@@ -1958,10 +1954,16 @@ void BPlusTree::Select_Data_Join(vector<string>attributenames, vector<LOGIC>Logi
     }
 
     // Execute Nested Loop Join
-    for (int i = 0; i < NUM_ALL_BLOCK; i++) {
-        if (this->Block_GRAPH[i] == BLOCK_DATA) {
+    FileManager* fm = FileManager::getInstance();
+    vector<off_t> rids;
+    vector<off_t> rids2;
+    fm->scan_hint(this->fpath);
+    for (off_t i = fm->next_Block(this->fpath, 0, BLOCK_DATA); i != INVALID; i = fm->next_Block(this->fpath, i + 1, BLOCK_DATA)) {
+        rids.clear();
+        fm->get_records(this->fpath, i, rids);
+        for (off_t rid : rids) {
             void* data[ATTR_MAX_NUM];
-            this->Get_Data(data, i);
+            if(!this->Get_Data(data, rid))continue;
 
             // 1. Check main table conditions
             if (this->SatisfyConditions(wc1, Logics, data)) {
@@ -1978,10 +1980,12 @@ void BPlusTree::Select_Data_Join(vector<string>attributenames, vector<LOGIC>Logi
                 for (size_t k = 0; k < wc_join.size(); k++) logic_join.push_back(AND_LOGIC);
 
                 // 3. Scan joined table
-                for (int j = 0; j < NUM_ALL_BLOCK; j++) {
-                    if (this->joinBp->Block_GRAPH[j] == BLOCK_DATA) {
+                for (off_t j = fm->next_Block(this->joinBp->fpath, 0, BLOCK_DATA); j != INVALID; j = fm->next_Block(this->joinBp->fpath, j + 1, BLOCK_DATA)) {
+                    rids2.clear();
+                    fm->get_records(this->joinBp->fpath, j, rids2);
+                    for (off_t rid2 : rids2) {
                         void* data2[ATTR_MAX_NUM];
-                        this->joinBp->Get_Data(data2, j);
+                        if(!this->joinBp->Get_Data(data2, rid2))continue;
 
                         if (this->joinBp->SatisfyConditions(wc_join, logic_join, data2)) {
                             this->Print_Data_Join(data, data2, attributenames);
@@ -2121,9 +2125,48 @@ bool BPlusTree::SatisfyConditions(vector<WhereCondition>w,vector<LOGIC>Logics,vo
     return flag1;
 }
 
+bool BPlusTree::GetKeyRange(vector<WhereCondition>w,vector<LOGIC>Logics,KeyRange& range){
+    // Behind an OR a row can match with any key
+    for(int i=0;i<Logics.size();i++){
+        if(Logics[i]!=AND_LOGIC)return false;
+    }
+    bool found=false;
+    for(int i=0;i<w.size();i++){
+        if(_stricmp(w[i].attribute.c_str(), this->key_attr)!=0)continue;
+        string op=w[i].operatorSymbol;
+        bool equal=(op=="="||op=="==");
+        if(!equal&&op!="<"&&op!="<="&&op!=">"&&op!=">=")continue;
+        void* key=str2value(w[i].value, this->key_kind);
+        if(key==NULL)continue;
+        bool inclusive=(equal||op.size()==2);
+        // Strings are copied at least max_key_size wide, the width keys are compared over
+        size_t size=sizeof(int);
+        if(this->key_kind==LL_KEY)size=sizeof(long long);
+        else if(this->key_kind==STRING_KEY)size=max(this->max_key_size, strlen((char*)key)+1);
+        // Keep the tighter of the bounds
+        if(equal||op[0]=='>'){
+            if(range.low==NULL||cmp(key,range.low,this->key_kind)
+                ||(!inclusive&&eql(key,range.low,this->key_kind))){
+                range.setLow(key, size, inclusive);
+            }
+        }
+        if(equal||op[0]=='<'){
+            if(range.high==NULL||cmp(range.high,key,this->key_kind)
+                ||(!inclusive&&eql(key,range.high,this->key_kind))){
+                range.setHigh(key, size, inclusive);
+            }
+        }
+        free_value(key, this->key_kind);
+        found=true;
+    }
+    return found;
+}
+
 bool BPlusTree::Delete_Data(vector<WhereCondition>w,vector<LOGIC>Logics){
     if(w.size()==0){
-        // delete the whole tree
+        // delete the whole tree, the root's pinned block goes first so its frame can be dropped
+        delete this->m_Root;
+        this->m_Root=NULL;
         FileManager::getInstance()->deleteFile(this->fpath);
         return true;
     }
@@ -2139,10 +2182,31 @@ bool BPlusTree::Delete_Data(vector<WhereCondition>w,vector<LOGIC>Logics){
         }
     }
     if(key_index==-1)return false;
-    for(int i=0;i<NUM_ALL_BLOCK;i++){
-        if(this->Block_GRAPH[i]==BLOCK_DATA){
+    vector<off_t> rids;
+    KeyRange range;
+    if(this->GetKeyRange(w, Logics, range)){
+        // Collect first, deleting changes the leaves the cursor walks
+        {
+            CRangeCursor cursor(this, range);
+            for(off_t rid=cursor.Next(); rid!=INVALID; rid=cursor.Next())rids.push_back(rid);
+        }
+        for(off_t rid : rids){
+            void* data[ATTR_MAX_NUM];
+            if(!this->Get_Data(data, rid))continue;
+            if(SatisfyConditions(w,Logics,data)){
+                this->Delete(data[key_index]);
+            }
+        }
+        return true;
+    }
+    FileManager* fm = FileManager::getInstance();
+    fm->scan_hint(this->fpath);
+    for(off_t i=fm->next_Block(this->fpath, 0, BLOCK_DATA); i!=INVALID; i=fm->next_Block(this->fpath, i+1, BLOCK_DATA)){
+        rids.clear();
+        fm->get_records(this->fpath, i, rids);
+        for(off_t rid : rids){
             void* data[ATTR_MAX_NUM];
-            this->Get_Data(data, i);
+            if(!this->Get_Data(data, rid))continue;
             if(SatisfyConditions(w,Logics,data)){
                 this->Delete(data[key_index]);
             }
@@ -2157,59 +2221,57 @@ bool BPlusTree::Update_Data(vector<WhereCondition> whereConditions, vector<Where
         cout << "Error: No attributes specified for update" << endl;
         return false;
     }
+    // The leaves are ordered by the primary key, a record can't change its key in place
+    for (auto& s : setAttributes) {
+        if (_stricmp(s.attribute.c_str(), this->key_attr) == 0) {
+            cout << "Error: The primary key " << this->key_attr << " cannot be updated" << endl;
+            return false;
+        }
+    }
     
     int update_count = 0;
-    
-    // Simple implementation: Only handle the case where the root node is a leaf
-    if (m_Root && m_Root->GetType() == NODE_TYPE_LEAF) {
-        CLeafNode* pLeaf = (CLeafNode*)m_Root;
-        
-        for (int i = 1; i <= pLeaf->GetCount(); i++) {
-            off_t data_offset = pLeaf->GetElement_offt(i);
-            if (data_offset == 0 || data_offset == INVALID) continue;
-            
-            void* data[ATTR_MAX_NUM];
-            this->Get_Data(data, data_offset);
-            
-            // Check WHERE conditions
-            bool satisfy = true;
-            for (auto& w : whereConditions) {
-                for (int j = 0; j < this->attr_num; j++) {
-                    #ifdef _WIN32
-                        if (_stricmp(w.attribute.c_str(), this->attr[j].name) == 0)
-                    #else
-                        if (strcasecmp(w.attribute.c_str(), this->attr[j].name) == 0)
-                    #endif
-                    {
-                        void* cmp_val = str2value(w.value, this->attr[j].key_kind);
-                        if (w.operatorSymbol == "=" && !eql(data[j], cmp_val, this->attr[j].key_kind)) {
-                            satisfy = false;
-                        }
-                        break;
-                    }
-                }
-            }
-            
-            if (satisfy) {
-                // Update attributes
-                for (auto& s : setAttributes) {
-                    for (int k = 0; k < this->attr_num; k++) {
-                        #ifdef _WIN32
-                            if (_stricmp(s.attribute.c_str(), this->attr[k].name) == 0)
-                        #else
-                            if (strcasecmp(s.attribute.c_str(), this->attr[k].name) == 0)
-                        #endif
-                        {
-                            data[k] = str2value(s.value, this->attr[k].key_kind);
-                            break;
-                        }
-                    }
+
+    // UPDATE conditions are all joined with AND
+    vector<LOGIC> Logics;
+    for (size_t i = 1; i < whereConditions.size(); i++) Logics.push_back(AND_LOGIC);
+
+    // Rows to check: the primary key range when the conditions give one, every row otherwise
+    vector<off_t> rids;
+    KeyRange range;
+    if (this->GetKeyRange(whereConditions, Logics, range)) {
+        CRangeCursor cursor(this, range);
+        for (off_t rid = cursor.Next(); rid != INVALID; rid = cursor.Next()) rids.push_back(rid);
+    }
+    else {
+        FileManager* fm = FileManager::getInstance();
+        fm->scan_hint(this->fpath);
+        for (off_t i = fm->next_Block(this->fpath, 0, BLOCK_DATA); i != INVALID; i = fm->next_Block(this->fpath, i + 1, BLOCK_DATA)) {
+            fm->get_records(this->fpath, i, rids);
+        }
+    }
+
+    for (off_t data_offset : rids) {
+        void* data[ATTR_MAX_NUM];
+        if (!this->Get_Data(data, data_offset)) continue;
+        if (!this->SatisfyConditions(whereConditions, Logics, data)) continue;
+
+        // Update attributes
+        for (auto& s : setAttributes) {
+            for (int k = 0; k < this->attr_num; k++) {
+                #ifdef _WIN32
+                    if (_stricmp(s.attribute.c_str(), this->attr[k].name) == 0)
+                #else
+                    if (strcasecmp(s.attribute.c_str(), this->attr[k].name) == 0)
+                #endif
+                {
+                    data[k] = str2value(s.value, this->attr[k].key_kind);
+                    break;
                 }
-                
-                FileManager::getInstance()->flush_data(this->fpath, data, this->attr, this->attr_num, data_offset);
-                update_count++;
             }
         }
+        
+        FileManager::getInstance()->flush_data(this->fpath, data, this->attr, this->attr_num, data_offset);
+        update_count++;
     }
     
     cout << "Updated " << update_count << " records" << endl;
@@ -14,11 +14,6 @@
 #include <ios>
 #include <string.h>
 #include <sys/types.h>
-#define ORDER_V 2    
-
-#define MAXNUM_KEY (ORDER_V * 2)    
-#define MAXNUM_POINTER (MAXNUM_KEY + 1)    
-#define MAXNUM_DATA (ORDER_V * 2) 
 #include<string>
 #include<iostream>
 #include <sstream>
@@ -27,6 +22,9 @@
 #include <vector>
 using namespace std;
 #include"rwdata.h"
+#include "BufferPool.h"
+#include "NodeCache.h"
+#include "KeySearch.h"
 
 
 #define TYPE_KEY 0
@@ -38,18 +36,19 @@ using namespace std;
 #define NEW_OFFT 0
 typedef int LOGIC;
 
-static int cmp(void* a, void* b,KEY_KIND key_kind) {
+// size bounds string comparison, node keys are stored in max_key_size bytes without a terminator
+static int cmp(void* a, void* b,KEY_KIND key_kind, size_t size = 1024) {
     if(key_kind == INT_KEY) {
         return *(int*)a > *(int*)b;
     }
     else if(key_kind == LL_KEY) {
         return *(long long*)a > *(long long*)b;
     }
-    int i= strncmp((char *)a, (char *)b, 1024);
+    int i= strncmp((char *)a, (char *)b, size);
     return i>0;
 }
 
-static int eql(void* a, void* b,KEY_KIND key_kind) {
+static int eql(void* a, void* b,KEY_KIND key_kind, size_t size = 1024) {
     if(key_kind == INT_KEY) {
         return *(int*)a == *(int*)b;
     }
@@ -57,7 +56,7 @@ static int eql(void* a, void* b,KEY_KIND key_kind) {
         return *(long long*)a == *(long long*)b;
     }
     // May need modification later
-    return strncmp((char *)a, (char *)b, 1024)==0;
+    return strncmp((char *)a, (char *)b, size)==0;
 }
 
 static void* Invalid(KEY_KIND key_kind) {
@@ -124,6 +123,12 @@ static void* str2value(string value, KEY_KIND key_kind) {
     
     return nullptr;
 }
+// Free a value made by str2value
+static void free_value(void* value, KEY_KIND key_kind) {
+    if(key_kind == INT_KEY) delete (int*)value;
+    else if(key_kind == LL_KEY) delete (long long*)value;
+    else delete[] (char*)value;
+}
 static string value2str(void* value, KEY_KIND key_kind) {
     switch (key_kind) {
         case INT_KEY:
@@ -155,8 +160,12 @@ public:
     // Get and Set valid data count
     int GetCount() { return m_Count; }
     void SetCount(int i) { m_Count = i; }
+    // Order v of the node, it holds at most 2v keys (see NODE_ORDER)
+    int GetOrder() { return m_Order; }
+    int GetMaxCount() { return 2 * m_Order; }
 
-    // Get and Set an element. For internal nodes it means key, for leaf nodes it means data; need to change to void* later
+    // Get and Set an element. For internal nodes it means key, for leaf nodes it means data.
+    // The returned pointer refers to the node's block and is only valid until the node changes
     virtual void* GetElement(int i) { return 0; }
     virtual void SetElement(int i, void* value) { }
 
@@ -194,6 +203,8 @@ protected:
 
     size_t max_size;    // Maximum size of node index data
 
+    int m_Order;    // Order v derived from max_size
+
     int m_Count;    // Valid data count, key count for internal nodes, data count for leaf nodes
 
     CNode* m_pFather;     // Pointer to father node. Standard B+ tree doesn't have this pointer, added for faster split and rotate operations
@@ -201,6 +212,15 @@ protected:
     off_t offt_father;   // Position of father node data in file
 
     off_t offt_self;   // Position of node data in file
+
+    // Pin the node's block for the life of the node and return it, zeroed for a new node.
+    // Keys and offsets are edited in place in the block, flush_file writes the node structure
+    // and logs it. One statement changes a tree at a time, so editing needs no latch
+    char* AttachBlock(bool fresh);
+
+    PageGuard m_Page;    // The node's pinned block
+    char* m_Block;       // Its data, or m_Spare
+    char* m_Spare;       // Zeroed stand-in when the pool had no frame, as an empty node
 };
 
 static void updateNode(CNode* node) {
@@ -225,18 +245,19 @@ public:
     bool Insert(void* value, CNode* pNode);
     bool Delete(void* value);
 
-    // Split node
-    void* Split(CInternalNode* pNode, void* key);
+    // Split a full node while inserting key and its right subtree, the upper half moves to pNode
+    // and the middle key, which goes up to the father, is copied to RetKey
+    bool Split(CInternalNode* pNode, void* key, CNode* pRightSon, void* RetKey);
     // Merge node
     bool Combine(CNode* pNode);
     // Move one element from another node to this node
     bool MoveOneElement(CNode* pNode);
+    // Copy the smallest key of the i-th subtree to key
+    bool GetSubtreeMin(int i, void* key);
 
     // Set pointer data when reading file
     void setPointers(off_t offt_pointer[]) {
-        for (int i = 0; i < MAXNUM_POINTER; i++) {
-            this->offt_pointers[i] = offt_pointer[i];
-        }
+        memcpy(this->offt_pointers, offt_pointer, sizeof(off_t) * (GetMaxCount() + 1));
     }
     // Return next node's file pointer based on index
     off_t getPointer(int index) {
@@ -250,15 +271,17 @@ public:
     // Function used for testing
     void print_data(){
         cout<<"Offset is: "<<this->offt_self<<" "<<"Internal Node"<<endl;
-        for(int i=0;i<MAXNUM_KEY;i++){
-            print_key(this->m_Keys[i], this->key_kind);
+        for(int i=1;i<=m_Count;i++){
+            print_key(this->GetElement(i), this->key_kind);
         }
     }
     
 protected:
+    // Point the father of the children in pointers [from, to] at this node
+    void AdoptChildren(int from, int to, CNode* pLoaded);
 
-    void* m_Keys[MAXNUM_KEY];           // Key array
-    off_t offt_pointers[MAXNUM_POINTER];     // Pointer array
+    char* m_Keys;           // Key array in the block, 2v keys of max_size bytes
+    off_t* offt_pointers;     // Pointer array in the block, 2v+1 child blocks
     
 };
 
@@ -278,7 +301,7 @@ public:
     off_t GetElement_offt(int i);
     void SetElement(int i, void* data);
     void SetElement_offt(int i,off_t offt){
-        if ((i > 0) && (i <= MAXNUM_KEY))
+        if ((i > 0) && (i <= GetMaxCount()))
         {
             this->offt_data[i - 1] = offt;
         }
@@ -323,11 +346,11 @@ public:
     // Function used for testing
     void print_data(){
         cout<<"Offset is: "<<this->getPtSelf()<<" Leaf Node"<<endl;
-        for(int i=0;i<MAXNUM_DATA;i++){
-            print_key(this->m_Datas[i], this->key_kind);
+        for(int i=1;i<=m_Count;i++){
+            print_key(this->GetElement(i), this->key_kind);
         }
         cout<<"Data block position is ";
-        for(int i=0;i<MAXNUM_DATA;i++){
+        for(int i=0;i<m_Count;i++){
             cout<<this->offt_data[i]<<" ";
         }
     }
@@ -337,12 +360,65 @@ public:
     CLeafNode* m_pNextNode;                 // Next node
     off_t offt_PrevNode;                    // Previous node offset in file
     off_t offt_NextNode;                    // Next node offset in file
-    off_t offt_data[MAXNUM_DATA];    // Data offset in file
+    off_t* offt_data;    // Record ids in the block, 2v entries
 protected:
-    void* m_Datas[MAXNUM_DATA];    // Data array, delete after finishing debug
+    char* m_Datas;    // Key array in the block, 2v keys of max_size bytes
     
 };
 
+// Bounds on the primary key, NULL for an open end. The range holds its own copy of each bound
+struct KeyRange {
+    void* low;
+    void* high;
+    bool low_inclusive;
+    bool high_inclusive;
+    KeyRange() : low(NULL), high(NULL), low_inclusive(true), high_inclusive(true) {}
+    KeyRange(const KeyRange& other) : KeyRange() { *this = other; }
+    KeyRange& operator=(const KeyRange& other) {
+        low_key = other.low_key;
+        high_key = other.high_key;
+        low = other.low != NULL ? low_key.data() : NULL;
+        high = other.high != NULL ? high_key.data() : NULL;
+        low_inclusive = other.low_inclusive;
+        high_inclusive = other.high_inclusive;
+        return *this;
+    }
+    void setLow(const void* key, size_t size, bool inclusive) {
+        low_key.assign((const char*)key, (const char*)key + size);
+        low = low_key.data();
+        low_inclusive = inclusive;
+    }
+    void setHigh(const void* key, size_t size, bool inclusive) {
+        high_key.assign((const char*)key, (const char*)key + size);
+        high = high_key.data();
+        high_inclusive = inclusive;
+    }
+private:
+    vector<char> low_key;
+    vector<char> high_key;
+};
+
+class BPlusTree;
+
+// Walks the records of a key range in key order: one descent to the leaf holding the lower bound,
+// then along offt_NextNode until the upper bound. Descending starts from the upper bound and
+// follows offt_PrevNode instead. Only the current leaf is held, and the tree must not change
+// while the cursor is open
+class CRangeCursor
+{
+public:
+    CRangeCursor(BPlusTree* tree, const KeyRange& range, bool descending = false);
+    ~CRangeCursor();
+    // Record id of the next key in the range, INVALID once past the upper bound
+    off_t Next();
+private:
+    BPlusTree* tree;
+    KeyRange range;
+    bool descending;
+    CLeafNode* leaf;
+    int pos;    // Next element of leaf, 1 based
+};
+
 // B+ Tree data structure
 class BPlusTree
 {
@@ -358,14 +434,14 @@ public:
     // Insert specific data
     off_t Insert(void* data);
     bool Insert_Data(vector<vector<string>> data);
-    void Get_Data(void* data[ATTR_MAX_NUM],off_t offt);
+    bool Get_Data(void* data[ATTR_MAX_NUM],off_t offt);
     void Print_Data(void* data[ATTR_MAX_NUM]);
     // Print only one record
     void Print_Data(void* data[ATTR_MAX_NUM],vector<string>attributenames);
     void Print_Data_Join(void* data1[ATTR_MAX_NUM],void* data2[ATTR_MAX_NUM],vector<string>attributenames);
     void Print_Header(vector<string>attributenames);
     void Print_Header_Join(vector<string>attributenames);
-    void Select_Data(vector<string>attributenames,vector<LOGIC>Logics,vector<WhereCondition>w);
+    void Select_Data(vector<string>attributenames,vector<LOGIC>Logics,vector<WhereCondition>w,OrderLimit order=OrderLimit());
     void Select_Data_Join(vector<string>attributenames,vector<LOGIC>Logics,vector<WhereCondition>w);
     bool SatisfyCondition(WhereCondition w,void* data[ATTR_MAX_NUM]);
     bool SatisfyConditions(vector<WhereCondition>w,vector<LOGIC>Logics,void* data[ATTR_MAX_NUM]);
@@ -373,6 +449,8 @@ public:
     bool Delete(void* data);
     bool Delete_Data(vector<WhereCondition>w,vector<LOGIC>Logics);
     bool Update_Data(vector<WhereCondition>w,vector<WhereCondition>attributenames);
+    // Bounds on the primary key implied by conditions joined with AND, false if they imply none
+    bool GetKeyRange(vector<WhereCondition>w,vector<LOGIC>Logics,KeyRange& range);
     // Clear tree
     void ClearTree();
     // Print tree
@@ -416,19 +494,27 @@ public:
     char fpath[100];     // File, i.e., table path
     size_t max_key_size;
     CNode* m_Root;    // Root node
-    char Block_GRAPH[NUM_ALL_BLOCK];
 protected:
 
-    // Search leaf node for insertion
-    CLeafNode* SearchLeafNode(void* data);
-    // Insert key into internal node
-    bool InsertInternalNode(CInternalNode* pNode, void* key, CNode* pRightSon);
+    // Search leaf node for insertion. path, if given, receives the internal nodes passed on
+    // the way down, root first, so a split can go back up without reading father pointers
+    CLeafNode* SearchLeafNode(void* data, vector<off_t>* path = NULL);
+    // Walk the decoded internal levels from the root towards data, returns the block of the
+    // first node not in the node cache: the leaf, or an internal node when the cache is full
+    off_t SearchCached(void* data, vector<off_t>* path);
+    // Insert key into internal node, path holds the ancestors of pNode (its father last).
+    // Splits use the blocks Insert reserved in spare, FreeSpare returns the ones left over
+    bool InsertInternalNode(CInternalNode* pNode, void* key, CNode* pRightSon, vector<off_t>& path, vector<CInternalNode*>& spare);
+    void FreeSpare(vector<CInternalNode*>& spare);
     // Delete key from internal node
     bool DeleteInternalNode(CInternalNode* pNode, void* key);
     bool SetCorrentFather(CLeafNode* leaf);
     bool SetCorrentFather(CInternalNode* leaf);
     bool parser_ref_table(const std::string& fname);
     off_t offt_root;    // Offset of root node in file
+    off_t offt_data_tail;    // Data block new records are appended to
+    char pool[20];    // Buffer pool partition, kept as read from the table header
+    int storage;      // TABLE_STORAGE_*, kept as read from the table header
     int m_Depth;      // Tree depth
     size_t key_use_block;
     size_t value_use_block;
@@ -441,6 +527,7 @@ protected:
     BPlusTree* joinBp;
     string ref_table="None";
     string foreign_key;
-    
+
+    friend class CRangeCursor;
 };
 
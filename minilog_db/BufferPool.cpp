@@ -1,49 +1,584 @@
 #include "BufferPool.h"
 #include <iostream>
 #include <cstdio>
+#include <fstream>
+#include <new>
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <climits>
 
 BufferPool* BufferPool::instance = nullptr;
+BufferPoolConfig BufferPool::config;
 
-BufferPool::BufferPool() : next_free_page(0) {
-    // Initialize page pool
-    for (int i = 0; i < BUFFER_POOL_SIZE; i++) {
-        pages[i] = Page();
+static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string::npos) return "";
+    size_t e = s.find_last_not_of(" \t\r\n");
+    return s.substr(b, e - b + 1);
+}
+
+bool BufferPoolConfig::set(const std::string& key, const std::string& value) {
+    if (key == "pool_pages") {
+        char* end = nullptr;
+        long long n = strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || n <= 0) return false;
+        pool_pages = n < BUFFER_POOL_MIN_SIZE ? BUFFER_POOL_MIN_SIZE : (size_t)n;
+        return true;
+    }
+    if (key == "replacer") {
+        if (_stricmp(value.c_str(), "lru") == 0) replacer = REPLACER_LRU;
+        else if (_stricmp(value.c_str(), "clock") == 0) replacer = REPLACER_CLOCK;
+        else if (_stricmp(value.c_str(), "2q") == 0) replacer = REPLACER_2Q;
+        else return false;
+        return true;
+    }
+    if (key == "io_backend") {
+        if (_stricmp(value.c_str(), "uring") == 0) io_backend = IO_BACKEND_URING;
+        else if (_stricmp(value.c_str(), "threads") == 0) io_backend = IO_BACKEND_THREADS;
+        else return false;
+        return true;
+    }
+    if (key == "dirty_target") {
+        char* end = nullptr;
+        double d = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || d < 0 || d > 1) return false;
+        dirty_target = d;
+        return true;
+    }
+    if (key == "writer_interval_ms") {
+        char* end = nullptr;
+        long n = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || n < 0) return false;
+        writer_interval_ms = (int)n;
+        return true;
+    }
+    if (key == "read_ahead_pages") {
+        char* end = nullptr;
+        long n = strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || n < 0 || n > IOV_MAX) return false;
+        read_ahead_pages = (size_t)n;
+        return true;
+    }
+    if (key == "partition") {
+        std::string fields = value;
+        std::replace(fields.begin(), fields.end(), ':', ' ');
+        std::replace(fields.begin(), fields.end(), ',', ' ');
+        std::istringstream in(fields);
+        BufferPartition part;
+        long long min_pages = -1, max_pages = 0;
+        if (!(in >> part.name >> min_pages) || min_pages < 0) return false;
+        if (in >> max_pages) {
+            if (max_pages < min_pages) return false;
+        }
+        std::string rest;
+        if (in >> rest) return false;
+        if (part.name.size() >= BUFFER_POOL_PARTITION_NAME) return false;
+        for (char c : part.name) {
+            if (!isalnum((unsigned char)c) && c != '_') return false;
+        }
+        part.min_pages = (size_t)min_pages;
+        // 0 or no maximum: it may grow to the whole pool
+        part.max_pages = max_pages > 0 ? (size_t)max_pages : 0;
+        
+        // Repeating a name replaces its quota
+        for (BufferPartition& p : partitions) {
+            if (p.name == part.name) {
+                p = part;
+                return true;
+            }
+        }
+        if (partitions.size() + 1 >= BUFFER_POOL_MAX_PARTITIONS) return false;
+        partitions.push_back(part);
+        return true;
+    }
+    if (key == "compressed_pages") {
+        char* end = nullptr;
+        long long n = strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || n < 0) return false;
+        compressed_pages = (size_t)n;
+        return true;
+    }
+    if (key == "huge_pages") {
+        huge_pages = (value == "1" || _stricmp(value.c_str(), "on") == 0 || _stricmp(value.c_str(), "true") == 0);
+        return true;
+    }
+    return false;
+}
+
+bool BufferPoolConfig::loadFile(const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
     }
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        size_t eq = line.find('=');
+        if (line.empty() || eq == std::string::npos) continue;
+        std::string key = trim(line.substr(0, eq));
+        if (!set(key, trim(line.substr(eq + 1)))) {
+            std::cerr << "Ignoring config line: " << line << std::endl;
+        }
+    }
+    return true;
 }
 
-BufferPool* BufferPool::getInstance() {
-    if (instance == nullptr) {
-        instance = new BufferPool();
+bool BufferPoolConfig::parseFlag(const char* arg) {
+    std::string flag(arg);
+    if (flag.compare(0, 2, "--") != 0) return false;
+    size_t eq = flag.find('=');
+    std::string key = flag.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+    // "--huge_pages" alone switches it on
+    std::string value = eq == std::string::npos ? "1" : flag.substr(eq + 1);
+    if (key == "config") return loadFile(value.c_str());
+    return set(key, value);
+}
+
+FileRegistry* FileRegistry::getInstance() {
+    static FileRegistry* registry = new FileRegistry();
+    return registry;
+}
+
+uint32_t FileRegistry::getId(const char* filename) {
+    // Page traffic mostly stays on one file, remember the last name this thread asked for
+    thread_local char last_name[100] = { 0 };
+    thread_local uint32_t last_id = INVALID_FILE_ID;
+    if (last_id != INVALID_FILE_ID && strcmp(last_name, filename) == 0) {
+        return last_id;
     }
-    return instance;
+    
+    uint32_t id = findId(filename);
+    if (id == INVALID_FILE_ID) {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        auto it = ids.find(filename);
+        if (it != ids.end()) {
+            id = it->second;
+        } else {
+            id = (uint32_t)files.size();
+            files.push_back(FileEntry{ filename, -1, 0, false, nullptr, 0 });
+            ids.emplace(filename, id);
+        }
+    }
+    
+    if (strlen(filename) < sizeof(last_name)) {
+        strcpy(last_name, filename);
+        last_id = id;
+    }
+    return id;
 }
 
-bool BufferPool::loadPage(const char* filename, off_t offset, Page* page) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        // File does not exist, create new page
-        memset(page->data, 0, DB_BLOCK_SIZE);
-        strcpy(page->filename, filename);
-        page->offset = offset;
-        page->is_dirty = false;
-        page->pin_count = 0;
-        return true;
+uint32_t FileRegistry::findId(const char* filename) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    auto it = ids.find(filename);
+    return it == ids.end() ? INVALID_FILE_ID : it->second;
+}
+
+int FileRegistry::getFd(uint32_t file_id, bool create) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        if (file_id >= files.size()) {
+            return -1;
+        }
+        if (files[file_id].fd >= 0) {
+            return files[file_id].fd;
+        }
     }
     
-    // Seek to specific block
-    if (fseek(file, offset * DB_BLOCK_SIZE, SEEK_SET) != 0) {
-        fclose(file);
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    FileEntry& file = files[file_id];
+    if (file.fd < 0) {
+        file.fd = open(file.name.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+    }
+    return file.fd;
+}
+
+bool FileRegistry::readBlock(uint32_t file_id, off_t offset, char* data) {
+    char* bufs[1] = { data };
+    return readBlocks(file_id, offset, bufs, 1);
+}
+
+bool FileRegistry::readBlocks(uint32_t file_id, off_t first, char* const* bufs, int count) {
+    int fd = getFd(file_id, false);
+    if (fd < 0) {
         return false;
     }
     
-    // Read page data
-    size_t read = fread(page->data, 1, DB_BLOCK_SIZE, file);
-    fclose(file);
+    std::vector<struct iovec> iov(count);
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = DB_BLOCK_SIZE;
+    }
+    IORequest req(IO_READ, fd, first * DB_BLOCK_SIZE, iov.data(), count);
+    IOBackend::getInstance()->run(&req, 1);
+    if (req.result < 0) {
+        return false;
+    }
+    // A short read only happens at the end of the file, the rest reads as zeros
+    for (int i = 0; i < count; i++) {
+        size_t begin = (size_t)i * DB_BLOCK_SIZE;
+        if ((size_t)req.result < begin + DB_BLOCK_SIZE) {
+            size_t keep = (size_t)req.result > begin ? (size_t)req.result - begin : 0;
+            memset(bufs[i] + keep, 0, DB_BLOCK_SIZE - keep);
+        }
+    }
+    return true;
+}
+
+off_t FileRegistry::blockCount(uint32_t file_id) {
+    int fd = getFd(file_id, false);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        return 0;
+    }
+    return (st.st_size + DB_BLOCK_SIZE - 1) / DB_BLOCK_SIZE;
+}
+
+std::string FileRegistry::getName(uint32_t file_id) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return file_id < files.size() ? files[file_id].name : std::string();
+}
+
+int FileRegistry::getPartition(uint32_t file_id) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return file_id < files.size() ? files[file_id].partition : 0;
+}
+
+void FileRegistry::setPartition(uint32_t file_id, int partition) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    if (file_id < files.size()) {
+        files[file_id].partition = partition;
+    }
+}
+
+void FileRegistry::setMapped(uint32_t file_id, bool mapped) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    if (file_id < files.size()) {
+        files[file_id].mapped = mapped;
+        if (!mapped) unmap(files[file_id]);
+    }
+}
+
+bool FileRegistry::isMapped(uint32_t file_id) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return file_id < files.size() && files[file_id].mapped;
+}
+
+const char* FileRegistry::mappedBlock(uint32_t file_id, off_t offset) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        if (file_id >= files.size() || !files[file_id].mapped) {
+            return nullptr;
+        }
+        const FileEntry& file = files[file_id];
+        if (file.map && offset < file.map_blocks) {
+            return file.map + offset * DB_BLOCK_SIZE;
+        }
+    }
+    
+    // First use, or the file may have grown since: map it and look at its size again
+    int fd = getFd(file_id, false);
+    if (fd < 0) {
+        return nullptr;
+    }
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    FileEntry& file = files[file_id];
+    if (!file.mapped || file.fd != fd) {
+        return nullptr;
+    }
+    if (!file.map) {
+        void* p = mmap(nullptr, MMAP_RESERVE_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << "mmap of " << file.name << " failed, reading it through the buffer pool" << std::endl;
+            file.mapped = false;
+            return nullptr;
+        }
+        file.map = (char*)p;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        file.map_blocks = st.st_size / DB_BLOCK_SIZE;
+    }
+    return offset < file.map_blocks ? file.map + offset * DB_BLOCK_SIZE : nullptr;
+}
+
+void FileRegistry::adviseMapped(uint32_t file_id, int advice) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    if (file_id < files.size() && files[file_id].map && files[file_id].map_blocks > 0) {
+        madvise(files[file_id].map, files[file_id].map_blocks * DB_BLOCK_SIZE, advice);
+    }
+}
+
+void FileRegistry::unmap(FileEntry& file) {
+    if (file.map) {
+        munmap(file.map, MMAP_RESERVE_BYTES);
+        file.map = nullptr;
+        file.map_blocks = 0;
+    }
+}
+
+void FileRegistry::adviseWillNeed(uint32_t file_id, off_t first, size_t count) {
+    int fd = getFd(file_id, false);
+    if (fd >= 0) {
+        posix_fadvise(fd, first * DB_BLOCK_SIZE, count * DB_BLOCK_SIZE, POSIX_FADV_WILLNEED);
+    }
+}
+
+bool FileRegistry::writeBlock(uint32_t file_id, off_t offset, const char* data) {
+    int fd = getFd(file_id, true);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct iovec iov = { (void*)data, DB_BLOCK_SIZE };
+    IORequest req(IO_WRITE, fd, offset * DB_BLOCK_SIZE, &iov, 1);
+    IOBackend::getInstance()->run(&req, 1);
+    return req.result == DB_BLOCK_SIZE;
+}
+
+bool FileRegistry::allocateBlocks(uint32_t file_id, off_t first, off_t count) {
+    int fd = getFd(file_id, true);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    
+    // Left behind past the end of the block graph, e.g. by a crash after the file grew
+    static const char zero[DB_BLOCK_SIZE] = { 0 };
+    off_t end = first + count;
+    for (off_t block = first; block < end && block * DB_BLOCK_SIZE < st.st_size; block++) {
+        if (!writeBlock(file_id, block, zero)) return false;
+    }
+    if (end * DB_BLOCK_SIZE <= st.st_size) {
+        return true;
+    }
+    
+    if (fallocate(fd, 0, first * DB_BLOCK_SIZE, count * DB_BLOCK_SIZE) == 0) {
+        return true;
+    }
+    // The file system cannot preallocate, a longer file reads back zeros all the same
+    return ftruncate(fd, end * DB_BLOCK_SIZE) == 0;
+}
+
+void FileRegistry::closeFile(const char* filename) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = ids.find(filename);
+    if (it == ids.end() || files[it->second].fd < 0) {
+        return;
+    }
+    unmap(files[it->second]);
+    close(files[it->second].fd);
+    files[it->second].fd = -1;
+}
+
+void FileRegistry::closeAll() {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    for (FileEntry& file : files) {
+        unmap(file);
+        if (file.fd >= 0) {
+            close(file.fd);
+            file.fd = -1;
+        }
+    }
+}
+
+FileRegistry::~FileRegistry() {
+    closeAll();
+}
+
+PageGuard::PageGuard(uint32_t file_id, off_t offset, int mode, bool resident_only)
+    : page(nullptr), mode(mode), dirty(mode == PAGE_WRITE) {
+    BufferPool* bp = BufferPool::getInstance();
+    page = resident_only ? bp->findPage(file_id, offset) : bp->getPage(file_id, offset);
+    if (!page) {
+        return;
+    }
+    if (mode == PAGE_READ) {
+        page->latch.lock_shared();
+    } else if (mode == PAGE_WRITE) {
+        page->latch.lock();
+    } else {
+        // Write-backs check editors under the latch, none is still copying the page after this
+        page->latch.lock();
+        page->editors++;
+        page->latch.unlock();
+    }
+}
+
+PageGuard& PageGuard::operator=(PageGuard&& other) {
+    if (this != &other) {
+        release();
+        page = other.page;
+        mode = other.mode;
+        dirty = other.dirty;
+        other.page = nullptr;
+    }
+    return *this;
+}
+
+void PageGuard::release() {
+    if (!page) {
+        return;
+    }
+    // Unlatch first, unpinning may hand the frame to someone else
+    if (mode == PAGE_READ) {
+        page->latch.unlock_shared();
+    } else if (mode == PAGE_WRITE) {
+        page->latch.unlock();
+    } else {
+        page->latch.lock();
+        page->editors--;
+        page->latch.unlock();
+    }
+    BufferPool::getInstance()->unpinPage(page->file_id, page->offset, dirty);
+    page = nullptr;
+}
+
+BufferPool::BufferPool() : pool_size(config.pool_pages), arena(nullptr), arena_bytes(0), arena_mapped(false),
+                           dirty_pages(0), writers_busy(0), writer_stop(false), reader_busy(false), reader_stop(false) {
+    // One arena for all page bytes, mmap hands out memory aligned to the OS page (and DB_BLOCK_SIZE)
+    arena_bytes = pool_size * DB_BLOCK_SIZE;
+#ifdef MAP_HUGETLB
+    if (config.huge_pages) {
+        size_t huge_bytes = (arena_bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void* p = mmap(nullptr, huge_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            arena = (char*)p;
+            arena_bytes = huge_bytes;
+            arena_mapped = true;
+        }
+    }
+#endif
+    if (!arena) {
+        void* p = mmap(nullptr, arena_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            arena = (char*)p;
+            arena_mapped = true;
+#ifdef MADV_HUGEPAGE
+            // No reserved huge pages, ask for transparent ones instead
+            if (config.huge_pages) madvise(arena, arena_bytes, MADV_HUGEPAGE);
+#endif
+        } else {
+            arena = (char*)::operator new[](arena_bytes, std::align_val_t(DB_BLOCK_SIZE));
+            memset(arena, 0, arena_bytes);
+        }
+    }
+    
+    // Deal the frames out to the shards
+    pages = new Page[pool_size];
+    for (size_t i = 0; i < pool_size; i++) {
+        BufferShard& shard = shards[i % BUFFER_POOL_SHARDS];
+        pages[i].data = arena + i * DB_BLOCK_SIZE;
+        pages[i].frame = (int)shard.frames.size();
+        shard.frames.push_back(&pages[i]);
+    }
+    // Partition 0 is default, its quota may come from the config like the others
+    partitions.push_back(BufferPartition{ BUFFER_POOL_DEFAULT_PARTITION, 0, 0 });
+    for (const BufferPartition& part : config.partitions) {
+        if (part.name == BUFFER_POOL_DEFAULT_PARTITION) partitions[0] = part;
+        else partitions.push_back(part);
+    }
+    size_t reserved = 0;
+    for (BufferPartition& part : partitions) {
+        size_t max_pages = part.max_pages == 0 ? pool_size : part.max_pages;
+        if (max_pages > pool_size) max_pages = pool_size;
+        // Room for the pages one operation pins together in every shard
+        if (max_pages < BUFFER_POOL_MIN_SIZE) max_pages = BUFFER_POOL_MIN_SIZE;
+        if (part.max_pages != 0 && max_pages != part.max_pages) {
+            std::cerr << "Buffer pool partition '" << part.name << "' maximum of " << part.max_pages
+                      << " pages changed to " << max_pages << std::endl;
+        }
+        part.max_pages = max_pages;
+        if (part.min_pages > part.max_pages) {
+            std::cerr << "Buffer pool partition '" << part.name << "' minimum of " << part.min_pages
+                      << " pages lowered to its maximum" << std::endl;
+            part.min_pages = part.max_pages;
+        }
+        reserved += part.min_pages;
+    }
+    if (reserved > pool_size) {
+        std::cerr << "Buffer pool partition minimums exceed the pool, ignoring them" << std::endl;
+        for (BufferPartition& part : partitions) part.min_pages = 0;
+    }
+    
+    // Each shard holds an eighth of every quota, the first shards one page more until the
+    // shares add up to the quota exactly
+    for (size_t s = 0; s < BUFFER_POOL_SHARDS; s++) {
+        BufferShard& shard = shards[s];
+        size_t frames = shard.frames.size();
+        shard.free_pages.assign(shard.frames.rbegin(), shard.frames.rend());
+        shard.compressed.setBudget(config.compressed_pages * DB_BLOCK_SIZE / BUFFER_POOL_SHARDS);
+        for (const BufferPartition& part : partitions) {
+            size_t max_pages = part.max_pages / BUFFER_POOL_SHARDS + (s < part.max_pages % BUFFER_POOL_SHARDS ? 1 : 0);
+            shard.part_min.push_back(part.min_pages / BUFFER_POOL_SHARDS + (s < part.min_pages % BUFFER_POOL_SHARDS ? 1 : 0));
+            shard.part_max.push_back(max_pages);
+            shard.part_pages.push_back(0);
+            shard.replacers.push_back(Replacer::create(config.replacer, (int)frames, (int)max_pages));
+        }
+    }
+    
+    dirty_limit = (size_t)(config.dirty_target * pool_size);
+    if (config.read_ahead_pages > pool_size / READ_AHEAD_POOL_SHARE) {
+        config.read_ahead_pages = pool_size / READ_AHEAD_POOL_SHARE;
+    }
+    if (config.writer_interval_ms > 0) {
+        writer = std::thread(&BufferPool::writerLoop, this);
+    }
+    
+    for (ReadAheadState& st : ra_states) {
+        st.file_id = INVALID_FILE_ID;
+        st.last_miss = 0;
+        st.run = 0;
+    }
+    // Started even with read-ahead off, it also does the warm start
+    reader = std::thread(&BufferPool::readerLoop, this);
+}
+
+bool BufferPool::configure(const BufferPoolConfig& cfg) {
+    if (instance != nullptr) {
+        return false;
+    }
+    config = cfg;
+    IOBackend::configure(cfg.io_backend);
+    return true;
+}
+
+BufferPool* BufferPool::getInstance() {
+    static std::once_flag created;
+    std::call_once(created, [] { instance = new BufferPool(); });
+    return instance;
+}
+
+BufferShard& BufferPool::shardOf(PageId pid) {
+    // Mix the id so consecutive blocks of one file spread over all shards
+    uint64_t h = pid * 0x9E3779B97F4A7C15ULL;
+    return shards[(h >> 32) % BUFFER_POOL_SHARDS];
+}
+
+bool BufferPool::loadPage(PageId pid, Page* page) {
+    // A page evicted a while ago may still be in the compressed tier, which beats the disk read
+    if (!shardOf(pid).compressed.take(pid, page->data)) {
+        if (!FileRegistry::getInstance()->readBlock(PAGE_ID_FILE(pid), PAGE_ID_BLOCK(pid), page->data)) {
+            // File does not exist, create new page
+            memset(page->data, 0, DB_BLOCK_SIZE);
+        }
+        read_ios.add();
+    }
     
     // Set page metadata
-    strcpy(page->filename, filename);
-    page->offset = offset;
+    page->file_id = PAGE_ID_FILE(pid);
+    page->offset = PAGE_ID_BLOCK(pid);
     page->is_dirty = false;
+    page->ra_trigger = false;
     page->pin_count = 0;
     
     return true;
@@ -54,146 +589,840 @@ bool BufferPool::flushPage(Page* page) {
         return true;  // Not dirty, no need to write back
     }
     
-    FILE* file = fopen(page->filename, "rb+");
-    if (!file) {
-        // File does not exist, create file
-        file = fopen(page->filename, "wb");
-        if (!file) {
-            return false;
-        }
+    if (FileRegistry::getInstance()->writeBlock(page->file_id, page->offset, page->data)) {
+        setDirty(page, false);
+        pages_written.add();
+        write_ios.add();
+        return true;
     }
     
-    // Seek to specific block
-    if (fseek(file, page->offset * DB_BLOCK_SIZE, SEEK_SET) != 0) {
-        fclose(file);
+    return false;
+}
+
+bool BufferPool::writeBack(BufferShard& shard, Page* page) {
+    // Writers hold the latch exclusively, so the image written is never torn. A page held by
+    // an editor may be half changed, it stays dirty until the editor lets go
+    std::shared_lock<std::shared_mutex> latch(page->latch);
+    if (page->editors > 0) {
         return false;
     }
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (!page->is_dirty) {
+            return true;
+        }
+        // Cleared before the write, a change made after it marks the page dirty again on unpin
+        setDirty(page, false);
+    }
     
-    // Write page data
-    size_t written = fwrite(page->data, 1, DB_BLOCK_SIZE, file);
-    fclose(file);
-    
-    if (written == DB_BLOCK_SIZE) {
-        page->is_dirty = false;
+    if (FileRegistry::getInstance()->writeBlock(page->file_id, page->offset, page->data)) {
+        pages_written.add();
+        write_ios.add();
         return true;
     }
     
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    setDirty(page, true);
     return false;
 }
 
-Page* BufferPool::selectVictim() {
-    // Find victim page from the tail of LRU list
-    for (auto it = lru_list.rbegin(); it != lru_list.rend(); ++it) {
-        Page* page = *it;
-        if (page->pin_count == 0) {
-            // Found a victim page
-            // If dirty, flush to disk first
-            if (page->is_dirty) {
-                if (!flushPage(page)) {
-                    std::cerr << "Failed to flush dirty page" << std::endl;
+size_t BufferPool::writeBatch(const std::vector<PageId>& pids, size_t count, bool unpinned_only,
+                              std::vector<uint32_t>* files) {
+    FileRegistry* registry = FileRegistry::getInstance();
+    // Pages of a round stay pinned until its writes finish, keep that a small part of each shard
+    size_t round = std::max<size_t>(1, std::min<size_t>(IO_QUEUE_DEPTH, pool_size / BUFFER_POOL_SHARDS));
+    size_t written = 0;
+    {
+        std::lock_guard<std::mutex> lock(writer_mtx);
+        writers_busy++;
+    }
+    
+    for (size_t next = 0; next < pids.size() && written < count; ) {
+        // Pin the pages of this round that are still resident and dirty
+        std::vector<Page*> pages;
+        while (next < pids.size() && pages.size() < round && written + pages.size() < count) {
+            PageId pid = pids[next++];
+            BufferShard& shard = shardOf(pid);
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            auto it = shard.page_table.find(pid);
+            if (it == shard.page_table.end() || !it->second->is_dirty ||
+                (unpinned_only && it->second->pin_count > 0)) {
+                continue;  // Evicted, written or taken meanwhile
+            }
+            pin(shard, it->second);
+            pages.push_back(it->second);
+        }
+        
+        std::vector<Page*> sent, busy;
+        std::vector<int> fds;
+        for (Page* page : pages) {
+            // Only try the latch: its holder may be waiting for a latch this round already holds.
+            // Busy pages are written one by one afterwards
+            if (!page->latch.try_lock_shared()) {
+                busy.push_back(page);
+                continue;
+            }
+            if (page->editors > 0) {
+                page->latch.unlock_shared();  // Half edited, written once its editor lets go
+                continue;
+            }
+            int fd = registry->getFd(page->file_id, true);
+            {
+                std::lock_guard<std::mutex> lock(shardOf(MAKE_PAGE_ID(page->file_id, page->offset)).mtx);
+                if (fd < 0 || !page->is_dirty) {
+                    page->latch.unlock_shared();
                     continue;
                 }
+                // Cleared before the write like in writeBack
+                setDirty(page, false);
+            }
+            sent.push_back(page);
+            fds.push_back(fd);
+        }
+        
+        // The pages are in file/block order: consecutive blocks of a file go out as one pwritev
+        std::vector<struct iovec> iov(sent.size());
+        std::vector<IORequest> reqs;
+        std::vector<size_t> req_of(sent.size());
+        for (size_t i = 0; i < sent.size(); i++) {
+            Page* page = sent[i];
+            iov[i].iov_base = page->data;
+            iov[i].iov_len = DB_BLOCK_SIZE;
+            if (i > 0 && sent[i - 1]->file_id == page->file_id && sent[i - 1]->offset + 1 == page->offset) {
+                reqs.back().iovcnt++;
+            } else {
+                reqs.emplace_back(IO_WRITE, fds[i], page->offset * DB_BLOCK_SIZE, &iov[i], 1);
+            }
+            req_of[i] = reqs.size() - 1;
+            if (files && (files->empty() || files->back() != page->file_id)) {
+                files->push_back(page->file_id);
             }
-            
-            // Remove old mapping from hash table
-            PageId old_id(page->filename, page->offset);
-            page_table.erase(old_id);
-            
-            // Remove from LRU list
-            lru_list.erase(std::next(it).base());
-            
-            return page;
+        }
+        
+        IOBackend::getInstance()->run(reqs.data(), (int)reqs.size());
+        write_ios.add(reqs.size());
+        
+        for (size_t i = 0; i < sent.size(); i++) {
+            Page* page = sent[i];
+            IORequest& req = reqs[req_of[i]];
+            if (req.result == (ssize_t)req.iovcnt * DB_BLOCK_SIZE) {
+                written++;
+                pages_written.add();
+            } else {
+                std::lock_guard<std::mutex> lock(shardOf(MAKE_PAGE_ID(page->file_id, page->offset)).mtx);
+                setDirty(page, true);
+            }
+            page->latch.unlock_shared();
+        }
+        for (Page* page : busy) {
+            if (writeBack(shardOf(MAKE_PAGE_ID(page->file_id, page->offset)), page)) {
+                written++;
+                if (files) files->push_back(page->file_id);
+            }
+        }
+        
+        for (Page* page : pages) {
+            BufferShard& shard = shardOf(MAKE_PAGE_ID(page->file_id, page->offset));
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            unpin(shard, page);
         }
     }
     
-    // No victim found (all pages are pinned)
-    return nullptr;
+    {
+        std::lock_guard<std::mutex> lock(writer_mtx);
+        writers_busy--;
+    }
+    writer_idle_cv.notify_all();
+    return written;
 }
 
-Page* BufferPool::getPage(const char* filename, off_t offset) {
-    PageId pid(filename, offset);
+Page* BufferPool::selectVictim(BufferShard& shard, int part) {
+    int frame = shard.replacers[part]->victim();
+    if (frame < 0) {
+        // No victim found (all pages are pinned)
+        return nullptr;
+    }
     
-    // Check if page is already in buffer pool
-    auto it = page_table.find(pid);
-    if (it != page_table.end()) {
-        // Page in buffer pool, move to head of LRU list
-        Page* page = *(it->second);
-        lru_list.erase(it->second);
-        lru_list.push_front(page);
-        page_table[pid] = lru_list.begin();
-        
-        page->pin_count++;
+    // Nobody holds the latch of an unpinned page
+    // If dirty, flush to disk first
+    Page* page = shard.frames[frame];
+    bool was_dirty = page->is_dirty;
+    if (was_dirty && !flushPage(page)) {
+        std::cerr << "Failed to flush dirty page" << std::endl;
+        // Keep the page resident, back where the replacer had it
+        shard.replacers[part]->reinstate(frame);
+        return nullptr;
+    }
+    
+    // Remove old mapping from hash table, the clean image moves to the compressed tier
+    PageId pid = MAKE_PAGE_ID(page->file_id, page->offset);
+    shard.page_table.erase(pid);
+    shard.compressed.put(pid, page->data);
+    shard.part_pages[part]--;
+    shard.evictions.add();
+    if (was_dirty) shard.dirty_evictions.add();
+    return page;
+}
+
+Page* BufferPool::takeFrame(BufferShard& shard, int part) {
+    // At its quota the partition replaces one of its own pages. If all of them are pinned it
+    // goes over the quota for now rather than fail the caller
+    if (shard.part_pages[part] >= shard.part_max[part]) {
+        Page* page = selectVictim(shard, part);
+        if (page) return page;
+    }
+    
+    if (!shard.free_pages.empty()) {
+        Page* page = shard.free_pages.back();
+        shard.free_pages.pop_back();
         return page;
     }
     
-    // Page not in buffer pool, need to load from disk
+    // Take from the partitions above their minimum, the one furthest above first. The
+    // requester may always replace its own pages. Minimums give way only when nothing else can
+    std::vector<std::pair<long, int>> order;
+    for (int q = 0; q < (int)partitions.size(); q++) {
+        if (shard.part_pages[q] == 0) continue;
+        long excess = (long)shard.part_pages[q] - (q == part ? 0 : (long)shard.part_min[q]);
+        order.emplace_back(excess > 0 ? -excess : LONG_MAX, q);
+    }
+    std::sort(order.begin(), order.end());
+    for (auto& candidate : order) {
+        Page* page = selectVictim(shard, candidate.second);
+        if (page) return page;
+    }
+    return nullptr;
+}
+
+void BufferPool::pin(BufferShard& shard, Page* page) {
+    if (page->pin_count++ == 0) {
+        shard.replacers[page->partition]->setEvictable(page->frame, false);
+    }
+}
+
+void BufferPool::unpin(BufferShard& shard, Page* page) {
+    if (page->pin_count > 0 && --page->pin_count == 0) {
+        shard.replacers[page->partition]->setEvictable(page->frame, true);
+    }
+}
+
+void BufferPool::setDirty(Page* page, bool dirty) {
+    if (page->is_dirty == dirty) {
+        return;
+    }
+    page->is_dirty = dirty;
+    if (!dirty) {
+        dirty_pages--;
+    } else if (++dirty_pages == dirty_limit + 1 && writer.joinable()) {
+        // Just went over the limit, do not wait for the next tick
+        writer_cv.notify_one();
+    }
+}
+
+Page* BufferPool::getPage(uint32_t file_id, off_t offset) {
+    PageId pid = MAKE_PAGE_ID(file_id, offset);
+    BufferShard& shard = shardOf(pid);
     Page* page = nullptr;
-    
-    // Check if there are free pages
-    if (next_free_page < BUFFER_POOL_SIZE) {
-        page = &pages[next_free_page++];
-    } else {
-        // No free pages, need to replace
-        page = selectVictim();
+    bool sequential = false;
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        
+        // Check if page is already in buffer pool
+        auto it = shard.page_table.find(pid);
+        if (it != shard.page_table.end()) {
+            page = it->second;
+            shard.replacers[page->partition]->accessed(page->frame);
+            pin(shard, page);
+            shard.hits.add();
+            if (page->ra_trigger) {
+                // Halfway through a read-ahead window, fetch the next one in the background
+                page->ra_trigger = false;
+                size_t window = config.read_ahead_pages;
+                queueReadAhead(file_id, offset + (off_t)(window - window / 2), window);
+            }
+            return page;
+        }
+        
+        // Page not in buffer pool, need to load from disk
+        shard.misses.add();
+        // A free frame or a victim, as the file's partition allows
+        int part = FileRegistry::getInstance()->getPartition(file_id);
+        page = takeFrame(shard, part);
         if (!page) {
+            shard.pin_failures.add();
             std::cerr << "No available page in buffer pool" << std::endl;
             return nullptr;
         }
+        page->partition = (uint8_t)part;
+        
+        // Load page from disk, other threads asking for it wait on the shard
+        if (!loadPage(pid, page)) {
+            std::cerr << "Failed to load page from disk" << std::endl;
+            shard.free_pages.push_back(page);
+            return nullptr;
+        }
+        
+        shard.page_table[pid] = page;
+        shard.part_pages[part]++;
+        shard.replacers[part]->loaded(page->frame, pid);
+        
+        page->pin_count = 1;
+        if (config.read_ahead_pages > 0) {
+            sequential = noteMiss(file_id, offset);
+        }
     }
     
-    // Load page from disk
-    if (!loadPage(filename, offset, page)) {
-        std::cerr << "Failed to load page from disk" << std::endl;
+    if (sequential) {
+        // The scan would miss on the next blocks right away, read them here in one go
+        // instead of racing the reader thread for them
+        readRange(file_id, offset + 1, config.read_ahead_pages);
+    }
+    return page;
+}
+
+Page* BufferPool::findPage(uint32_t file_id, off_t offset) {
+    PageId pid = MAKE_PAGE_ID(file_id, offset);
+    BufferShard& shard = shardOf(pid);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.page_table.find(pid);
+    if (it == shard.page_table.end()) {
         return nullptr;
     }
+    Page* page = it->second;
+    shard.replacers[page->partition]->accessed(page->frame);
+    pin(shard, page);
+    shard.hits.add();
+    return page;
+}
+
+void BufferPool::unpinPage(uint32_t file_id, off_t offset, bool is_dirty) {
+    PageId pid = MAKE_PAGE_ID(file_id, offset);
+    BufferShard& shard = shardOf(pid);
+    std::lock_guard<std::mutex> lock(shard.mtx);
     
-    // Add page to head of LRU list
-    lru_list.push_front(page);
-    page_table[pid] = lru_list.begin();
+    auto it = shard.page_table.find(pid);
+    if (it != shard.page_table.end()) {
+        Page* page = it->second;
+        unpin(shard, page);
+        
+        if (is_dirty) {
+            setDirty(page, true);
+        }
+    }
+}
+
+bool BufferPool::forcePage(const char* filename, off_t offset) {
+    PageId pid = MAKE_PAGE_ID(FileRegistry::getInstance()->getId(filename), offset);
+    BufferShard& shard = shardOf(pid);
+    Page* page = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.page_table.find(pid);
+        if (it == shard.page_table.end()) {
+            return true;  // Page not in buffer pool, no need to flush
+        }
+        page = it->second;
+        pin(shard, page);
+    }
     
-    page->pin_count = 1;
-    return page;
+    bool ok = writeBack(shard, page);
+    
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    unpin(shard, page);
+    return ok;
 }
 
-void BufferPool::unpinPage(const char* filename, off_t offset, bool is_dirty) {
-    PageId pid(filename, offset);
+void BufferPool::flushAllPages() {
+    std::vector<PageId> dirty;
+    for (BufferShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        for (auto& pair : shard.page_table) {
+            if (pair.second->is_dirty) {
+                dirty.push_back(pair.first);
+            }
+        }
+    }
+    
+    // Batches for the whole pool, in file/block order
+    std::sort(dirty.begin(), dirty.end());
+    std::vector<uint32_t> files;
+    writeBatch(dirty, dirty.size(), false, &files);
     
-    auto it = page_table.find(pid);
-    if (it != page_table.end()) {
-        Page* page = *(it->second);
+    // Then one fdatasync per file written, all submitted together
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    std::vector<IORequest> syncs;
+    for (uint32_t file_id : files) {
+        int fd = FileRegistry::getInstance()->getFd(file_id, false);
+        if (fd >= 0) {
+            syncs.emplace_back(IO_FSYNC, fd, 0, nullptr, 0);
+        }
+    }
+    IOBackend::getInstance()->run(syncs.data(), (int)syncs.size());
+    this->syncs.add(syncs.size());
+    for (IORequest& req : syncs) {
+        if (req.result < 0) {
+            std::cerr << "fdatasync failed: " << strerror((int)-req.result) << std::endl;
+        }
+    }
+}
+
+void BufferPool::discardFile(const char* filename) {
+    uint32_t file_id = FileRegistry::getInstance()->findId(filename);
+    if (file_id == INVALID_FILE_ID) {
+        return;  // Never read or written, nothing cached
+    }
+    {
+        // The reader may be loading pages of the file right now, let it finish and forget the rest
+        std::unique_lock<std::mutex> lock(ra_mtx);
+        ra_queue.erase(std::remove_if(ra_queue.begin(), ra_queue.end(),
+                                      [file_id](const ReadAheadRequest& req) { return req.file_id == file_id; }),
+                       ra_queue.end());
+        ra_idle_cv.wait(lock, [this] { return !reader_busy; });
+    }
+    while (true) {
+        {
+            // A write round may have frames of the file pinned with their writes in flight
+            std::unique_lock<std::mutex> lock(writer_mtx);
+            writer_idle_cv.wait(lock, [this] { return writers_busy == 0; });
+        }
         
-        if (page->pin_count > 0) {
-            page->pin_count--;
+        bool pinned = false;
+        for (BufferShard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            shard.compressed.erase(0xFFFFFFFF00000000ULL, MAKE_PAGE_ID(file_id, 0));
+            for (auto it = shard.page_table.begin(); it != shard.page_table.end(); ) {
+                Page* page = it->second;
+                if (page->file_id != file_id) {
+                    ++it;
+                    continue;
+                }
+                if (page->pin_count > 0) {
+                    // Its holder still uses it and will unpin it through this page table
+                    pinned = true;
+                    ++it;
+                    continue;
+                }
+                it = shard.page_table.erase(it);
+                shard.replacers[page->partition]->remove(page->frame);
+                shard.part_pages[page->partition]--;
+                
+                // Hand the frame back to the shard
+                page->file_id = INVALID_FILE_ID;
+                page->offset = -1;
+                page->ra_trigger = false;
+                setDirty(page, false);
+                shard.free_pages.push_back(page);
+            }
+        }
+        if (!pinned) {
+            break;
+        }
+        // Someone still holds a frame of the file, give them time to let go
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void BufferPool::writerLoop() {
+    std::unique_lock<std::mutex> lock(writer_mtx);
+    while (!writer_stop) {
+        writer_cv.wait_for(lock, std::chrono::milliseconds(config.writer_interval_ms));
+        if (writer_stop) {
+            break;
+        }
+        size_t dirty = dirty_pages.load();
+        if (dirty <= dirty_limit) {
+            continue;
         }
         
-        if (is_dirty) {
-            page->is_dirty = true;
+        lock.unlock();
+        writeDirtyPages(dirty - dirty_limit);
+        lock.lock();
+    }
+}
+
+size_t BufferPool::writeDirtyPages(size_t count) {
+    // Gather the unpinned dirty pages of every shard, pinned ones are busy and would be dirtied again
+    std::vector<PageId> dirty;
+    for (BufferShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        for (auto& pair : shard.page_table) {
+            if (pair.second->is_dirty && pair.second->pin_count == 0) {
+                dirty.push_back(pair.first);
+            }
         }
     }
+    
+    // File/block order turns the writes into forward sweeps over each file
+    std::sort(dirty.begin(), dirty.end());
+    size_t written = writeBatch(dirty, count, true);
+    writer_pages.add(written);
+    return written;
 }
 
-bool BufferPool::forcePage(const char* filename, off_t offset) {
-    PageId pid(filename, offset);
+bool BufferPool::noteMiss(uint32_t file_id, off_t block) {
+    std::lock_guard<std::mutex> lock(ra_mtx);
+    ReadAheadState& st = ra_states[file_id % READ_AHEAD_FILES];
+    if (st.file_id != file_id) {
+        st.file_id = file_id;
+        st.last_miss = block;
+        st.run = 0;
+        return false;
+    }
+    
+    if (block > st.last_miss && block - st.last_miss <= READ_AHEAD_GAP) st.run++;
+    else st.run = 0;
+    st.last_miss = block;
     
-    auto it = page_table.find(pid);
-    if (it != page_table.end()) {
-        Page* page = *(it->second);
-        return flushPage(page);
+    if (st.run >= READ_AHEAD_TRIGGER) {
+        // From here on the trigger pages keep the windows coming
+        st.run = 0;
+        return true;
+    }
+    return false;
+}
+
+void BufferPool::queueReadAhead(uint32_t file_id, off_t first, size_t count, bool scan) {
+    std::lock_guard<std::mutex> lock(ra_mtx);
+    ra_queue.push_back(ReadAheadRequest{ file_id, first, count, scan });
+    ra_cv.notify_one();
+}
+
+void BufferPool::readAhead(const char* filename, off_t first, size_t count) {
+    if (config.read_ahead_pages == 0) {
+        return;
+    }
+    // The caller reads these next, so load the first window now; its trigger page queues the rest
+    readRange(FileRegistry::getInstance()->getId(filename), first, count ? count : config.read_ahead_pages);
+}
+
+void BufferPool::readerLoop() {
+    std::unique_lock<std::mutex> lock(ra_mtx);
+    while (true) {
+        ra_cv.wait(lock, [this] { return reader_stop || !ra_queue.empty(); });
+        if (reader_stop) {
+            break;
+        }
+        ReadAheadRequest req = ra_queue.front();
+        ra_queue.pop_front();
+        reader_busy = true;
+        
+        lock.unlock();
+        readRange(req.file_id, req.first, req.count, req.scan);
+        lock.lock();
+        reader_busy = false;
+        ra_idle_cv.notify_all();
+    }
+}
+
+void BufferPool::readRange(uint32_t file_id, off_t first, size_t count, bool scan) {
+    FileRegistry* registry = FileRegistry::getInstance();
+    off_t blocks = registry->blockCount(file_id);
+    if (first >= blocks) {
+        return;
+    }
+    bool full = first + (off_t)count <= blocks;
+    if (!full) {
+        count = blocks - first;
+    }
+    int part = registry->getPartition(file_id);
+    
+    // Let the kernel start on the window after this one while we read this one
+    if (scan) {
+        registry->adviseWillNeed(file_id, first + count, count);
     }
     
-    return true;  // Page not in buffer pool, no need to flush
+    std::vector<Page*> run;
+    off_t run_first = first;
+    for (off_t b = first; b < first + (off_t)count; b++) {
+        PageId pid = MAKE_PAGE_ID(file_id, b);
+        BufferShard& shard = shardOf(pid);
+        Page* page = nullptr;
+        bool stop = false;
+        bool cached = false;
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            if (shard.page_table.find(pid) == shard.page_table.end()) {
+                page = takeFrame(shard, part);
+                stop = !page;  // Shard full of pinned pages, not worth waiting for
+            }
+        }
+        
+        if (page) {
+            // Latch the frame before publishing it, a reader that finds the page waits on the latch
+            // for the data. Only try: the frame's last user may still be leaving its latch, and
+            // waiting here while holding the latches of the run could order latches both ways
+            bool latched = page->latch.try_lock();
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            if (!latched || shard.page_table.find(pid) != shard.page_table.end()) {
+                // Frame busy, or the block was loaded by a foreground miss meanwhile
+                if (latched) page->latch.unlock();
+                shard.free_pages.push_back(page);
+                page = nullptr;
+            } else {
+                page->file_id = file_id;
+                page->offset = b;
+                page->is_dirty = false;
+                page->ra_trigger = false;
+                page->partition = (uint8_t)part;
+                page->pin_count = 1;
+                shard.page_table[pid] = page;
+                shard.part_pages[part]++;
+                shard.replacers[part]->loaded(page->frame, pid);
+                cached = shard.compressed.take(pid, page->data);
+            }
+        }
+        
+        if (page && cached) {
+            // Came out of the compressed tier, nothing to read. It ends the run like a resident block
+            page->latch.unlock();
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            unpin(shard, page);
+            page = nullptr;
+        }
+        if (page) {
+            if (run.empty()) run_first = b;
+            run.push_back(page);
+        }
+        if ((!page && !run.empty()) || run.size() >= (size_t)IOV_MAX) {
+            readRun(file_id, run_first, run);
+        }
+        if (stop) {
+            break;
+        }
+    }
+    if (!run.empty()) {
+        readRun(file_id, run_first, run);
+    }
+    
+    // Mark the middle of a full window so the scan reaching it asks for the next one
+    if (full && scan) {
+        PageId pid = MAKE_PAGE_ID(file_id, first + (off_t)(count / 2));
+        BufferShard& shard = shardOf(pid);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.page_table.find(pid);
+        if (it != shard.page_table.end()) {
+            it->second->ra_trigger = true;
+        }
+    }
 }
 
-void BufferPool::flushAllPages() {
-    for (auto& pair : page_table) {
-        Page* page = *(pair.second);
-        if (page->is_dirty) {
-            flushPage(page);
+void BufferPool::readRun(uint32_t file_id, off_t first, std::vector<Page*>& run) {
+    std::vector<char*> bufs;
+    for (Page* page : run) {
+        bufs.push_back(page->data);
+    }
+    read_ios.add();
+    prefetched.add(run.size());
+    if (!FileRegistry::getInstance()->readBlocks(file_id, first, bufs.data(), (int)bufs.size())) {
+        for (char* buf : bufs) {
+            memset(buf, 0, DB_BLOCK_SIZE);
+        }
+    }
+    
+    for (size_t i = 0; i < run.size(); i++) {
+        run[i]->latch.unlock();
+        BufferShard& shard = shardOf(MAKE_PAGE_ID(file_id, first + (off_t)i));
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        unpin(shard, run[i]);
+    }
+    run.clear();
+}
+
+int BufferPool::findPartition(const char* name) const {
+    for (size_t i = 0; i < partitions.size(); i++) {
+        if (partitions[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+bool BufferPool::assignFile(const char* filename, const char* partition) {
+    int part = findPartition(partition && partition[0] ? partition : BUFFER_POOL_DEFAULT_PARTITION);
+    if (part < 0) {
+        return false;
+    }
+    FileRegistry* registry = FileRegistry::getInstance();
+    registry->setPartition(registry->getId(filename), part);
+    return true;
+}
+
+std::vector<PartitionStatus> BufferPool::getPartitions() {
+    // The quotas are what the shards' shares add up to
+    std::vector<PartitionStatus> parts;
+    for (const BufferPartition& part : partitions) {
+        parts.push_back(PartitionStatus{ part.name, 0, 0, 0 });
+    }
+    for (BufferShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        for (size_t i = 0; i < parts.size(); i++) {
+            parts[i].min_pages += shard.part_min[i];
+            parts[i].max_pages += shard.part_max[i];
+            parts[i].pages += shard.part_pages[i];
         }
     }
+    return parts;
+}
+
+BufferPoolStatus BufferPool::getStatus() {
+    BufferPoolStatus st;
+    memset(&st, 0, sizeof(st));
+    st.pool_pages = pool_size;
+    for (BufferShard& shard : shards) {
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            st.resident += shard.page_table.size();
+            for (auto& pair : shard.page_table) {
+                if (pair.second->pin_count > 0) st.pinned++;
+            }
+            st.compressed_pages += shard.compressed.pages();
+            st.compressed_bytes += shard.compressed.bytes();
+            st.compressed_hits += shard.compressed.hits;
+        }
+        st.hits += shard.hits.get();
+        st.misses += shard.misses.get();
+        st.evictions += shard.evictions.get();
+        st.dirty_evictions += shard.dirty_evictions.get();
+        st.pin_failures += shard.pin_failures.get();
+    }
+    st.dirty = dirty_pages.load();
+    st.prefetched = prefetched.get();
+    st.read_ios = read_ios.get();
+    st.pages_written = pages_written.get();
+    st.write_ios = write_ios.get();
+    st.writer_pages = writer_pages.get();
+    st.syncs = syncs.get();
+    return st;
+}
+
+std::vector<FileResidency> BufferPool::getResidency() {
+    std::map<uint32_t, FileResidency> by_id;
+    for (BufferShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        for (auto& pair : shard.page_table) {
+            FileResidency& fr = by_id[PAGE_ID_FILE(pair.first)];
+            fr.pages++;
+            if (pair.second->is_dirty) fr.dirty++;
+        }
+    }
+    
+    std::vector<FileResidency> files;
+    for (auto& pair : by_id) {
+        pair.second.name = FileRegistry::getInstance()->getName(pair.first);
+        files.push_back(pair.second);
+    }
+    std::sort(files.begin(), files.end(),
+              [](const FileResidency& a, const FileResidency& b) { return a.name < b.name; });
+    return files;
+}
+
+bool BufferPool::saveResidentPages(const char* path) {
+    std::vector<PageId> resident;
+    for (BufferShard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        for (auto& pair : shard.page_table) {
+            resident.push_back(pair.first);
+        }
+    }
+    std::sort(resident.begin(), resident.end());
+    
+    // "block name" per line, the name last so it may hold spaces. Ids are only valid in this
+    // process, names are what the next one can look up
+    std::string tmp = std::string(path) + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    FileRegistry* registry = FileRegistry::getInstance();
+    uint32_t file_id = INVALID_FILE_ID;
+    std::string name;
+    for (PageId pid : resident) {
+        if (PAGE_ID_FILE(pid) != file_id) {
+            file_id = PAGE_ID_FILE(pid);
+            name = registry->getName(file_id);
+        }
+        out << PAGE_ID_BLOCK(pid) << ' ' << name << '\n';
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), path) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t BufferPool::warmUp(const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        return 0;
+    }
+    std::map<std::string, std::vector<off_t>> blocks;
+    off_t block;
+    std::string name;
+    while (in >> block && std::getline(in >> std::ws, name)) {
+        if (block >= 0 && !name.empty()) {
+            blocks[name].push_back(block);
+        }
+    }
+    
+    // One request per run of consecutive blocks, stopping once the pool would be full
+    FileRegistry* registry = FileRegistry::getInstance();
+    size_t queued = 0;
+    for (auto& pair : blocks) {
+        if (queued >= pool_size) {
+            break;
+        }
+        std::vector<off_t>& list = pair.second;
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+        if (list.size() > pool_size - queued) {
+            list.resize(pool_size - queued);
+        }
+        uint32_t file_id = registry->getId(pair.first.c_str());
+        size_t i = 0;
+        while (i < list.size()) {
+            size_t j = i + 1;
+            while (j < list.size() && list[j] == list[j - 1] + 1) j++;
+            queueReadAhead(file_id, list[i], j - i, false);
+            i = j;
+        }
+        queued += list.size();
+    }
+    return queued;
+}
+
+void BufferPool::stopThreads() {
+    {
+        std::lock_guard<std::mutex> lock(writer_mtx);
+        writer_stop = true;
+    }
+    writer_cv.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(ra_mtx);
+        reader_stop = true;
+    }
+    ra_cv.notify_one();
+    if (reader.joinable()) {
+        reader.join();
+    }
+    
+    // Nothing submits batches from other threads now, the last flushes go on this one
+    IOBackend::stopInstance();
 }
 
 BufferPool::~BufferPool() {
+    stopThreads();
+    
     // Flush all dirty pages
     flushAllPages();
-}
\ No newline at end of file
+    
+    delete[] pages;
+    if (arena_mapped) {
+        munmap(arena, arena_bytes);
+    } else {
+        ::operator delete[](arena, std::align_val_t(DB_BLOCK_SIZE));
+    }
+}
@@ -1,90 +1,509 @@
 #pragma once
 #include "rwdata.h"
+#include "Replacer.h"
+#include "IOBackend.h"
+#include "CompressedCache.h"
 #include <unordered_map>
-#include <list>
+#include <vector>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <deque>
 #include <cstring>
 
-// Buffer pool size (number of pages)
+// Default buffer pool size (number of pages), see BufferPoolConfig
 #define BUFFER_POOL_SIZE 100
 
-// Page status
+// Number of independently locked partitions of the page table
+#define BUFFER_POOL_SHARDS 8
+
+// Smallest pool accepted, every shard needs room for the pages one operation pins together
+#define BUFFER_POOL_MIN_SIZE (BUFFER_POOL_SHARDS * 4)
+
+// Default replacement policy of every shard (REPLACER_LRU, REPLACER_CLOCK or REPLACER_2Q)
+#define BUFFER_POOL_REPLACER REPLACER_2Q
+
+// Background writer defaults: keep at most this share of the frames dirty, checking every interval
+#define BUFFER_POOL_DIRTY_TARGET 0.10
+#define BUFFER_POOL_WRITER_INTERVAL 100    // Milliseconds, 0 disables the writer
+
+// Read-ahead: blocks read per window, forward gap still counted as sequential (index blocks sit
+// between data blocks), sequential misses before it starts, and files tracked at once. A window
+// is cut to 1/READ_AHEAD_POOL_SHARE of the pool so that one scan cannot flush a small pool
+#define READ_AHEAD_PAGES 32
+#define READ_AHEAD_POOL_SHARE 8
+#define READ_AHEAD_GAP 4
+#define READ_AHEAD_TRIGGER 2
+#define READ_AHEAD_FILES 16
+
+// Default RAM for the compressed second tier, in DB_BLOCK_SIZE units, 0 disables it
+#define BUFFER_POOL_COMPRESSED_PAGES 32
+
+// Config file read at startup when present
+#define BUFFER_POOL_CONFIG_FILE "minilog.conf"
+
+// Resident page list of a database (<db>.warm), written at checkpoints and read back on open
+#define BUFFER_POOL_WARM_SUFFIX ".warm"
+
+// File id of no file
+#define INVALID_FILE_ID 0xFFFFFFFFu
+
+// Buffer pool partitions: tables named in CREATE TABLE ... WITH (pool = 'name') get their frames
+// from that partition. Partition 0 is "default", where every other file lives
+#define BUFFER_POOL_MAX_PARTITIONS 8
+#define BUFFER_POOL_DEFAULT_PARTITION "default"
+#define BUFFER_POOL_PARTITION_NAME 20    // Longest name + 1, as stored in the table header
+
+// Address space reserved when a table file is mapped: its largest possible size, so the mapping
+// never moves while the file grows
+#define MMAP_RESERVE_BYTES ((size_t)NUM_ALL_BLOCK * DB_BLOCK_SIZE)
+
+// Huge page size tried for the frame arena with huge_pages on
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// A named share of the frames. The partition keeps min_pages even when others need frames and
+// replaces its own pages once it holds max_pages, unless all of them are pinned
+struct BufferPartition {
+    std::string name;
+    size_t min_pages;
+    size_t max_pages;
+};
+
+// Buffer pool settings chosen when the database is opened
+struct BufferPoolConfig {
+    size_t pool_pages;  // Number of frames
+    int replacer;       // REPLACER_*
+    bool huge_pages;    // Back the frame arena with huge pages if the system allows
+    double dirty_target;      // Share of dirty frames the background writer brings the pool back to
+    int writer_interval_ms;   // How often the writer checks, 0 disables it
+    size_t read_ahead_pages;  // Read-ahead window in blocks, 0 disables read-ahead
+    int io_backend;           // IO_BACKEND_*, used by the WAL as well
+    size_t compressed_pages;  // RAM of the compressed second tier in blocks, 0 disables it
+    std::vector<BufferPartition> partitions;  // Besides default, which may be listed to set its quota
+    
+    BufferPoolConfig() : pool_pages(BUFFER_POOL_SIZE), replacer(BUFFER_POOL_REPLACER), huge_pages(false),
+                         dirty_target(BUFFER_POOL_DIRTY_TARGET), writer_interval_ms(BUFFER_POOL_WRITER_INTERVAL),
+                         read_ahead_pages(READ_AHEAD_PAGES), io_backend(IO_BACKEND),
+                         compressed_pages(BUFFER_POOL_COMPRESSED_PAGES) {}
+    
+    // Set one option by name (pool_pages, replacer, huge_pages, dirty_target, writer_interval_ms,
+    // read_ahead_pages, io_backend, compressed_pages, partition), false if the name or value is bad.
+    // A partition is "name min_pages [max_pages]", the fields may also be split by ':' or a comma.
+    // The pool raises a maximum below BUFFER_POOL_MIN_SIZE and warns when it does
+    bool set(const std::string& key, const std::string& value);
+    
+    // Read "key = value" lines, '#' starts a comment. False if the file cannot be opened
+    bool loadFile(const char* path);
+    
+    // Apply one command line flag "--key=value" or "--config=path", false if it is not understood
+    bool parseFlag(const char* arg);
+};
+
+// Frame descriptor. The page bytes live in the pool's arena, descriptors sit in their own array
 struct Page {
-    char data[DB_BLOCK_SIZE];  // Page data
-    char filename[100];         // Filename
+    char* data;                // Page data, DB_BLOCK_SIZE bytes in the arena
     off_t offset;              // Offset in file (block number)
-    bool is_dirty;             // Dirty page flag
     int pin_count;             // Pin count, cannot be replaced if > 0
+    int frame;                 // Frame number inside its shard, as seen by the replacer
+    bool is_dirty;             // Dirty page flag
+    bool ra_trigger;           // Read-ahead mark, a hit on it fetches the next window
+    uint8_t partition;         // Buffer pool partition whose quota the page counts against
+    uint32_t file_id;          // File the page belongs to, see FileRegistry
+    int editors;               // PAGE_PIN guards, changed under the exclusive latch and read under either
+    // Guards data while pinned: shared for readers, exclusive for writers.
+    // is_dirty and pin_count are guarded by the owning shard's mutex instead
+    std::shared_mutex latch;
     
-    Page() : offset(-1), is_dirty(false), pin_count(0) {
-        memset(data, 0, DB_BLOCK_SIZE);
-        memset(filename, 0, 100);
+    Page() : data(nullptr), offset(-1), pin_count(0), frame(-1), is_dirty(false), ra_trigger(false), partition(0),
+             file_id(INVALID_FILE_ID), editors(0) {}
+};
+
+// Page identifier (used as key for hash table): file id in the high 32 bits, block number in the low 32
+typedef uint64_t PageId;
+#define MAKE_PAGE_ID(file_id, block) (((uint64_t)(file_id) << 32) | (uint32_t)(block))
+#define PAGE_ID_FILE(pid) ((uint32_t)((pid) >> 32))
+#define PAGE_ID_BLOCK(pid) ((off_t)((pid) & 0xFFFFFFFFu))
+
+// Custom hash function, spreads consecutive blocks of a file over the buckets
+struct PageIdHash {
+    size_t operator()(PageId pid) const {
+        uint64_t h = pid * 0x9E3779B97F4A7C15ULL;
+        return (size_t)(h ^ (h >> 32));
     }
 };
 
-// Page identifier (used as key for hash table)
-struct PageId {
-    char filename[100];
-    off_t offset;
+// Numbers every table/meta file and keeps it open for the life of the database, doing
+// positional block I/O on it through the IOBackend, so a page miss or writeback is one request.
+// A name keeps its id even after the file is closed or removed, ids are never reused
+class FileRegistry {
+private:
+    struct FileEntry {
+        std::string name;
+        int fd;
+        int partition;  // Buffer pool partition its pages are loaded into
+        bool mapped;    // Data blocks are read through map (TABLE_STORAGE_MMAP)
+        char* map;      // Read-only shared mapping, MMAP_RESERVE_BYTES long, created on first use
+        off_t map_blocks;   // Whole blocks of the file the last time its size was checked
+    };
     
-    PageId(const char* fname, off_t off) : offset(off) {
-        strcpy(filename, fname);
+    // Drop the mapping of the file, called with mtx held exclusively
+    void unmap(FileEntry& file);
+    
+    std::shared_mutex mtx;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<FileEntry> files;  // Indexed by file id
+    
+    FileRegistry() {}
+    
+public:
+    static FileRegistry* getInstance();
+    
+    // Id of filename, registered on first use. Repeated calls for the same name in a thread
+    // compare against the last name only, without hashing or allocating
+    uint32_t getId(const char* filename);
+    
+    // Id of filename if it was ever registered, INVALID_FILE_ID otherwise
+    uint32_t findId(const char* filename);
+    
+    // Descriptor of the file, -1 if it does not exist and create is false
+    int getFd(uint32_t file_id, bool create);
+    
+    // Read one block, bytes past the end of the file read as zeros
+    bool readBlock(uint32_t file_id, off_t offset, char* data);
+    
+    // Read count consecutive blocks starting at first with one vectored read, one buffer per block
+    bool readBlocks(uint32_t file_id, off_t first, char* const* bufs, int count);
+    
+    // Number of blocks in the file, 0 if it does not exist
+    off_t blockCount(uint32_t file_id);
+    
+    // Name the file was registered under, empty for an unknown id
+    std::string getName(uint32_t file_id);
+    
+    // Buffer pool partition of the file, 0 unless set. Pages already cached keep theirs
+    int getPartition(uint32_t file_id);
+    void setPartition(uint32_t file_id, int partition);
+    
+    // Read the file's data blocks through a mapping (see TABLE_STORAGE_MMAP) or not
+    void setMapped(uint32_t file_id, bool mapped);
+    bool isMapped(uint32_t file_id);
+    
+    // The block inside the file mapping, nullptr if the file is not mapped or the block lies past
+    // its end. The pointer stays valid until the file is closed
+    const char* mappedBlock(uint32_t file_id, off_t offset);
+    
+    // madvise the mapped part of the file (MADV_SEQUENTIAL before a scan, ...)
+    void adviseMapped(uint32_t file_id, int advice);
+    
+    // Tell the kernel the blocks will be read soon
+    void adviseWillNeed(uint32_t file_id, off_t first, size_t count);
+    
+    // Make room for count zeroed blocks from first on, growing the file. Blocks the file
+    // already has in that range are zeroed too
+    bool allocateBlocks(uint32_t file_id, off_t first, off_t count);
+    bool allocateBlocks(const char* filename, off_t first, off_t count) {
+        return allocateBlocks(getId(filename), first, count);
     }
     
-    bool operator==(const PageId& other) const {
-        return strcmp(filename, other.filename) == 0 && offset == other.offset;
+    // Write one block, the file is created if needed
+    bool writeBlock(uint32_t file_id, off_t offset, const char* data);
+    bool writeBlock(const char* filename, off_t offset, const char* data) {
+        return writeBlock(getId(filename), offset, data);
     }
+    
+    // Close the descriptor (and the mapping) before the file is removed, replaced or truncated
+    void closeFile(const char* filename);
+    
+    void closeAll();
+    
+    ~FileRegistry();
 };
 
-// Custom hash function
-struct PageIdHash {
-    size_t operator()(const PageId& pid) const {
-        size_t h1 = std::hash<std::string>{}(pid.filename);
-        size_t h2 = std::hash<off_t>{}(pid.offset);
-        return h1 ^ (h2 << 1);
+// One partition of the pool: its own frames, page table and replacer under one mutex.
+// A page always maps to the same shard, so lookups and eviction only lock that shard
+struct BufferShard {
+    std::mutex mtx;
+    
+    // Frames of this shard, indexed by Page::frame
+    std::vector<Page*> frames;
+    
+    // Hash map: PageId -> resident page
+    std::unordered_map<PageId, Page*, PageIdHash> page_table;
+    
+    // Frames of this shard not holding any page
+    std::vector<Page*> free_pages;
+    
+    // One replacer per buffer pool partition, each choosing among the unpinned frames of its pages
+    std::vector<Replacer*> replacers;
+    
+    // Per partition: resident pages and this shard's part of the quota
+    std::vector<size_t> part_pages, part_min, part_max;
+    
+    // Clean pages evicted from this shard, compressed. Consulted on a miss before the disk
+    CompressedCache compressed;
+    
+    // Counted per shard, next to the mutex the same threads already share
+    StatCounter hits, misses, evictions, dirty_evictions, pin_failures;
+    
+    ~BufferShard() {
+        for (Replacer* replacer : replacers) delete replacer;
+    }
+};
+
+// Snapshot of the pool for SHOW STATUS, counters are totals since startup
+struct BufferPoolStatus {
+    size_t pool_pages;
+    size_t resident;
+    size_t dirty;
+    size_t pinned;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t dirty_evictions;   // Victims written back before their frame was reused
+    uint64_t pin_failures;      // Misses that found every frame of the shard pinned
+    uint64_t prefetched;        // Pages loaded by read-ahead and warm start
+    uint64_t read_ios;
+    uint64_t pages_written;
+    uint64_t write_ios;
+    uint64_t writer_pages;      // Written by the background writer
+    uint64_t syncs;
+    size_t compressed_pages;    // Pages held by the compressed tier
+    size_t compressed_bytes;
+    uint64_t compressed_hits;   // Misses served from it instead of the disk
+};
+
+// Occupancy of one buffer pool partition
+struct PartitionStatus {
+    std::string name;
+    size_t min_pages;
+    size_t max_pages;
+    size_t pages;
+};
+
+// Pages of one file held by the pool
+struct FileResidency {
+    std::string name;
+    size_t pages;
+    size_t dirty;
+};
+
+// Page access modes of a PageGuard
+#define PAGE_PIN 0      // Pin only, the holder edits the data without the latch and no write-back
+                        // touches the page until it lets go
+#define PAGE_READ 1     // Shared latch
+#define PAGE_WRITE 2    // Exclusive latch, the page is marked dirty when the guard lets go
+
+// Keeps a page pinned (and latched, see PAGE_*) for its lifetime and gives typed views straight
+// into the frame, so callers read and write the block without copying it. Move-only
+class PageGuard {
+private:
+    Page* page;
+    int mode;
+    bool dirty;
+
+public:
+    PageGuard() : page(nullptr), mode(PAGE_PIN), dirty(false) {}
+    // resident_only: only take the page if the pool already holds it, never read it in
+    PageGuard(uint32_t file_id, off_t offset, int mode, bool resident_only = false);
+    PageGuard(const char* filename, off_t offset, int mode)
+        : PageGuard(FileRegistry::getInstance()->getId(filename), offset, mode) {}
+    PageGuard(PageGuard&& other) : page(other.page), mode(other.mode), dirty(other.dirty) {
+        other.page = nullptr;
     }
+    PageGuard& operator=(PageGuard&& other);
+    PageGuard(const PageGuard&) = delete;
+    PageGuard& operator=(const PageGuard&) = delete;
+    ~PageGuard() { release(); }
+
+    // False if the pool had no frame to give
+    bool valid() const { return page != nullptr; }
+
+    char* data() const { return page->data; }
+
+    // The block seen as a T starting pos bytes into it
+    template <typename T>
+    T* as(size_t pos = 0) const { return (T*)(page->data + pos); }
+
+    std::shared_mutex& latch() const { return page->latch; }
+
+    // Write it back eventually, implied by PAGE_WRITE
+    void markDirty() { dirty = true; }
+
+    // Unlatch and unpin now instead of at the end of the scope
+    void release();
 };
 
 class BufferPool {
 private:
     static BufferPool* instance;
+    static BufferPoolConfig config;
+    
+    // Page pool: descriptors and one DB_BLOCK_SIZE aligned arena holding the page bytes
+    Page* pages;
+    size_t pool_size;
+    std::vector<BufferPartition> partitions;  // Index is the partition number, 0 is default
+    char* arena;
+    size_t arena_bytes;
+    bool arena_mapped;  // From mmap rather than the heap
+    BufferShard shards[BUFFER_POOL_SHARDS];
     
-    // LRU list (stores page pointers)
-    std::list<Page*> lru_list;
+    // Background writer
+    std::atomic<size_t> dirty_pages;  // Frames with is_dirty set
+    size_t dirty_limit;               // dirty_target of pool_size, in frames
+    std::thread writer;
+    std::mutex writer_mtx;
+    std::condition_variable writer_cv;
+    std::condition_variable writer_idle_cv;  // Signalled when a writeBatch call finishes
+    int writers_busy;                        // writeBatch calls under way, guarded by writer_mtx
+    bool writer_stop;
     
-    // Hash map: PageId -> iterator of the page in LRU list
-    std::unordered_map<PageId, std::list<Page*>::iterator, PageIdHash> page_table;
+    // Read-ahead, state and queue guarded by ra_mtx
+    struct ReadAheadRequest {
+        uint32_t file_id;
+        off_t first;
+        size_t count;
+        bool scan;        // Part of a scan rather than a warm start
+    };
+    struct ReadAheadState {
+        uint32_t file_id;
+        off_t last_miss;
+        int run;          // Sequential misses in a row
+    };
+    ReadAheadState ra_states[READ_AHEAD_FILES];
+    std::deque<ReadAheadRequest> ra_queue;
+    std::thread reader;
+    std::mutex ra_mtx;
+    std::condition_variable ra_cv;
+    std::condition_variable ra_idle_cv;  // Signalled when the reader finishes a request
+    bool reader_busy;
+    bool reader_stop;
     
-    // Page pool
-    Page pages[BUFFER_POOL_SIZE];
-    int next_free_page;  // Index of the next free page
+    // I/O counters, the per-shard ones live in BufferShard
+    StatCounter prefetched, read_ios, pages_written, write_ios, writer_pages, syncs;
     
     BufferPool();
     
-    // Write page back to disk
+    BufferShard& shardOf(PageId pid);
+    
+    // Write page back to disk, only for unpinned pages under the shard lock
     bool flushPage(Page* page);
     
-    // Load page from disk
-    bool loadPage(const char* filename, off_t offset, Page* page);
+    // Write back a page pinned by the caller while other threads may use it
+    bool writeBack(BufferShard& shard, Page* page);
+    
+    // Write back up to count of the given pages (sorted) that are still dirty, and unpinned if
+    // asked, pinning a round of them at a time. Each round is one IOBackend batch with a pwritev
+    // per run of consecutive blocks. Returns the number written, the files written to go to files
+    size_t writeBatch(const std::vector<PageId>& pids, size_t count, bool unpinned_only,
+                      std::vector<uint32_t>* files = nullptr);
+    
+    // Load page from the compressed tier or the disk, called with the shard locked
+    bool loadPage(PageId pid, Page* page);
     
-    // Select a victim page (using LRU strategy)
-    Page* selectVictim();
+    // Select a victim page of the partition in the shard (using its replacer), called with the shard locked
+    Page* selectVictim(BufferShard& shard, int part);
+    
+    // A frame for a new page of the partition: its own victim once it is at its quota, else a free
+    // frame, else a victim of the partition furthest above its minimum. Called with the shard locked
+    Page* takeFrame(BufferShard& shard, int part);
+    
+    // Change pin_count and keep the replacer's view of it in step, called with the shard locked
+    void pin(BufferShard& shard, Page* page);
+    void unpin(BufferShard& shard, Page* page);
+    
+    // Change is_dirty and keep dirty_pages in step, called with the shard locked
+    void setDirty(Page* page, bool dirty);
+    
+    // Background writer: wakes every writer_interval_ms, or when the pool passes its dirty limit
+    void writerLoop();
+    
+    // Write up to count unpinned dirty pages in file/block order, returns the number written
+    size_t writeDirtyPages(size_t count);
+    
+    // Sequential miss detection, true once READ_AHEAD_TRIGGER forward misses in a row were seen
+    bool noteMiss(uint32_t file_id, off_t block);
+    void queueReadAhead(uint32_t file_id, off_t first, size_t count, bool scan = true);
+    
+    // Read-ahead thread: loads the queued windows and the warm start list
+    void readerLoop();
+    
+    // Load the blocks of [first, first + count) that are not resident, unpinned, with vectored reads.
+    // For a scan it also marks the trigger page and advises the kernel of the next window
+    void readRange(uint32_t file_id, off_t first, size_t count, bool scan = true);
+    
+    // Finish one contiguous run of frames reserved by readRange
+    void readRun(uint32_t file_id, off_t first, std::vector<Page*>& run);
     
 public:
     static BufferPool* getInstance();
     
+    // Settings for the pool, only before the first getInstance(). False once the pool exists
+    static bool configure(const BufferPoolConfig& cfg);
+    
+    size_t size() const { return pool_size; }
+    
     // Get page (main interface)
-    // If the page is in the buffer pool, return it directly; otherwise load it from disk
-    Page* getPage(const char* filename, off_t offset);
+    // If the page is in the buffer pool, return it directly; otherwise load it from disk.
+    // The page comes back pinned but not latched, lock page->latch around any access to data
+    Page* getPage(uint32_t file_id, off_t offset);
+    Page* getPage(const char* filename, off_t offset) {
+        return getPage(FileRegistry::getInstance()->getId(filename), offset);
+    }
+    
+    // The page pinned if it is resident, nullptr otherwise. Nothing is read from disk
+    Page* findPage(uint32_t file_id, off_t offset);
+    
+    // Guarded access, see PageGuard. Check valid() before using the data
+    PageGuard readPage(const char* filename, off_t offset) { return PageGuard(filename, offset, PAGE_READ); }
+    PageGuard writePage(const char* filename, off_t offset) { return PageGuard(filename, offset, PAGE_WRITE); }
+    PageGuard pinPage(const char* filename, off_t offset) { return PageGuard(filename, offset, PAGE_PIN); }
     
     // Unpin page (decrease pin_count)
-    void unpinPage(const char* filename, off_t offset, bool is_dirty);
+    void unpinPage(uint32_t file_id, off_t offset, bool is_dirty);
+    void unpinPage(const char* filename, off_t offset, bool is_dirty) {
+        unpinPage(FileRegistry::getInstance()->getId(filename), offset, is_dirty);
+    }
     
     // Force write page back to disk
     bool forcePage(const char* filename, off_t offset);
     
-    // Flush all dirty pages to disk
+    // Flush all dirty pages to disk in file/block order, then fdatasync every file written
     void flushAllPages();
     
+    // Drop all pages of a file without writing them back, used when the file is removed or rewritten.
+    // Waits until no frame of the file is pinned, so the caller must not hold any of them
+    void discardFile(const char* filename);
+    
+    // The blocks from first on are about to be read in order: load one window now (count 0 means
+    // read_ahead_pages) and let the reader thread stay ahead of the scan from there
+    void readAhead(const char* filename, off_t first, size_t count = 0);
+    
+    // Number of the partition called name, -1 if there is none
+    int findPartition(const char* name) const;
+    
+    // Load the file's pages into the named partition from now on, false if there is no such partition
+    bool assignFile(const char* filename, const char* partition);
+    
+    // Quota and resident pages of every partition
+    std::vector<PartitionStatus> getPartitions();
+    
+    // Counters and current occupancy, see BufferPoolStatus
+    BufferPoolStatus getStatus();
+    
+    // Resident and dirty pages of every file with pages in the pool, by file name
+    std::vector<FileResidency> getResidency();
+    
+    // Write the (file, block) list of the resident pages to path, replacing it atomically
+    bool saveResidentPages(const char* path);
+    
+    // Queue the pages listed in path for the reader thread, in file/block order and up to the pool
+    // size, so a restarted database finds its working set cached. Returns the number queued
+    size_t warmUp(const char* path);
+    
+    // Stop the background writer, read-ahead and I/O worker threads, before the final flush at shutdown
+    void stopThreads();
+    
     ~BufferPool();
-};
\ No newline at end of file
+};
@@ -0,0 +1,123 @@
+#include "CompressedCache.h"
+#include <cstring>
+
+size_t rleCompress(const char* src, size_t size, char* dst, size_t cap) {
+    size_t out = 0;
+    size_t lit_start = 0;  // First byte not yet emitted
+    size_t i = 0;
+    while (i <= size) {
+        size_t run = 0;
+        if (i < size) {
+            run = 1;
+            while (i + run < size && run < RLE_MAX_RUN && src[i + run] == src[i]) run++;
+        }
+        // Emit the literals before a run, at the end, or when they fill a token
+        size_t lits = i - lit_start;
+        if (lits > 0 && (run >= RLE_MIN_RUN || i == size || lits == RLE_MAX_LITERAL)) {
+            if (out + 1 + lits > cap) return 0;
+            dst[out++] = (char)(lits - 1);
+            memcpy(dst + out, src + lit_start, lits);
+            out += lits;
+            lit_start = i;
+        }
+        if (i == size) break;
+        if (run >= RLE_MIN_RUN) {
+            if (out + 2 > cap) return 0;
+            dst[out++] = (char)(0x80 | (run - RLE_MIN_RUN));
+            dst[out++] = src[i];
+            i += run;
+            lit_start = i;
+        } else {
+            i++;
+        }
+    }
+    return out;
+}
+
+bool rleDecompress(const char* src, size_t len, char* dst, size_t size) {
+    size_t in = 0, out = 0;
+    while (in < len) {
+        unsigned char t = (unsigned char)src[in++];
+        if (t & 0x80) {
+            size_t run = (t & 0x7F) + RLE_MIN_RUN;
+            if (in >= len || out + run > size) return false;
+            memset(dst + out, src[in++], run);
+            out += run;
+        } else {
+            size_t lits = (size_t)t + 1;
+            if (in + lits > len || out + lits > size) return false;
+            memcpy(dst + out, src + in, lits);
+            in += lits;
+            out += lits;
+        }
+    }
+    return out == size;
+}
+
+void CompressedCache::drop(std::unordered_map<uint64_t, Entry>::iterator it) {
+    used -= it->second.len + COMPRESSED_ENTRY_OVERHEAD;
+    delete[] it->second.data;
+    lru.erase(it->second.lru);
+    entries.erase(it);
+}
+
+void CompressedCache::put(uint64_t key, const char* page) {
+    if (budget == 0) {
+        return;
+    }
+    auto old = entries.find(key);
+    if (old != entries.end()) {
+        drop(old);
+    }
+    
+    char buf[COMPRESSED_PAGE_MAX];
+    size_t len = rleCompress(page, DB_BLOCK_SIZE, buf, sizeof(buf));
+    if (len == 0 || len + COMPRESSED_ENTRY_OVERHEAD > budget) {
+        return;  // Compresses too poorly to be worth it
+    }
+    
+    // Make room, least recently stored first
+    while (used + len + COMPRESSED_ENTRY_OVERHEAD > budget && !lru.empty()) {
+        drop(entries.find(lru.back()));
+    }
+    
+    Entry entry;
+    entry.data = new char[len];
+    memcpy(entry.data, buf, len);
+    entry.len = len;
+    lru.push_front(key);
+    entry.lru = lru.begin();
+    entries.emplace(key, entry);
+    used += len + COMPRESSED_ENTRY_OVERHEAD;
+    stores++;
+}
+
+bool CompressedCache::take(uint64_t key, char* page) {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    bool ok = rleDecompress(it->second.data, it->second.len, page, DB_BLOCK_SIZE);
+    drop(it);
+    if (ok) hits++;
+    return ok;
+}
+
+void CompressedCache::erase(uint64_t mask, uint64_t match) {
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        auto next = std::next(it);
+        if ((it->first & mask) == match) {
+            drop(it);
+        }
+        it = next;
+    }
+}
+
+void CompressedCache::clear() {
+    for (auto& pair : entries) {
+        delete[] pair.second.data;
+    }
+    entries.clear();
+    lru.clear();
+    used = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "rwdata.h"
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+// Byte run-length coding of a block: a token t < 0x80 is followed by t + 1 literal bytes,
+// a token t >= 0x80 by one byte that repeats (t & 0x7F) + RLE_MIN_RUN times.
+// Zero padded rows and nodes shrink to a small fraction of the block
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN (0x7F + RLE_MIN_RUN)
+#define RLE_MAX_LITERAL 0x80
+
+// Pages that do not compress below this are not worth keeping in the second tier
+#define COMPRESSED_PAGE_MAX (DB_BLOCK_SIZE * 3 / 4)
+
+// Bookkeeping charged to the budget for every cached page besides its bytes
+#define COMPRESSED_ENTRY_OVERHEAD 64
+
+// Encode size bytes of src into dst (room for cap bytes), returns the encoded length or 0 if it does not fit
+size_t rleCompress(const char* src, size_t size, char* dst, size_t cap);
+
+// Decode len bytes of src into exactly size bytes of dst, false if the input is malformed
+bool rleDecompress(const char* src, size_t len, char* dst, size_t size);
+
+// Second tier behind one buffer pool shard: clean pages the shard evicted, kept compressed in
+// LRU order within a byte budget. A page is handed back (and dropped from here) on a miss of
+// the shard, saving the disk read. Guarded by the shard's mutex like the rest of the shard
+class CompressedCache {
+private:
+    struct Entry {
+        char* data;
+        size_t len;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    std::unordered_map<uint64_t, Entry> entries;
+    std::list<uint64_t> lru;     // Most recently stored first
+    size_t budget;               // Bytes, 0 disables the cache
+    size_t used;
+
+    void drop(std::unordered_map<uint64_t, Entry>::iterator it);
+
+public:
+    uint64_t hits;
+    uint64_t stores;
+
+    explicit CompressedCache(size_t budget = 0) : budget(budget), used(0), hits(0), stores(0) {}
+    ~CompressedCache() { clear(); }
+
+    void setBudget(size_t bytes) { budget = bytes; }
+
+    // Keep a copy of the clean page, replacing an older one
+    void put(uint64_t key, const char* page);
+
+    // Decompress the page into page and forget it, false if it is not here
+    bool take(uint64_t key, char* page);
+
+    // Forget every page whose key matches (key & mask) == match, used when a file goes away
+    void erase(uint64_t mask, uint64_t match);
+
+    void clear();
+
+    size_t pages() const { return entries.size(); }
+    size_t bytes() const { return used; }
+};
@@ -9,6 +9,8 @@
 #include <sys/types.h>
 #include <vector>
 #include <limits> // for numeric_limits
+#include <iomanip>
+#include <algorithm>
 #include "BufferPool.h"
 #include "WAL.h"
 
@@ -92,7 +94,12 @@ void DataBase::run(){
             operation_count++;
         }
         else if(cmd=="show"||cmd=="SHOW"||cmd=="Show"){
-            this->printTableNames();
+            // SHOW STATUS / SHOW BUFFERPOOL, anything else lists the tables
+            string what = pos == string::npos ? "" : sql.substr(pos + 1);
+            what.erase(remove_if(what.begin(), what.end(), [](char c){ return c == ' ' || c == ';'; }), what.end());
+            if(_stricmp(what.c_str(), "status") == 0) this->printStatus(false);
+            else if(_stricmp(what.c_str(), "bufferpool") == 0) this->printStatus(true);
+            else this->printTableNames();
         }
         
         // Auto-checkpoint after certain number of operations
@@ -114,6 +121,7 @@ void DataBase::run(){
     FileManager::getInstance()->flushDatabase(meta_file, this->db);
     
     // Flush buffer pool
+    BufferPool::getInstance()->stopThreads();
     BufferPool::getInstance()->flushAllPages();
     
     // Close WAL
@@ -158,6 +166,27 @@ void DataBase::init(){
         
         // Double check that the loaded name is correct
         strcpy(this->db.db_name, db_name_input.c_str()); 
+        
+        // Route every table to its buffer pool partition before its pages are read
+        for(int i=0;i<this->db.table_num;i++){
+            string t_file = string(this->db.tables[i]) + ".bin";
+            if(FileManager::getInstance()->getFileSize(t_file.c_str()) == (size_t)-1) continue;
+            table t = FileManager::getInstance()->getTable(t_file.c_str(), LOC_TABLE);
+            t.pool[sizeof(t.pool) - 1] = '\0';
+            if(!BufferPool::getInstance()->assignFile(t_file.c_str(), t.pool)){
+                cout << "Buffer pool partition '" << t.pool << "' of table " << this->db.tables[i]
+                     << " is not configured, using default" << endl;
+            }
+            FileRegistry* files = FileRegistry::getInstance();
+            files->setMapped(files->getId(t_file.c_str()), t.storage == TABLE_STORAGE_MMAP);
+        }
+        
+        // Start reading the pages cached at the last checkpoint while recovery and the prompt come up
+        string warm_file = db_name_input + BUFFER_POOL_WARM_SUFFIX;
+        size_t warm = BufferPool::getInstance()->warmUp(warm_file.c_str());
+        if (warm > 0) {
+            cout << "Warming buffer pool with " << warm << " pages" << endl;
+        }
     }
 }
 
@@ -180,6 +209,38 @@ bool DataBase::createTable(const std::string& sql){
         cout<<"Create table failed: Unable to parse attributes" <<endl;
         return false;
     }
+    for(auto& a : ture_attr){
+        if(_stricmp(a.constraint, "PRIMARY KEY") == 0 && a.key_kind == STRING_KEY && a.max_size > MAXSIZE_KEY){
+            cout << "Create table failed: Primary key " << a.name << " is wider than " << MAXSIZE_KEY << " bytes" << endl;
+            return false;
+        }
+    }
+
+    // WITH (pool = 'name') puts the table in a buffer pool partition from minilog.conf,
+    // WITH (storage = 'mmap') reads its rows through a mapping of the file
+    string pool;
+    int storage = TABLE_STORAGE_POOL;
+    map<string, string> options = SQL::parseTableOptions(sql);
+    for(auto& option : options){
+        if(option.first == "pool"){
+            pool = option.second;
+        }
+        else if(option.first == "storage"){
+            if(_stricmp(option.second.c_str(), "mmap") == 0) storage = TABLE_STORAGE_MMAP;
+            else if(_stricmp(option.second.c_str(), "pool") != 0){
+                cout << "Create table failed: Unknown storage '" << option.second << "'" << endl;
+                return false;
+            }
+        }
+        else{
+            cout << "Create table failed: Unknown table option " << option.first << endl;
+            return false;
+        }
+    }
+    if(!BufferPool::getInstance()->assignFile(tablename.c_str(), pool.c_str())){
+        cout << "Create table failed: Unknown buffer pool partition '" << pool << "'" << endl;
+        return false;
+    }
 
     attribute attr[ATTR_MAX_NUM];
     int attr_num=ture_attr.size();
@@ -188,7 +249,12 @@ bool DataBase::createTable(const std::string& sql){
     }
     
     // Create physical file
-    FileManager::getInstance()->table_create(tablename.c_str(), attr_num, attr);
+    if(!FileManager::getInstance()->table_create(tablename.c_str(), attr_num, attr, pool.c_str(), storage)){
+        cout << "Create table failed: Unable to create " << tablename << endl;
+        return false;
+    }
+    FileRegistry* files = FileRegistry::getInstance();
+    files->setMapped(files->getId(tablename.c_str()), storage == TABLE_STORAGE_MMAP);
     
     // Remove .bin suffix and store in table list
     tablename.erase(tablename.size() - 4);
@@ -263,8 +329,9 @@ void DataBase::select(const std::string& sql){
     vector<string>attributeNames;
     vector<LOGIC>Logics;
     vector<WhereCondition>whereConditions=SQL::parseSelectStatement(sql,attributeNames,Logics);
+    OrderLimit order=SQL::parseOrderLimit(sql);
     BPlusTree* bp=new BPlusTree(fpath);
-    bp->Select_Data(attributeNames, Logics, whereConditions);
+    bp->Select_Data(attributeNames, Logics, whereConditions, order);
     
     delete bp;
 }
@@ -372,8 +439,7 @@ void DataBase::Drop(const std::string& sql){
     fclose(file);
     
     // Delete physical file
-    int res=remove(fpath.c_str());
-    if(res!=0){
+    if(!FileManager::getInstance()->removeFile(fpath.c_str())){
         cout<<"Failed to delete file"<<endl;
         return;
     }
@@ -434,6 +500,47 @@ void DataBase::printTableNames(){
     }
 }
 
+void DataBase::printStatus(bool per_file){
+    BufferPoolStatus bp = BufferPool::getInstance()->getStatus();
+    uint64_t lookups = bp.hits + bp.misses;
+    double ratio = lookups ? 100.0 * bp.hits / lookups : 0.0;
+    
+    cout << "Buffer pool: " << bp.pool_pages << " pages, " << bp.resident << " resident, "
+         << bp.dirty << " dirty, " << bp.pinned << " pinned" << endl;
+    cout << "  hits " << bp.hits << ", misses " << bp.misses << ", hit ratio "
+         << fixed << setprecision(1) << ratio << "%" << defaultfloat << endl;
+    cout << "  evictions " << bp.evictions << " (" << bp.dirty_evictions << " dirty), pin failures "
+         << bp.pin_failures << endl;
+    cout << "  reads " << bp.read_ios << ", pages read ahead " << bp.prefetched << ", writes "
+         << bp.pages_written << " pages in " << bp.write_ios << " I/Os (" << bp.writer_pages
+         << " by the background writer), syncs " << bp.syncs << endl;
+    cout << "  compressed tier: " << bp.compressed_pages << " pages in " << bp.compressed_bytes / 1024
+         << " KB, " << bp.compressed_hits << " pages restored from it" << endl;
+    
+    if(per_file){
+        vector<PartitionStatus> parts = BufferPool::getInstance()->getPartitions();
+        for(const PartitionStatus& p : parts){
+            cout << "Partition " << p.name << ": " << p.pages << " pages (min " << p.min_pages
+                 << ", max " << p.max_pages << ")" << endl;
+        }
+        vector<FileResidency> files = BufferPool::getInstance()->getResidency();
+        for(const FileResidency& f : files){
+            cout << "  " << f.name << ": " << f.pages << " pages, " << f.dirty << " dirty" << endl;
+        }
+        return;
+    }
+    
+    FileManagerStatus fm = FileManager::getInstance()->getStatus();
+    cout << "Records: " << fm.records_read << " read, " << fm.records_written << " written, "
+         << fm.records_allocated << " allocated, " << fm.records_freed << " freed, "
+         << fm.mapped_reads << " blocks read through mmap" << endl;
+    cout << "Blocks: " << fm.blocks_allocated << " allocated, files grew by " << fm.blocks_appended
+         << " in " << fm.extents << " extents, " << fm.block_map_loads << " block graph loads" << endl;
+    NodeCache* nodes = NodeCache::getInstance();
+    cout << "Node cache: " << nodes->size() << " internal nodes, " << nodes->hits.get() << " hits, "
+         << nodes->decodes.get() << " decoded, " << nodes->evictions.get() << " evicted" << endl;
+}
+
 void DataBase::flush(){
     string meta_file = string(this->db.db_name) + ".meta";
     FileManager::getInstance()->flushDatabase(meta_file, this->db);
@@ -21,6 +21,8 @@ class DataBase {
         void flush();
         void init();
         void printTableNames();
+        // SHOW STATUS counters, per_file adds the pages each file holds in the pool (SHOW BUFFERPOOL)
+        void printStatus(bool per_file);
         database db;
     private:
         
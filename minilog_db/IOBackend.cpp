@@ -0,0 +1,344 @@
+#include "IOBackend.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+IOBackend* IOBackend::instance = nullptr;
+int IOBackend::wanted = IO_BACKEND;
+
+bool IOBackend::configure(int kind) {
+    if (instance != nullptr) {
+        return false;
+    }
+    wanted = kind;
+    return true;
+}
+
+IOBackend* IOBackend::getInstance() {
+    static std::once_flag created;
+    std::call_once(created, [] {
+        if (wanted == IO_BACKEND_URING && UringBackend::supported()) {
+            instance = new UringBackend();
+        } else {
+            if (wanted == IO_BACKEND_URING) {
+                std::cerr << "io_uring not available, using the thread-pool I/O backend" << std::endl;
+            }
+            instance = new ThreadPoolBackend(IO_THREADS);
+        }
+    });
+    return instance;
+}
+
+void IOBackend::stopInstance() {
+    if (instance != nullptr) {
+        instance->stop();
+    }
+}
+
+void IOBackend::perform(IORequest& req) {
+    ssize_t n = 0;
+    switch (req.op) {
+    case IO_READ:
+        n = preadv(req.fd, req.iov, req.iovcnt, req.offset);
+        break;
+    case IO_WRITE:
+        n = pwritev(req.fd, req.iov, req.iovcnt, req.offset);
+        break;
+    default:
+        n = fdatasync(req.fd);
+        break;
+    }
+    req.result = n < 0 ? -errno : n;
+    if (req.op == IO_WRITE) {
+        completeWrite(req);
+    }
+}
+
+void IOBackend::completeWrite(IORequest& req) {
+    size_t total = 0;
+    for (int i = 0; i < req.iovcnt; i++) {
+        total += req.iov[i].iov_len;
+    }
+    if (req.result < 0 || (size_t)req.result == total) {
+        return;
+    }
+
+    // Skip what was written and go on with plain pwritev
+    std::vector<struct iovec> rest(req.iov, req.iov + req.iovcnt);
+    size_t done = (size_t)req.result;
+    size_t first = 0;
+    size_t skip = done;
+    while (done < total) {
+        while (skip >= rest[first].iov_len) {
+            skip -= rest[first].iov_len;
+            first++;
+        }
+        rest[first].iov_base = (char*)rest[first].iov_base + skip;
+        rest[first].iov_len -= skip;
+        ssize_t n = pwritev(req.fd, rest.data() + first, (int)(rest.size() - first), req.offset + done);
+        if (n <= 0) {
+            req.result = n < 0 ? -errno : -EIO;
+            return;
+        }
+        done += n;
+        skip = n;
+    }
+    req.result = (ssize_t)total;
+}
+
+/*
+ * io_uring
+ */
+struct UringRing {
+    int fd;
+    void* sq_ptr;
+    void* cq_ptr;
+    size_t sq_bytes, cq_bytes;
+    struct io_uring_sqe* sqes;
+    size_t sqe_bytes;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe* cqes;
+
+    UringRing() : fd(-1), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes((struct io_uring_sqe*)MAP_FAILED) {}
+    ~UringRing() { close(); }
+
+    bool open();
+    void close();
+};
+
+bool UringRing::open() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = (int)syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &p);
+    if (fd < 0) {
+        return false;
+    }
+    entries = p.sq_entries;
+
+    // Kernels with IORING_FEAT_SINGLE_MMAP share one mapping between both rings
+    sq_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        sq_bytes = cq_bytes = sq_bytes > cq_bytes ? sq_bytes : cq_bytes;
+    }
+    sq_ptr = mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        close();
+        return false;
+    }
+    cq_ptr = single ? sq_ptr
+                    : mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+        close();
+        return false;
+    }
+    sqe_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        close();
+        return false;
+    }
+
+    char* sq = (char*)sq_ptr;
+    sq_head = (unsigned*)(sq + p.sq_off.head);
+    sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + p.sq_off.array);
+    char* cq = (char*)cq_ptr;
+    cq_head = (unsigned*)(cq + p.cq_off.head);
+    cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+void UringRing::close() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqe_bytes);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_bytes);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_bytes);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    sq_ptr = cq_ptr = MAP_FAILED;
+    sqes = (struct io_uring_sqe*)MAP_FAILED;
+}
+
+UringRing& UringBackend::ring() {
+    static thread_local UringRing ring;
+    return ring;
+}
+
+bool UringBackend::supported() {
+    UringRing probe;
+    return probe.open();
+}
+
+void UringBackend::run(IORequest* reqs, int count) {
+    UringRing& r = ring();
+    if (r.fd < 0 && !r.open()) {
+        // Out of locked memory for another ring, this thread does its I/O itself
+        for (int i = 0; i < count; i++) {
+            perform(reqs[i]);
+        }
+        return;
+    }
+
+    for (int base = 0; base < count; base += (int)r.entries) {
+        int n = count - base < (int)r.entries ? count - base : (int)r.entries;
+
+        // Only this thread produces, the kernel reads the tail once it is published
+        unsigned tail = *r.sq_tail;
+        for (int i = 0; i < n; i++) {
+            IORequest& req = reqs[base + i];
+            unsigned idx = tail & *r.sq_mask;
+            struct io_uring_sqe* sqe = &r.sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = req.fd;
+            if (req.op == IO_FSYNC) {
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            } else {
+                sqe->opcode = req.op == IO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+                sqe->off = (uint64_t)req.offset;
+                sqe->addr = (uint64_t)(uintptr_t)req.iov;
+                sqe->len = (unsigned)req.iovcnt;
+            }
+            sqe->user_data = (uint64_t)(base + i);
+            r.sq_array[idx] = idx;
+            req.result = -EIO;
+            tail++;
+        }
+        __atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+
+        // One io_uring_enter submits the round and waits for all of it
+        int to_submit = n;
+        int done = 0;
+        while (true) {
+            unsigned head = *r.cq_head;
+            unsigned ready = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != ready; head++) {
+                struct io_uring_cqe* cqe = &r.cqes[head & *r.cq_mask];
+                reqs[cqe->user_data].result = cqe->res;
+                done++;
+            }
+            __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+            if (done >= n) {
+                break;
+            }
+
+            int ret = (int)syscall(__NR_io_uring_enter, r.fd, to_submit, n - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret >= 0) {
+                to_submit -= ret;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                // The ring is unusable: give it up, the next batch of this thread sets up a new one
+                std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+                r.close();
+                break;
+            }
+        }
+        if (r.fd < 0) {
+            for (int i = base + n; i < count; i++) {
+                reqs[i].result = -EIO;
+            }
+            return;
+        }
+
+        for (int i = base; i < base + n; i++) {
+            if (reqs[i].op == IO_WRITE) {
+                completeWrite(reqs[i]);
+            }
+        }
+    }
+}
+
+/*
+ * Thread pool
+ */
+ThreadPoolBackend::ThreadPoolBackend(int threads) : stopping(false) {
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(&ThreadPoolBackend::workerLoop, this);
+    }
+}
+
+ThreadPoolBackend::~ThreadPoolBackend() {
+    stop();
+}
+
+void ThreadPoolBackend::stop() {
+    std::vector<std::thread> joining;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+        joining.swap(workers);
+    }
+    cv.notify_all();
+    for (std::thread& worker : joining) {
+        worker.join();
+    }
+}
+
+void ThreadPoolBackend::workerLoop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [this] { return stopping || !queue.empty(); });
+        // Jobs queued before the stop still run, their callers are waiting for them
+        if (queue.empty()) {
+            return;
+        }
+        Job job = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        perform(*job.req);
+        {
+            std::lock_guard<std::mutex> done(job.batch->mtx);
+            if (--job.batch->pending == 0) {
+                job.batch->cv.notify_one();
+            }
+        }
+        lock.lock();
+    }
+}
+
+void ThreadPoolBackend::run(IORequest* reqs, int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (count == 1) {
+        // Nothing to overlap with, a hand-off would only add latency
+        perform(reqs[0]);
+        return;
+    }
+
+    Batch batch;
+    batch.pending = count - 1;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!stopping) {
+            for (int i = 1; i < count; i++) {
+                queue.push_back(Job{ &reqs[i], &batch });
+            }
+            queued = true;
+        }
+    }
+    if (!queued) {
+        // The workers are gone, the final flushes at shutdown run here
+        for (int i = 0; i < count; i++) {
+            perform(reqs[i]);
+        }
+        return;
+    }
+    cv.notify_all();
+
+    perform(reqs[0]);
+    std::unique_lock<std::mutex> lock(batch.mtx);
+    batch.cv.wait(lock, [&batch] { return batch.pending == 0; });
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// I/O backends
+#define IO_BACKEND_URING 1
+#define IO_BACKEND_THREADS 2
+
+// Default backend. IO_BACKEND_URING falls back to IO_BACKEND_THREADS when the kernel refuses io_uring
+#define IO_BACKEND IO_BACKEND_URING
+
+// Submission queue entries of one io_uring, larger batches are submitted in several rounds
+#define IO_QUEUE_DEPTH 64
+
+// Worker threads of the thread-pool backend
+#define IO_THREADS 4
+
+// Request operations
+#define IO_READ 1
+#define IO_WRITE 2
+#define IO_FSYNC 3   // fdatasync of fd, offset and iov unused
+
+// One positional vectored read or write, or a data sync of a file
+struct IORequest {
+    int op;                      // IO_READ, IO_WRITE or IO_FSYNC
+    int fd;
+    off_t offset;                // Byte offset in the file
+    const struct iovec* iov;
+    int iovcnt;
+    ssize_t result;              // Bytes transferred (0 for IO_FSYNC), -errno on failure
+
+    IORequest() : op(IO_READ), fd(-1), offset(0), iov(nullptr), iovcnt(0), result(0) {}
+    IORequest(int op, int fd, off_t offset, const struct iovec* iov, int iovcnt)
+        : op(op), fd(fd), offset(offset), iov(iov), iovcnt(iovcnt), result(0) {}
+};
+
+// Carries out the block I/O of the buffer pool and the WAL. run() hands a whole batch over at
+// once and returns when every request of it has finished, so one thread keeps many I/Os in
+// flight with a single submission. Requests of a batch may complete in any order.
+// Writes are done in full or fail, reads come back short only at the end of the file
+class IOBackend {
+private:
+    static IOBackend* instance;
+    static int wanted;
+
+protected:
+    // Synchronous fallback for one request
+    static void perform(IORequest& req);
+
+    // Finish a write the kernel did only part of
+    static void completeWrite(IORequest& req);
+
+public:
+    virtual ~IOBackend() {}
+
+    // Submit count requests and wait for all of them
+    virtual void run(IORequest* reqs, int count) = 0;
+
+    // IO_BACKEND_URING or IO_BACKEND_THREADS, the one actually in use
+    virtual int kind() const = 0;
+
+    // Join the backend's own threads once they are done. Later batches run on the caller's thread
+    virtual void stop() {}
+
+    // Choose the backend, only before the first getInstance. False if it is too late
+    static bool configure(int kind);
+
+    static IOBackend* getInstance();
+
+    // stop() the backend in use, if one was created
+    static void stopInstance();
+};
+
+struct UringRing;
+
+// io_uring through the raw system calls. Every thread gets its own ring on first use, so
+// submitting needs no lock and nobody reaps another thread's completions
+class UringBackend : public IOBackend {
+private:
+    static UringRing& ring();
+
+public:
+    // Whether this kernel lets us set up a ring
+    static bool supported();
+
+    void run(IORequest* reqs, int count) override;
+    int kind() const override { return IO_BACKEND_URING; }
+};
+
+// pread/pwrite on a pool of worker threads. The caller does one request itself and waits for
+// the workers to finish the rest
+class ThreadPoolBackend : public IOBackend {
+private:
+    struct Batch {
+        std::mutex mtx;
+        std::condition_variable cv;
+        int pending;
+    };
+    struct Job {
+        IORequest* req;
+        Batch* batch;
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Job> queue;
+    std::vector<std::thread> workers;
+    bool stopping;
+
+    void workerLoop();
+
+public:
+    explicit ThreadPoolBackend(int threads);
+    ~ThreadPoolBackend() override;
+
+    void run(IORequest* reqs, int count) override;
+    int kind() const override { return IO_BACKEND_THREADS; }
+    void stop() override;
+};
@@ -0,0 +1,189 @@
+#include "KeySearch.h"
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    #include <immintrin.h>
+    #define KEY_SEARCH_X86
+#endif
+
+static int search_width = KEY_SEARCH_AUTO;
+
+// Keys in a[0, n) below x, or not above x when upper is set
+template <typename T>
+static int countScalar(const T* a, int n, T x, bool upper) {
+    int c = 0;
+    for (int i = 0; i < n; i++) {
+        c += upper ? (a[i] <= x) : (a[i] < x);
+    }
+    return c;
+}
+
+#ifdef KEY_SEARCH_X86
+// The vector loops count a[i] > x for upper (the rest is not above x) and x > a[i] otherwise
+
+__attribute__((target("avx2")))
+static int countInt32Avx2(const int* a, int n, int x, bool upper) {
+    __m256i vx = _mm256_set1_epi32(x);
+    int c = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i m = upper ? _mm256_cmpgt_epi32(v, vx) : _mm256_cmpgt_epi32(vx, v);
+        int bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        c += upper ? 8 - bits : bits;
+    }
+    return c + countScalar(a + i, n - i, x, upper);
+}
+
+static int countInt32Sse2(const int* a, int n, int x, bool upper) {
+    __m128i vx = _mm_set1_epi32(x);
+    int c = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i m = upper ? _mm_cmpgt_epi32(v, vx) : _mm_cmpgt_epi32(vx, v);
+        int bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+        c += upper ? 4 - bits : bits;
+    }
+    return c + countScalar(a + i, n - i, x, upper);
+}
+
+__attribute__((target("avx2")))
+static int countInt64Avx2(const long long* a, int n, long long x, bool upper) {
+    __m256i vx = _mm256_set1_epi64x(x);
+    int c = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i m = upper ? _mm256_cmpgt_epi64(v, vx) : _mm256_cmpgt_epi64(vx, v);
+        int bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+        c += upper ? 4 - bits : bits;
+    }
+    return c + countScalar(a + i, n - i, x, upper);
+}
+
+__attribute__((target("sse4.2")))
+static int countInt64Sse42(const long long* a, int n, long long x, bool upper) {
+    __m128i vx = _mm_set1_epi64x(x);
+    int c = 0, i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i m = upper ? _mm_cmpgt_epi64(v, vx) : _mm_cmpgt_epi64(vx, v);
+        int bits = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(m)));
+        c += upper ? 2 - bits : bits;
+    }
+    return c + countScalar(a + i, n - i, x, upper);
+}
+#endif
+
+static int countKeys(const int* a, int n, int x, bool upper) {
+#ifdef KEY_SEARCH_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (search_width == KEY_SEARCH_SCALAR) return countScalar(a, n, x, upper);
+    if (search_width == KEY_SEARCH_SSE) return countInt32Sse2(a, n, x, upper);
+    if (search_width == KEY_SEARCH_AVX2) return countInt32Avx2(a, n, x, upper);
+    return avx2 ? countInt32Avx2(a, n, x, upper) : countInt32Sse2(a, n, x, upper);
+#else
+    return countScalar(a, n, x, upper);
+#endif
+}
+
+static int countKeys(const long long* a, int n, long long x, bool upper) {
+#ifdef KEY_SEARCH_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (search_width == KEY_SEARCH_SCALAR) return countScalar(a, n, x, upper);
+    if (search_width == KEY_SEARCH_SSE) return countInt64Sse42(a, n, x, upper);
+    if (search_width == KEY_SEARCH_AVX2) return countInt64Avx2(a, n, x, upper);
+    if (avx2) return countInt64Avx2(a, n, x, upper);
+    if (sse42) return countInt64Sse42(a, n, x, upper);
+#endif
+    return countScalar(a, n, x, upper);
+}
+
+bool keySearchUseWidth(int width) {
+#ifdef KEY_SEARCH_X86
+    // SSE stands for SSE2 with INT keys and SSE4.2 with BIGINT keys, ask for the latter
+    if (width == KEY_SEARCH_SSE && !__builtin_cpu_supports("sse4.2")) return false;
+    if (width == KEY_SEARCH_AVX2 && !__builtin_cpu_supports("avx2")) return false;
+#else
+    if (width == KEY_SEARCH_SSE || width == KEY_SEARCH_AVX2) return false;
+#endif
+    search_width = width;
+    return true;
+}
+
+// Halve the range without branching on the keys until it fits the window, then count it
+template <typename T>
+static int boundNumber(const char* keys, int n, const void* key, bool upper) {
+    const T* a = (const T*)keys;
+    const T* base = a;
+    T x;
+    memcpy(&x, key, sizeof(T));
+    while (n > KEY_SEARCH_WINDOW) {
+        int half = n / 2;
+        T probe = base[half - 1];
+        base += (upper ? probe <= x : probe < x) ? half : 0;
+        n -= half;
+    }
+    return (int)(base - a) + countKeys(base, n, x, upper);
+}
+
+// Same order as cmp and eql: negative, zero or positive as a is below, equal to or above b
+static int compareKey(const char* a, const void* b, KEY_KIND key_kind, size_t key_size) {
+    if (key_kind == INT_KEY) {
+        int x, y;
+        memcpy(&x, a, sizeof(int));
+        memcpy(&y, b, sizeof(int));
+        return (x > y) - (x < y);
+    }
+    if (key_kind == LL_KEY) {
+        long long x, y;
+        memcpy(&x, a, sizeof(long long));
+        memcpy(&y, b, sizeof(long long));
+        return (x > y) - (x < y);
+    }
+    return strncmp(a, (const char*)b, key_size);
+}
+
+static int boundGeneric(const char* keys, int n, const void* key, KEY_KIND key_kind, size_t key_size, bool upper) {
+    const char* base = keys;
+    while (n > 1) {
+        int half = n / 2;
+        int c = compareKey(base + (half - 1) * key_size, key, key_kind, key_size);
+        base += (upper ? c <= 0 : c < 0) ? half * key_size : 0;
+        n -= half;
+    }
+    int pos = (int)((base - keys) / key_size);
+    if (n == 1) {
+        int c = compareKey(base, key, key_kind, key_size);
+        pos += (upper ? c <= 0 : c < 0) ? 1 : 0;
+    }
+    return pos;
+}
+
+static int bound(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size, bool upper) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (key_kind == INT_KEY && key_size == sizeof(int)) {
+        return boundNumber<int>(keys, count, key, upper);
+    }
+    if (key_kind == LL_KEY && key_size == sizeof(long long)) {
+        return boundNumber<long long>(keys, count, key, upper);
+    }
+    return boundGeneric(keys, count, key, key_kind, key_size, upper);
+}
+
+int keyUpperBound(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size) {
+    return bound(keys, count, key, key_kind, key_size, true);
+}
+
+int keyLowerBound(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size) {
+    return bound(keys, count, key, key_kind, key_size, false);
+}
+
+int keyFind(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size) {
+    int pos = keyLowerBound(keys, count, key, key_kind, key_size);
+    if (pos < count && compareKey(keys + pos * key_size, key, key_kind, key_size) == 0) {
+        return pos;
+    }
+    return -1;
+}
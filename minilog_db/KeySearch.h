@@ -0,0 +1,26 @@
+#pragma once
+#include "rwdata.h"
+
+/* Search inside a node. The keys of a node are stored back to back, key_size bytes each, in
+ascending order. A binary search without data dependent branches narrows the range down to
+KEY_SEARCH_WINDOW keys, which are then counted: with AVX2 or SSE for INT and BIGINT keys when
+the CPU has them, one key at a time otherwise. String keys compare like cmp/eql in BPTree.h */
+#define KEY_SEARCH_WINDOW 16
+
+// Position (0 based) of the first of the count keys that is greater than key, count if none is
+int keyUpperBound(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size);
+
+// Position of the first key that is not less than key, count if none is
+int keyLowerBound(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size);
+
+// Position of the key equal to key, -1 if there is none
+int keyFind(const char* keys, int count, const void* key, KEY_KIND key_kind, size_t key_size);
+
+// Counting loops, KEY_SEARCH_AUTO takes the widest the CPU has
+#define KEY_SEARCH_AUTO 0
+#define KEY_SEARCH_SCALAR 1
+#define KEY_SEARCH_SSE 2
+#define KEY_SEARCH_AVX2 3
+
+// Count with the given loop from now on, false if the CPU lacks it. Lets tests check every loop
+bool keySearchUseWidth(int width);
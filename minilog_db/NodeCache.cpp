@@ -0,0 +1,187 @@
+#include "NodeCache.h"
+#include "BufferPool.h"
+#include "KeySearch.h"
+#include <cstring>
+
+NodeCache* NodeCache::getInstance() {
+    static NodeCache* cache = new NodeCache();
+    return cache;
+}
+
+off_t NodeCache::descend(const char* filename, off_t root, const void* key, KEY_KIND key_kind, size_t key_size,
+                         std::vector<off_t>* path) {
+    std::lock_guard<std::mutex> lock(mtx);
+    CachedNode* node = get(filename, root, key_size);
+    if (!node) {
+        return root;
+    }
+    for (;;) {
+        // First key greater than key
+        int i = keyUpperBound(node->keys, node->count, key, key_kind, key_size);
+        if (path) path->push_back(node->self);
+        if (node->leaf_children) {
+            return node->children[i];
+        }
+        CachedNode* next = child(filename, node, i, key_size);
+        if (!next) {
+            return node->children[i];
+        }
+        node = next;
+    }
+}
+
+CachedNode* NodeCache::get(const char* filename, off_t offt, size_t key_size, CachedNode* keep) {
+    uint32_t file_id = FileRegistry::getInstance()->getId(filename);
+    auto file = files.find(file_id);
+    if (file != files.end()) {
+        auto it = file->second.find(offt);
+        if (it != file->second.end()) {
+            hits.add();
+            it->second->referenced = true;
+            return it->second;
+        }
+    }
+
+    CachedNode* node = decode(filename, file_id, offt, key_size);
+    if (!node) {
+        return NULL;
+    }
+    if (nodes >= NODE_CACHE_MAX_NODES) {
+        CachedNode* old = victim(keep);
+        if (!old) {
+            delete[] (char*)node;
+            return NULL;
+        }
+        auto old_file = files.find(old->file_id);
+        old_file->second.erase(old->self);
+        if (old_file->second.empty()) files.erase(old_file);
+        remove(old);
+        evictions.add();
+    }
+
+    if (free_slots.empty()) {
+        node->slot = clock.size();
+        clock.push_back(node);
+    } else {
+        node->slot = free_slots.back();
+        free_slots.pop_back();
+        clock[node->slot] = node;
+    }
+    files[file_id][offt] = node;
+    nodes++;
+    return node;
+}
+
+CachedNode* NodeCache::victim(CachedNode* keep) {
+    // A node used since the hand last passed it gets another round
+    for (size_t swept = 0; swept < 2 * clock.size(); swept++) {
+        CachedNode* node = clock[hand];
+        hand = (hand + 1) % clock.size();
+        if (!node || node == keep) {
+            continue;
+        }
+        if (node->referenced) {
+            node->referenced = false;
+            continue;
+        }
+        return node;
+    }
+    return NULL;
+}
+
+void NodeCache::remove(CachedNode* node) {
+    if (node->parent) {
+        node->parent->child[node->parent_slot] = NULL;
+    }
+    for (int i = 0; i <= node->count; i++) {
+        if (node->child[i] && node->child[i]->parent == node) node->child[i]->parent = NULL;
+    }
+    clock[node->slot] = NULL;
+    free_slots.push_back(node->slot);
+    nodes--;
+    delete[] (char*)node;
+}
+
+CachedNode* NodeCache::decode(const char* filename, uint32_t file_id, off_t offt, size_t key_size) {
+    FileManager* fm = FileManager::getInstance();
+    if (fm->get_BlockType(filename, offt) != BLOCK_INTER) {
+        return NULL;
+    }
+    PageGuard page(file_id, offt, PAGE_READ);
+    if (!page.valid()) {
+        return NULL;
+    }
+
+    // Same layout as CInternalNode: the node structure, 2v + 1 child blocks, then 2v keys
+    const inter_node* header = page.as<inter_node>();
+    int max_count = 2 * NODE_ORDER(key_size);
+    if (header->node_type != NODE_TYPE_INTERNAL || header->count > (size_t)max_count) {
+        return NULL;
+    }
+    int count = (int)header->count;
+    const off_t* children = page.as<off_t>(sizeof(inter_node));
+    const char* keys = (const char*)(children + max_count + 1);
+
+    size_t keys_size = count * key_size;
+    size_t children_size = (count + 1) * sizeof(off_t);
+    char* mem = new char[sizeof(CachedNode) + children_size + (count + 1) * sizeof(CachedNode*) + keys_size];
+    CachedNode* node = (CachedNode*)mem;
+    node->self = offt;
+    node->count = count;
+    node->referenced = true;
+    node->file_id = file_id;
+    node->slot = 0;
+    node->parent = NULL;
+    node->parent_slot = 0;
+    node->children = (off_t*)(mem + sizeof(CachedNode));
+    node->child = (CachedNode**)(mem + sizeof(CachedNode) + children_size);
+    node->keys = (char*)(node->child + count + 1);
+    memcpy(node->children, children, children_size);
+    memset(node->child, 0, (count + 1) * sizeof(CachedNode*));
+    memcpy(node->keys, keys, keys_size);
+    node->leaf_children = fm->get_BlockType(filename, children[0]) == BLOCK_LEAF;
+    decodes.add();
+    return node;
+}
+
+void NodeCache::invalidate(const char* filename, off_t offt) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto file = files.find(FileRegistry::getInstance()->findId(filename));
+    if (file == files.end()) {
+        return;
+    }
+    auto it = file->second.find(offt);
+    if (it == file->second.end()) {
+        return;
+    }
+    remove(it->second);
+    file->second.erase(it);
+    if (file->second.empty()) files.erase(file);
+}
+
+void NodeCache::drop(const char* filename) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (filename == NULL) {
+        for (auto& file : files) {
+            for (auto& entry : file.second) delete[] (char*)entry.second;
+        }
+        files.clear();
+        clock.clear();
+        free_slots.clear();
+        hand = 0;
+        nodes = 0;
+        return;
+    }
+    auto it = files.find(FileRegistry::getInstance()->findId(filename));
+    if (it == files.end()) {
+        return;
+    }
+    // A tree's nodes only point at each other, no other file's node is left pointing here
+    for (auto& entry : it->second) {
+        clock[entry.second->slot] = NULL;
+        free_slots.push_back(entry.second->slot);
+        delete[] (char*)entry.second;
+    }
+    nodes -= it->second.size();
+    files.erase(it);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "rwdata.h"
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Decoded internal nodes kept in all, beyond this the clock evicts nodes not used lately
+#define NODE_CACHE_MAX_NODES 4096
+
+// An internal node decoded out of its block: its keys and child blocks copied into one allocation.
+// child[i] is swizzled into a direct pointer to the decoded child the first time a descent passes
+// through it, so a hot lookup walks the upper levels without touching the buffer pool
+struct CachedNode {
+    off_t self;
+    int count;              // Keys, there are count + 1 children
+    bool leaf_children;     // The children are leaves, which are never cached
+    bool referenced;        // Clock bit, set on every hit
+    uint32_t file_id;
+    size_t slot;            // Place on the clock
+    CachedNode* parent;     // Node whose child pointer is swizzled to this one, NULL if none
+    int parent_slot;        // Index of that pointer in parent->child
+    char* keys;             // count keys of the tree's key size
+    off_t* children;        // count + 1 child blocks
+    CachedNode** child;     // count + 1 swizzled children, NULL until decoded
+};
+
+/* Decoded-node cache of all trees, by file and block. A node's entry is dropped, together with
+the swizzled pointer to it, whenever the node is written or its block changes type, so entries
+never go stale; removeFile, deleteFile and recovery drop whole files. Once full, a clock over the
+entries evicts nodes not used since its last pass. Every session shares the cache, so a whole
+descent runs under its mutex, as do invalidate and drop: no entry is freed under a walker */
+class NodeCache {
+private:
+    mutable std::mutex mtx;
+    std::unordered_map<uint32_t, std::unordered_map<off_t, CachedNode*>> files;
+    std::vector<CachedNode*> clock;     // Every node at its slot, NULL for a free slot
+    std::vector<size_t> free_slots;
+    size_t hand;
+    size_t nodes;
+
+    NodeCache() : hand(0), nodes(0) {}
+    CachedNode* decode(const char* filename, uint32_t file_id, off_t offt, size_t key_size);
+    // Node the clock evicts next, never keep. NULL if there is no other
+    CachedNode* victim(CachedNode* keep);
+    // Unlink node from its parent and children and free it, its files entry is up to the caller
+    void remove(CachedNode* node);
+
+    // The decoded internal node at block offt, read on a miss. NULL if the block holds no
+    // internal node or no other node than keep could be evicted for it. Called with mtx held
+    CachedNode* get(const char* filename, off_t offt, size_t key_size, CachedNode* keep = NULL);
+
+    // Child i (0 based) of node, swizzling the pointer on first use. Called with mtx held
+    CachedNode* child(const char* filename, CachedNode* node, int i, size_t key_size) {
+        CachedNode* next = node->child[i];
+        if (next) {
+            hits.add();
+            next->referenced = true;
+            return next;
+        }
+        // node itself must survive the eviction a miss may cause
+        next = get(filename, node->children[i], key_size, node);
+        if (next) {
+            if (next->parent && next->parent != node) next->parent->child[next->parent_slot] = NULL;
+            node->child[i] = next;
+            next->parent = node;
+            next->parent_slot = i;
+        }
+        return next;
+    }
+
+public:
+    StatCounter hits;      // Nodes served without reading their block
+    StatCounter decodes;   // Nodes read from the pool and decoded
+    StatCounter evictions; // Nodes the clock made room for others with
+
+    static NodeCache* getInstance();
+
+    // Walk the decoded internal levels of the tree rooted at root towards key. Returns the block
+    // of the first node not in the cache: the leaf, or an internal node when the cache is full.
+    // path, if given, receives the cached nodes passed, root first
+    off_t descend(const char* filename, off_t root, const void* key, KEY_KIND key_kind, size_t key_size,
+                  std::vector<off_t>* path);
+
+    // Forget the node at block offt, after it was written
+    void invalidate(const char* filename, off_t offt);
+
+    // Forget the nodes of the file, NULL forgets everything
+    void drop(const char* filename);
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return nodes;
+    }
+};
@@ -0,0 +1,217 @@
+#include "Replacer.h"
+
+Replacer* Replacer::create(int kind, int frames, int capacity) {
+    if (capacity <= 0 || capacity > frames) capacity = frames;
+    switch (kind) {
+    case REPLACER_LRU:
+        return new LRUReplacer(frames);
+    case REPLACER_CLOCK:
+        return new ClockReplacer(frames);
+    default:
+        return new TwoQueueReplacer(frames, capacity);
+    }
+}
+
+void FrameList::push_front(int frame) {
+    prev[frame] = -1;
+    next[frame] = head;
+    if (head >= 0) prev[head] = frame;
+    else tail = frame;
+    head = frame;
+}
+
+void FrameList::push_back(int frame) {
+    next[frame] = -1;
+    prev[frame] = tail;
+    if (tail >= 0) next[tail] = frame;
+    else head = frame;
+    tail = frame;
+}
+
+void FrameList::erase(int frame) {
+    if (prev[frame] >= 0) next[prev[frame]] = next[frame];
+    else head = next[frame];
+    if (next[frame] >= 0) prev[next[frame]] = prev[frame];
+    else tail = prev[frame];
+    prev[frame] = next[frame] = -1;
+}
+
+/*
+ * LRU
+ */
+void LRUReplacer::setEvictable(int frame, bool evictable) {
+    if (evictable && !listed[frame]) {
+        list.push_front(frame);
+        listed[frame] = 1;
+    } else if (!evictable && listed[frame]) {
+        list.erase(frame);
+        listed[frame] = 0;
+    }
+}
+
+int LRUReplacer::victim() {
+    if (list.empty()) {
+        return -1;
+    }
+    int frame = list.back();
+    list.erase(frame);
+    listed[frame] = 0;
+    return frame;
+}
+
+void LRUReplacer::reinstate(int frame) {
+    list.push_back(frame);
+    listed[frame] = 1;
+}
+
+void LRUReplacer::remove(int frame) {
+    setEvictable(frame, false);
+}
+
+/*
+ * CLOCK
+ */
+void ClockReplacer::loaded(int frame, uint64_t) {
+    used[frame] = 1;
+    referenced[frame] = 1;
+    evictable[frame] = 0;
+}
+
+void ClockReplacer::accessed(int frame) {
+    referenced[frame] = 1;
+}
+
+void ClockReplacer::setEvictable(int frame, bool evictable) {
+    this->evictable[frame] = evictable;
+}
+
+int ClockReplacer::victim() {
+    // Two turns clear every reference bit, after that only pinned frames are left
+    int frames = (int)used.size();
+    for (int step = 0; step < 2 * frames; step++) {
+        int frame = hand;
+        hand = (hand + 1) % frames;
+        if (!used[frame] || !evictable[frame]) {
+            continue;
+        }
+        if (referenced[frame]) {
+            referenced[frame] = 0;
+            continue;
+        }
+        used[frame] = 0;
+        evictable[frame] = 0;
+        return frame;
+    }
+    return -1;
+}
+
+void ClockReplacer::reinstate(int frame) {
+    used[frame] = 1;
+    evictable[frame] = 1;
+}
+
+void ClockReplacer::remove(int frame) {
+    used[frame] = 0;
+    referenced[frame] = 0;
+    evictable[frame] = 0;
+}
+
+/*
+ * 2Q
+ */
+TwoQueueReplacer::TwoQueueReplacer(int frames, int capacity)
+    : a1in(frames), am(frames), queue(frames, 0), evictable(frames, 0), evicted_from(frames, 0), keys(frames, 0),
+      a1in_count(0) {
+    // A1in takes a quarter of the frames as in the paper. A1out only holds keys, so it remembers
+    // a few times the frame count: a hot page must come back before a scan pushes it out of A1out
+    a1in_max = capacity / 4 > 0 ? capacity / 4 : 1;
+    a1out_max = capacity * 4;
+}
+
+void TwoQueueReplacer::loaded(int frame, uint64_t key) {
+    keys[frame] = key;
+    evictable[frame] = 0;
+    auto ghost = a1out_keys.find(key);
+    if (ghost != a1out_keys.end()) {
+        // Asked for again after leaving A1in: a hot page
+        a1out_keys.erase(ghost);
+        queue[frame] = 2;
+    } else {
+        // Its place in the FIFO is fixed now, pins and unpins don't move it
+        queue[frame] = 1;
+        a1in.push_front(frame);
+        a1in_count++;
+    }
+}
+
+void TwoQueueReplacer::setEvictable(int frame, bool evictable) {
+    if (!queue[frame] || this->evictable[frame] == evictable) {
+        return;
+    }
+    this->evictable[frame] = evictable;
+    if (queue[frame] == 2) {
+        if (evictable) am.push_front(frame);
+        else am.erase(frame);
+    }
+}
+
+void TwoQueueReplacer::forget(int frame) {
+    if (queue[frame] == 1) {
+        a1in.erase(frame);
+        a1in_count--;
+    } else if (queue[frame] == 2 && evictable[frame]) {
+        am.erase(frame);
+    }
+    queue[frame] = 0;
+    evictable[frame] = 0;
+}
+
+int TwoQueueReplacer::victim() {
+    // The oldest unpinned page of A1in, pinned ones are passed over where they stand
+    int first_in = a1in.back();
+    while (first_in >= 0 && !evictable[first_in]) {
+        first_in = a1in.before(first_in);
+    }
+    
+    // Keep A1in at its quota, Am only gives up frames once A1in is small or fully pinned
+    if (first_in >= 0 && (a1in_count >= a1in_max || am.empty())) {
+        forget(first_in);
+        evicted_from[first_in] = 1;
+        a1out.push_back(keys[first_in]);
+        a1out_keys.insert(keys[first_in]);
+        if (a1out.size() > a1out_max) {
+            auto old = a1out_keys.find(a1out.front());
+            if (old != a1out_keys.end()) a1out_keys.erase(old);
+            a1out.pop_front();
+        }
+        return first_in;
+    }
+    if (!am.empty()) {
+        int frame = am.back();
+        forget(frame);
+        evicted_from[frame] = 2;
+        return frame;
+    }
+    return -1;
+}
+
+void TwoQueueReplacer::reinstate(int frame) {
+    queue[frame] = evicted_from[frame];
+    evictable[frame] = 1;
+    if (queue[frame] == 2) {
+        am.push_back(frame);
+        return;
+    }
+    a1in.push_back(frame);
+    a1in_count++;
+    // Take back the ghost victim() left, the page never left
+    if (!a1out.empty() && a1out.back() == keys[frame]) {
+        auto ghost = a1out_keys.find(keys[frame]);
+        if (ghost != a1out_keys.end()) a1out_keys.erase(ghost);
+        a1out.pop_back();
+    }
+}
+
+void TwoQueueReplacer::remove(int frame) {
+    forget(frame);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <cstdint>
+#include <cstddef>
+
+// Replacement policies
+#define REPLACER_LRU 1
+#define REPLACER_CLOCK 2
+#define REPLACER_2Q 3
+
+// Decides which frame of a buffer pool shard to reuse. Frames are numbered 0..frames-1 inside
+// the shard, the shard's mutex is held on every call. Only frames marked evictable
+// (pin_count == 0) may be returned by victim()
+class Replacer {
+public:
+    virtual ~Replacer() {}
+
+    // A page (identified by key) was just read into the frame, the frame starts pinned
+    virtual void loaded(int frame, uint64_t key) = 0;
+
+    // The resident page in frame was requested again
+    virtual void accessed(int frame) = 0;
+
+    // Called when the pin count of frame drops to zero (true) or leaves zero (false)
+    virtual void setEvictable(int frame, bool evictable) = 0;
+
+    // Pick an evictable frame and stop tracking it, -1 if every frame is pinned
+    virtual int victim() = 0;
+
+    // The frame victim() just returned keeps its page after all (it failed to flush): it goes
+    // back to the old end of the queue it came from, still evictable
+    virtual void reinstate(int frame) = 0;
+
+    // The frame was emptied without an eviction (its file was dropped)
+    virtual void remove(int frame) = 0;
+
+    // frames numbers the shard's frames, capacity is how many of them this replacer will hold
+    // at most (its buffer pool partition's share of the shard), 0 for all of them
+    static Replacer* create(int kind, int frames, int capacity = 0);
+};
+
+// Doubly linked list of frame numbers threaded through two arrays, for O(1) unlink
+class FrameList {
+private:
+    std::vector<int> prev, next;
+    int head, tail;
+
+public:
+    explicit FrameList(int frames) : prev(frames, -1), next(frames, -1), head(-1), tail(-1) {}
+
+    bool empty() const { return head < 0; }
+    int back() const { return tail; }
+    int before(int frame) const { return prev[frame]; }
+    void push_front(int frame);
+    void push_back(int frame);
+    void erase(int frame);
+};
+
+// Least recently unpinned frame goes first
+class LRUReplacer : public Replacer {
+private:
+    FrameList list;
+    std::vector<char> listed;
+
+public:
+    explicit LRUReplacer(int frames) : list(frames), listed(frames, 0) {}
+
+    void loaded(int, uint64_t) override {}
+    void accessed(int) override {}
+    void setEvictable(int frame, bool evictable) override;
+    int victim() override;
+    void reinstate(int frame) override;
+    void remove(int frame) override;
+};
+
+// Second chance: the hand clears reference bits and takes the first unreferenced unpinned frame
+class ClockReplacer : public Replacer {
+private:
+    std::vector<char> used, referenced, evictable;
+    int hand;
+
+public:
+    explicit ClockReplacer(int frames) : used(frames, 0), referenced(frames, 0), evictable(frames, 0), hand(0) {}
+
+    void loaded(int frame, uint64_t key) override;
+    void accessed(int frame) override;
+    void setEvictable(int frame, bool evictable) override;
+    int victim() override;
+    void reinstate(int frame) override;
+    void remove(int frame) override;
+};
+
+// 2Q (Johnson & Shasha): new pages enter a FIFO (A1in) and only move to the LRU queue (Am) when
+// they are requested again after being evicted from it, which is remembered in a ghost queue
+// (A1out) of page keys. Repeated hits while in A1in neither promote nor move the page, so a scan
+// that touches each data page several times in a row still cannot push index and graph pages out
+// of Am. A1in frames stay linked in load order while pinned, Am frames are linked while unpinned
+class TwoQueueReplacer : public Replacer {
+private:
+    FrameList a1in, am;
+    std::vector<char> queue;         // 0 = not tracked, 1 = A1in, 2 = Am
+    std::vector<char> evictable;     // Pin count is zero
+    std::vector<char> evicted_from;  // Queue victim() took the frame from, for reinstate
+    std::vector<uint64_t> keys;
+    int a1in_count;
+    int a1in_max;
+
+    std::deque<uint64_t> a1out;
+    std::unordered_multiset<uint64_t> a1out_keys;
+    size_t a1out_max;
+
+    void forget(int frame);
+
+public:
+    TwoQueueReplacer(int frames, int capacity);
+
+    void loaded(int frame, uint64_t key) override;
+    void accessed(int) override {}
+    void setEvictable(int frame, bool evictable) override;
+    int victim() override;
+    void reinstate(int frame) override;
+    void remove(int frame) override;
+};
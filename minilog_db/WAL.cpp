@@ -1,9 +1,11 @@
 #include "WAL.h"
 #include "BufferPool.h"
 #include "rwdata.h" 
+#include "NodeCache.h"
 #include <iostream>
 #include <cstdio>
 #include <cstring>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h> 
 
@@ -12,7 +14,7 @@ namespace SQL {
 // WAL Implementation
 WAL* WAL::instance = nullptr;
 
-WAL::WAL() : current_lsn(1), wal_file(nullptr), is_recovering(false) {}
+WAL::WAL() : current_lsn(1), wal_fd(-1), wal_end(0), is_recovering(false) {}
 
 WAL* WAL::getInstance() {
     if (instance == nullptr) {
@@ -28,36 +30,26 @@ bool WAL::init(const std::string& db_name) {
     struct stat st;
     bool wal_exists = (stat(wal_path.c_str(), &st) == 0);
     
-    if (!wal_exists) {
-        // Create new WAL file
-        wal_file = fopen(wal_path.c_str(), "wb+");
-        if (!wal_file) {
-            std::cerr << "Failed to create WAL file: " << wal_path << std::endl;
-            return false;
-        }
-        current_lsn = 1;
-    } else {
-        // Open existing WAL file in append mode
-        wal_file = fopen(wal_path.c_str(), "ab+");
-        if (!wal_file) {
-            std::cerr << "Failed to open WAL file: " << wal_path << std::endl;
-            return false;
-        }
-        
-        // Find the last LSN
-        fseek(wal_file, 0, SEEK_END);
-        long file_size = ftell(wal_file);
-        
-        if (file_size > 0) {
-            // Read through the file to find the last LSN
-            // I know that in a real production system, this should be read backwards from the end or use an index.
-            // Scanning the entire large log file is inefficient, but sufficient for this db.
-            rewind(wal_file);
+    // Records are appended at wal_end with positional writes
+    wal_fd = open(wal_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (wal_fd < 0) {
+        std::cerr << "Failed to " << (wal_exists ? "open" : "create") << " WAL file: " << wal_path << std::endl;
+        return false;
+    }
+    current_lsn = 1;
+    wal_end = 0;
+    
+    if (wal_exists && st.st_size > 0) {
+        // Read through the file to find the last LSN
+        // I know that in a real production system, this should be read backwards from the end or use an index.
+        // Scanning the entire large log file is inefficient, but sufficient for this db.
+        FILE* log = fopen(wal_path.c_str(), "rb");
+        if (log) {
             LogRecord record;
             void* data = nullptr;
             uint64_t max_lsn = 0;
             
-            while (readLogRecord(wal_file, record, &data)) {
+            while (readLogRecord(log, record, &data)) {
                 if (record.lsn > max_lsn) {
                     max_lsn = record.lsn;
                 }
@@ -66,34 +58,39 @@ bool WAL::init(const std::string& db_name) {
                     data = nullptr;
                 }
             }
+            fclose(log);
             
             current_lsn = max_lsn + 1;
-            
-            // Reset file pointer to end for appending
-            fseek(wal_file, 0, SEEK_END);
         }
+        
+        // Append after everything, as the old append mode did
+        wal_end = st.st_size;
     }
     
     return true;
 }
 
 bool WAL::writeLogRecord(const LogRecord& record, const void* data) {
-    if (!wal_file) return false;
-    
-    // Write fixed-size record header
-    size_t written = fwrite(&record, sizeof(LogRecord), 1, wal_file);
-    if (written != 1) {
-        return false;
-    }
+    if (wal_fd < 0) return false;
     
-    // Write variable-length data if present
+    // Fixed-size record header, then the variable-length data if present
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)&record;
+    iov[0].iov_len = sizeof(LogRecord);
+    int iovcnt = 1;
     if (data && record.data_size > 0) {
-        written = fwrite(data, 1, record.data_size, wal_file);
-        if (written != record.data_size) {
-            return false;
-        }
+        iov[1].iov_base = (void*)data;
+        iov[1].iov_len = record.data_size;
+        iovcnt = 2;
     }
     
+    IORequest req(IO_WRITE, wal_fd, wal_end, iov, iovcnt);
+    IOBackend::getInstance()->run(&req, 1);
+    if (req.result < 0) {
+        // A torn record is overwritten by the next one
+        return false;
+    }
+    wal_end += req.result;
     return true;
 }
 
@@ -126,15 +123,17 @@ bool WAL::readLogRecord(FILE* file, LogRecord& record, void** data) {
     return true;
 }
 
-uint64_t WAL::logInsert(const std::string& table_name, off_t page_offset, const void* data, size_t size) {
+uint64_t WAL::logInsert(const std::string& table_name, off_t page_offset, const void* data, size_t size, size_t data_pos) {
     if (is_recovering) return 0; // Don't log during recovery
     
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.type = LOG_INSERT;
     record.timestamp = time(nullptr);
     strncpy(record.table_name, table_name.c_str(), 99);
     record.page_offset = page_offset;
+    record.data_pos = data_pos;
     record.data_size = size;
     
     if (writeLogRecord(record, data)) {
@@ -148,6 +147,7 @@ uint64_t WAL::logInsert(const std::string& table_name, off_t page_offset, const
 uint64_t WAL::logDelete(const std::string& table_name, off_t page_offset, const void* old_data, size_t size) {
     if (is_recovering) return 0;
     
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.type = LOG_DELETE;
@@ -168,6 +168,7 @@ uint64_t WAL::logUpdate(const std::string& table_name, off_t page_offset,
                         const void* old_data, const void* new_data, size_t size) {
     if (is_recovering) return 0;
     
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.type = LOG_UPDATE;
@@ -195,6 +196,7 @@ uint64_t WAL::logUpdate(const std::string& table_name, off_t page_offset,
 uint64_t WAL::logBeginTransaction(uint32_t txn_id) {
     if (is_recovering) return 0;
     
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.txn_id = txn_id;
@@ -213,6 +215,7 @@ uint64_t WAL::logBeginTransaction(uint32_t txn_id) {
 uint64_t WAL::logCommit(uint32_t txn_id) {
     if (is_recovering) return 0;
     
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.txn_id = txn_id;
@@ -231,6 +234,7 @@ uint64_t WAL::logCommit(uint32_t txn_id) {
 uint64_t WAL::logAbort(uint32_t txn_id) {
     if (is_recovering) return 0;
     
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.txn_id = txn_id;
@@ -253,6 +257,7 @@ bool WAL::checkpoint() {
     BufferPool::getInstance()->flushAllPages();
     
     // 2. Write checkpoint record to WAL
+    std::lock_guard<std::mutex> lock(log_mtx);
     LogRecord record;
     record.lsn = current_lsn++;
     record.type = LOG_CHECKPOINT;
@@ -347,15 +352,18 @@ bool WAL::recover(const std::string& db_name) {
         Page* page = bp->getPage(filename.c_str(), rec.page_offset);
         
         if (page) {
+            std::unique_lock<std::shared_mutex> latch(page->latch);
             std::cout << "  [REDO] LSN " << rec.lsn << " Type " << rec.type 
                       << " on " << filename << " (Block " << rec.page_offset << ")" << std::endl;
 
             // Perform Physical Redo
-            // The logic here is based on flush_data in rwdata.cpp, assuming the log records the content of the entire data block
+            // A record holds either a whole block image or a byte range of it starting at data_pos
+            // (slotted data pages only log the header, slot and record they touched)
             if (rec.type == LOG_INSERT) {
                 // Insert: directly write data from log to page
-                // this db's data block structure is simple, data is packed, so we overwrite directly
-                memcpy(page->data, rec_data, rec.data_size);
+                if (rec.data_pos + rec.data_size <= DB_BLOCK_SIZE) {
+                    memcpy(page->data + rec.data_pos, rec_data, rec.data_size);
+                }
             } 
             else if (rec.type == LOG_UPDATE) {
                 // Update: log contains [OldData | NewData]
@@ -363,7 +371,9 @@ bool WAL::recover(const std::string& db_name) {
                 size_t single_data_size = rec.data_size / 2;
                 char* new_data_ptr = (char*)rec_data + single_data_size;
                 
-                memcpy(page->data, new_data_ptr, single_data_size);
+                if (rec.data_pos + single_data_size <= DB_BLOCK_SIZE) {
+                    memcpy(page->data + rec.data_pos, new_data_ptr, single_data_size);
+                }
             }
 
             // Mark page as dirty, BufferPool will flush it to disk later
@@ -384,13 +394,15 @@ bool WAL::recover(const std::string& db_name) {
     // Force flush all redone dirty pages to disk to ensure durability
     std::cout << "Phase 3: Persistence - Flushing " << success_count << " pages to disk." << std::endl;
     bp->flushAllPages();
+    // Redo wrote graph pages and nodes behind the FileManager's back
+    FileManager::getInstance()->drop_BlockMap(NULL);
+    NodeCache::getInstance()->drop(NULL);
 
     // Phase 4: Cleanup
     // Clear WAL file (equivalent to an implicit Checkpoint), ready for new operations
-    wal_file = fopen(wal_file_path.c_str(), "wb");
-    if (wal_file) {
-        fclose(wal_file);
-        wal_file = nullptr;
+    FILE* cleared = fopen(wal_file_path.c_str(), "wb");
+    if (cleared) {
+        fclose(cleared);
     }
     
     // Checkpoint file can also be reset or deleted
@@ -404,17 +416,14 @@ bool WAL::recover(const std::string& db_name) {
 }
 
 void WAL::flush() {
-    if (wal_file) {
-        fflush(wal_file);
-        // In a production environment, fsync(fileno(wal_file)) should be called here to ensure OS flush
-    }
+    // writeLogRecord hands every record to the kernel, there is no user-space buffer left to push.
+    // In a production environment, an IO_FSYNC request should be submitted here to ensure OS flush
 }
 
 void WAL::close() {
-    if (wal_file) {
-        fflush(wal_file);
-        fclose(wal_file);
-        wal_file = nullptr;
+    if (wal_fd >= 0) {
+        ::close(wal_fd);
+        wal_fd = -1;
     }
 }
 
@@ -463,7 +472,14 @@ bool RecoveryManager::performRecovery() {
 
 bool RecoveryManager::createCheckpoint() {
     if (!wal) return false;
-    return wal->checkpoint();
+    if (!wal->checkpoint()) return false;
+    
+    // Remember what is cached, the next open of the database loads it again
+    std::string warm_path = current_db + BUFFER_POOL_WARM_SUFFIX;
+    if (!BufferPool::getInstance()->saveResidentPages(warm_path.c_str())) {
+        std::cerr << "Failed to save resident pages to " << warm_path << std::endl;
+    }
+    return true;
 }
 
 bool RecoveryManager::needsRecovery(const std::string& db_name) {
@@ -5,6 +5,7 @@
 #include <ctime>
 #include <cstring> 
 #include <cstdint> 
+#include <mutex>
 
 #define WAL_FILE_SUFFIX ".wal"
 #define CHECKPOINT_FILE_SUFFIX ".ckpt"
@@ -30,10 +31,11 @@ struct LogRecord {
     time_t timestamp;       // Timestamp
     char table_name[100];   // Table affected
     off_t page_offset;      // Page/block offset
+    size_t data_pos;        // Byte position of the data inside the page
     size_t data_size;       // Size of data
     // After this: variable-length data
     
-    LogRecord() : lsn(0), txn_id(0), type(LOG_BEGIN_TRANS), timestamp(0), page_offset(0), data_size(0) {
+    LogRecord() : lsn(0), txn_id(0), type(LOG_BEGIN_TRANS), timestamp(0), page_offset(0), data_pos(0), data_size(0) {
         memset(table_name, 0, 100);
     }
 };
@@ -43,12 +45,15 @@ private:
     static WAL* instance;
     std::string wal_path;
     uint64_t current_lsn;
-    FILE* wal_file;
+    int wal_fd;
+    off_t wal_end;          // Where the next record goes
     bool is_recovering;
+    // Keeps LSN order and file order the same when several threads log
+    std::mutex log_mtx;
     
     WAL();
     
-    // Write a log record to disk
+    // Write a log record to disk, header and data in one IOBackend request
     bool writeLogRecord(const LogRecord& record, const void* data = nullptr);
     
     // Read next log record from file
@@ -61,7 +66,8 @@ public:
     bool init(const std::string& db_name);
     
     // Log operations
-    uint64_t logInsert(const std::string& table_name, off_t page_offset, const void* data, size_t size);
+    // data_pos lets callers log only the byte range of the page they changed
+    uint64_t logInsert(const std::string& table_name, off_t page_offset, const void* data, size_t size, size_t data_pos = 0);
     uint64_t logDelete(const std::string& table_name, off_t page_offset, const void* old_data, size_t size);
     uint64_t logUpdate(const std::string& table_name, off_t page_offset, 
                        const void* old_data, const void* new_data, size_t size);
@@ -1,6 +1,7 @@
 #include "BPTree.h"
 #include"rwdata.h"
 #include "DataBase.h"
+#include "BufferPool.h"
 #include<iostream>
 #include <string>
 #include <vector>
@@ -132,19 +133,21 @@ char* getString(int index){
 	s[2]='\0';
 	return s;
 }
-void print_add_leaf(BPlusTree* bp,KEY_KIND key){
+void print_add_leaf(KEY_KIND key){
 	int size=0;
 	if (key==INT_KEY)size=sizeof(int);
 	else if(key==LL_KEY)size=sizeof(long long);
 	else if(key==STRING_KEY) size=100;//string的最大大小先写死
-	for(int i=2;i<NUM_ALL_BLOCK;i++){
-		if(bp->Block_GRAPH[i]==BLOCK_LEAF){
+	off_t count=FileManager::getInstance()->get_BlockCount("table.bin");
+	for(off_t i=2;i<count;i++){
+		char type=FileManager::getInstance()->get_BlockType("table.bin",i);
+		if(type==BLOCK_LEAF){
 			CLeafNode* c=new CLeafNode("table.bin",key,size,i);
 			//cout<<"父亲为"<<c->getPtFather()<<endl;
 			c->print_data();
 			cout<<endl;
 		}
-		else if(bp->Block_GRAPH[i]==BLOCK_INTER){
+		else if(type==BLOCK_INTER){
 			CInternalNode* c=new CInternalNode("table.bin",key,size,i);
 			c->print_data();
 			cout<<endl;
@@ -153,7 +156,18 @@ void print_add_leaf(BPlusTree* bp,KEY_KIND key){
 	}
 }
 
-int main(){
+int main(int argc, char** argv){
+	// Buffer pool settings: minilog.conf in the working directory first, then flags such as
+	// --pool_pages=4096 --replacer=clock --huge_pages --config=other.conf
+	BufferPoolConfig pool_config;
+	pool_config.loadFile(BUFFER_POOL_CONFIG_FILE);
+	for(int i=1;i<argc;i++){
+		if(!pool_config.parseFlag(argv[i])){
+			cout<<"Unknown option: "<<argv[i]<<endl;
+			return 1;
+		}
+	}
+	BufferPool::configure(pool_config);
     
 	DataBase* database=new DataBase();
 	//database->init();
@@ -180,7 +194,7 @@ int test_key_ll(){
 	BPlusTree* bp1 = new BPlusTree(fname);
 	CInternalNode* root=(CInternalNode*)bp1->GetRoot();
 	cout<<"root的偏移量为："<<root->getPtSelf()<<endl;
-	print_add_leaf(bp1,LL_KEY);
+	print_add_leaf(LL_KEY);
 	return 0;
 }
 int test_string(){
@@ -204,7 +218,7 @@ int test_string(){
 	BPlusTree* bp1 = new BPlusTree(fname);
 	CInternalNode* root=(CInternalNode*)bp1->GetRoot();
 	cout<<"root的偏移量为："<<root->getPtSelf()<<endl;
-	print_add_leaf(bp1,STRING_KEY);
+	print_add_leaf(STRING_KEY);
 
 
 
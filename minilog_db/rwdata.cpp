@@ -1,10 +1,12 @@
 #include "rwdata.h"
 #include "BufferPool.h"
 #include "WAL.h"
+#include "NodeCache.h"
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <string>
 
@@ -24,196 +26,32 @@ FileManager* FileManager::getInstance() {
     return m;
 }
 
-// getCInternalNode using BufferPool
-inter_node FileManager::getCInternalNode(Index idx, void* data[MAXNUM_KEY], off_t offt) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(idx.fpath, offt);
-    
-    if (!page) {
-        inter_node empty_node;
-        memset(&empty_node, 0, sizeof(inter_node));
-        return empty_node;
-    }
-    
-    // Read node data from page buffer
-    inter_node node;
-    memcpy(&node, page->data, sizeof(inter_node));
-    
-    // Read key data (following the node structure)
-    off_t arr_offt = sizeof(inter_node);
-    idx.offt_self = arr_offt;
-    
-    // Read key values from buffer page
-    if (idx.key_kind == INT_KEY) {
-        int* temp = (int*)(page->data + arr_offt);
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            data[i] = new int(temp[i]);
-        }
-    } else if (idx.key_kind == LL_KEY) {
-        long long* temp = (long long*)(page->data + arr_offt);
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            data[i] = new long long(temp[i]);
-        }
-    } else {
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            char* temp = new char[1024];
-            memcpy(temp, page->data + arr_offt + i * idx.max_size, idx.max_size);
-            data[i] = temp;
-        }
-    }
-    
-    // Release page (decrement pin count)
-    bp->unpinPage(idx.fpath, offt, false);
-    
-    return node;
-}
-
-// flushInterNode
-bool FileManager::flushInterNode(inter_node node, Index idx, void** key) {
-    BufferPool* bp = BufferPool::getInstance();
-    off_t block_idx = idx.offt_self / DB_BLOCK_SIZE;
-    Page* page = bp->getPage(idx.fpath, block_idx);
-    
-    if (!page) {
+// flushNode
+bool FileManager::flushNode(PageGuard& page, const char* filename, off_t offt, const void* node, size_t node_size) {
+    if (!page.valid()) {
         return false;
     }
+    std::unique_lock<std::shared_mutex> latch(page.latch());
     
-    // Write node structure
-    memcpy(page->data, &node, sizeof(inter_node));
+    // Keys and offsets were changed in place, only the node structure is still to write
+    memcpy(page.data(), node, node_size);
     
-    // Write key data
-    off_t offset = sizeof(inter_node);
-    
-    if (idx.key_kind == INT_KEY) {
-        int temp[MAXNUM_KEY];
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            temp[i] = *(int*)key[i];
-        }
-        memcpy(page->data + offset, temp, sizeof(int) * MAXNUM_KEY);
-    } else if (idx.key_kind == LL_KEY) {
-        long long temp[MAXNUM_KEY];
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            temp[i] = *(long long*)key[i];
-        }
-        memcpy(page->data + offset, temp, sizeof(long long) * MAXNUM_KEY);
-    } else {
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            memcpy(page->data + offset + i * idx.max_size, 
-                   (char*)key[i], idx.max_size);
-        }
-    }
-
     // Write WAL log (Page Image)
     // Even for Update, we log complete Insert (overwrite) log for easier recovery via memcpy
-    std::string table_name = getTableNameFromPath(idx.fpath);
-    WAL::getInstance()->logInsert(table_name, block_idx, page->data, DB_BLOCK_SIZE);
-    
-    // Mark as dirty and release
-    bp->unpinPage(idx.fpath, block_idx, true);
-    
-    return true;
-}
-
-// getLeafNode
-leaf_node FileManager::getLeafNode(Index idx, void* data[MAXNUM_DATA], off_t offt) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(idx.fpath, offt);
-    
-    if (!page) {
-        leaf_node empty_node;
-        memset(&empty_node, 0, sizeof(leaf_node));
-        return empty_node;
-    }
-    
-    // Read node data from page buffer
-    leaf_node node;
-    memcpy(&node, page->data, sizeof(leaf_node));
-    
-    // Read data values (following the node structure)
-    off_t arr_offt = sizeof(leaf_node);
-    idx.offt_self = arr_offt;
-    
-    // Read data values from buffer page
-    if (idx.key_kind == INT_KEY) {
-        int* temp = (int*)(page->data + arr_offt);
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            data[i] = new int(temp[i]);
-        }
-    } else if (idx.key_kind == LL_KEY) {
-        long long* temp = (long long*)(page->data + arr_offt);
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            data[i] = new long long(temp[i]);
-        }
-    } else {
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            char* temp = new char[1024];
-            memcpy(temp, page->data + arr_offt + i * idx.max_size, idx.max_size);
-            data[i] = temp;
-        }
-    }
-    
-    // Release page
-    bp->unpinPage(idx.fpath, offt, false);
-    
-    return node;
-}
-
-// flushLeafNode
-bool FileManager::flushLeafNode(leaf_node node, Index idx, void** value) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(idx.fpath, node.offt_self);
-    
-    if (!page) {
-        return false;
-    }
-    
-    // Write node structure
-    memcpy(page->data, &node, sizeof(leaf_node));
-    
-    // Write data values
-    off_t offset = sizeof(leaf_node);
-    idx.offt_self = offset;
-    
-    if (idx.key_kind == INT_KEY) {
-        int temp[MAXNUM_DATA];
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            temp[i] = *(int*)value[i];
-        }
-        memcpy(page->data + offset, temp, sizeof(int) * MAXNUM_DATA);
-    } else if (idx.key_kind == LL_KEY) {
-        long long temp[MAXNUM_DATA];
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            temp[i] = *(long long*)value[i];
-        }
-        memcpy(page->data + offset, temp, sizeof(long long) * MAXNUM_DATA);
-    } else {
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            memcpy(page->data + offset + i * idx.max_size,
-                   (char*)value[i], idx.max_size);
-        }
-    }
-
-    // Write WAL log
-    std::string table_name = getTableNameFromPath(idx.fpath);
-    WAL::getInstance()->logInsert(table_name, node.offt_self, page->data, DB_BLOCK_SIZE);
-    
-    // Mark as dirty and release
-    bp->unpinPage(idx.fpath, node.offt_self, true);
+    std::string table_name = getTableNameFromPath(filename);
+    WAL::getInstance()->logInsert(table_name, offt, page.data(), DB_BLOCK_SIZE);
     
+    page.markDirty();
     return true;
 }
 
 // getTable
 table FileManager::getTable(const char* filename, off_t offt) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(filename, offt);
+    PageGuard page = BufferPool::getInstance()->readPage(filename, offt);
     
-    table t;
-    if (page) {
-        memcpy(&t, page->data, sizeof(table));
-        bp->unpinPage(filename, offt, false);
-    } else {
-        memset(&t, 0, sizeof(table));
+    table t{};
+    if (page.valid()) {
+        memcpy(&t, page.data(), sizeof(table));
     }
     
     return t;
@@ -221,311 +59,409 @@ table FileManager::getTable(const char* filename, off_t offt) {
 
 // flushTable
 bool FileManager::flushTable(table t, const char* filename, off_t offt) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(filename, offt);
+    PageGuard page = BufferPool::getInstance()->writePage(filename, offt);
     
-    if (!page) {
+    if (!page.valid()) {
         return false;
     }
     
-    memcpy(page->data, &t, sizeof(table));
+    memcpy(page.data(), &t, sizeof(table));
 
     // Write WAL log and table header also needs recovery
     std::string table_name = getTableNameFromPath(filename);
-    WAL::getInstance()->logInsert(table_name, offt, page->data, DB_BLOCK_SIZE);
-
-    bp->unpinPage(filename, offt, true);
+    WAL::getInstance()->logInsert(table_name, offt, page.data(), DB_BLOCK_SIZE);
     
     return true;
 }
 
-void FileManager::flush_value(void* value[MAXNUM_DATA], Index idx) {
-    FILE* file = fopen(idx.fpath, "rb+");
-    if (fseek(file, idx.offt_self, SEEK_SET) != 0) {
-        perror("Failed to seek");
-        fclose(file);
-    }
-
-    if (idx.key_kind == INT_KEY) {
-        int temp[MAXNUM_DATA];
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            temp[i] = *(int*)value[i];
-        }
-        fwrite(&temp, sizeof(int), MAXNUM_DATA, file);
-    }
-    else if (idx.key_kind == LL_KEY) {
-        long long temp[MAXNUM_DATA];
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            temp[i] = *(long long*)value[i];
-        }
-        fwrite(&temp, sizeof(long long), MAXNUM_DATA, file);
+vector<char>* FileManager::find_BlockMap(const char* fname) {
+    if (last_map && last_map_name == fname) {
+        return last_map;
     }
-    else {
-        for (int i = 0; i < MAXNUM_DATA; i++) {
-            char* temp = (char*)value[i];
-            fwrite(temp, sizeof(char), idx.max_size, file);
-        }
+    auto it = block_maps.find(fname);
+    if (it == block_maps.end()) {
+        return NULL;
     }
-    fclose(file);
+    last_map_name = fname;
+    last_map = &it->second;
+    return last_map;
 }
 
-void FileManager::get_key(void* key[MAXNUM_KEY], Index idx) {
-    FILE* file = fopen(idx.fpath, "rb");
-    if (fseek(file, idx.offt_self, SEEK_SET) != 0) {
-        perror("Failed to seek");
-        fclose(file);
+vector<char>* FileManager::get_BlockMap(const char* fname, std::unique_lock<std::mutex>& lock) {
+    vector<char>* types = find_BlockMap(fname);
+    if (types) {
+        return types;
     }
-    if (idx.key_kind == INT_KEY) {
-        for (int i = 0; i < MAXNUM_DATA; ++i) {
-            int *temp = new int();
-            if (fread(temp, sizeof(int), 1, file) != 1) {
-                perror("Failed to read data");
-                fclose(file);
-                return;
-            }
-            key[i] = (void*)temp;
-        }
-    }
-    else if (idx.key_kind == LL_KEY) {
-        for (int i = 0; i < MAXNUM_DATA; ++i) {
-            long long *temp = new long long();
-            if (fread(temp, sizeof(long long), 1, file) != 1) {
-                perror("Failed to read data");
-                fclose(file);
-                return;
-            }
-            key[i] = (void*)temp;
-        }
+    
+    // The graph latches come before map_mtx
+    lock.unlock();
+    BufferPool* bp = BufferPool::getInstance();
+    Page* root_page = bp->getPage(fname, LOC_GRAPH);
+    if (!root_page) {
+        return NULL;
+    }
+    std::shared_lock<std::shared_mutex> root_latch(root_page->latch);
+    graph_root* root = (graph_root*)root_page->data;
+    if (root->num_pages == 0 || root->num_pages > GRAPH_MAX_PAGES) {
+        root_latch.unlock();
+        bp->unpinPage(fname, LOC_GRAPH, false);
+        lock.lock();
+        return NULL;
+    }
+    
+    vector<char> loaded(root->num_blocks, BLOCK_UNAVA);
+    for (uint32_t i = 0; i < root->num_pages; i++) {
+        off_t first = (off_t)i * GRAPH_PAGE_BLOCKS;
+        if (first >= root->num_blocks) break;
+        size_t count = root->num_blocks - first;
+        if (count > GRAPH_PAGE_BLOCKS) count = GRAPH_PAGE_BLOCKS;
+        Page* page = bp->getPage(fname, root->pages[i]);
+        if (!page) continue;
+        std::shared_lock<std::shared_mutex> latch(page->latch);
+        memcpy(loaded.data() + first, page->data, count);
+        latch.unlock();
+        bp->unpinPage(fname, root->pages[i], false);
+    }
+    
+    // Entered while the root latch still keeps flushBlock and newBlock out. If another session
+    // loaded the graph meanwhile, its copy is kept
+    lock.lock();
+    auto res = block_maps.emplace(string(fname), std::move(loaded));
+    root_latch.unlock();
+    bp->unpinPage(fname, LOC_GRAPH, false);
+    block_map_loads.add();
+    last_map_name = fname;
+    last_map = &res.first->second;
+    return last_map;
+}
+
+void FileManager::drop_BlockMap(const char* fname) {
+    std::lock_guard<std::mutex> lock(map_mtx);
+    last_map = NULL;
+    last_map_name.clear();
+    if (fname == NULL) {
+        block_maps.clear();
+        return;
     }
-    else {
-        for (int i = 0; i < MAXNUM_DATA; ++i) {
-            char temp[1024] = { 0 };
-            if (fread(temp, sizeof(char), idx.max_size, file) != idx.max_size) {
-                perror("Failed to read data");
-                fclose(file);
-                return;
-            }
-            key[i] = (void*)temp;
-        }
+    auto it = block_maps.find(fname);
+    if (it != block_maps.end()) {
+        block_maps.erase(it);
     }
-    fclose(file);
 }
 
-void FileManager::get_value(void* value[MAXNUM_DATA], Index idx) {
-    FILE* file = fopen(idx.fpath, "rb");
-    if (fseek(file, idx.offt_self, SEEK_SET) != 0) {
-        perror("Failed to seek");
-        fclose(file);
+char FileManager::raw_BlockType(const char* fname, off_t offt) {
+    std::unique_lock<std::mutex> lock(map_mtx);
+    vector<char>* types = get_BlockMap(fname, lock);
+    if (!types || offt < 0 || offt >= (off_t)types->size()) {
+        return BLOCK_UNAVA;
     }
+    return (*types)[offt];
+}
 
-    if (idx.key_kind == INT_KEY) {
-        for (int i = 0; i < MAXNUM_DATA; ++i) {
-            int *temp = new int();
-            if (fread(temp, sizeof(int), 1, file) != 1) {
-                perror("Failed to read data");
-                fclose(file);
-                return;
-            }
-            value[i] = (void*)temp;
-        }
+char FileManager::get_BlockType(const char* fname, off_t offt) {
+    char type = raw_BlockType(fname, offt);
+    return type == BLOCK_DATA_ROOM ? BLOCK_DATA : type;
+}
+
+off_t FileManager::get_BlockCount(const char* fname) {
+    std::unique_lock<std::mutex> lock(map_mtx);
+    vector<char>* types = get_BlockMap(fname, lock);
+    return types ? types->size() : 0;
+}
+
+off_t FileManager::next_Block(const char* fname, off_t offt, char type) {
+    std::unique_lock<std::mutex> lock(map_mtx);
+    vector<char>* types = get_BlockMap(fname, lock);
+    if (offt < 0) offt = 0;
+    if (!types || offt >= (off_t)types->size()) {
+        return INVALID;
     }
-    else if (idx.key_kind == LL_KEY) {
-        for (int i = 0; i < MAXNUM_DATA; ++i) {
-            long long *temp = new long long();
-            if (fread(temp, sizeof(long long), 1, file) != 1) {
-                perror("Failed to read data");
-                fclose(file);
-                return;
-            }
-            value[i] = (void*)temp;
-        }
+    if (type != BLOCK_DATA) {
+        const char* hit = (const char*)memchr(types->data() + offt, type, types->size() - offt);
+        return hit ? hit - types->data() : INVALID;
     }
-    else {
-        for (int i = 0; i < MAXNUM_DATA; ++i) {
-            char* temp=new char[1024];
-            if (fread(temp, sizeof(char), idx.max_size, file) != idx.max_size) {
-                perror("Failed to read data");
-                fclose(file);
-                return;
-            }
-            value[i] = temp;
-        }
+    for (off_t i = offt; i < (off_t)types->size(); i++) {
+        if ((*types)[i] == BLOCK_DATA || (*types)[i] == BLOCK_DATA_ROOM) return i;
     }
-    fclose(file);
+    return INVALID;
 }
 
-void FileManager::get_BlockGraph(const char* fname, char* freeBlock) {
+off_t FileManager::getFreeBlock(const char* fname, char type_block) {
     BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(fname, 1);  // Block graph is in the 1st block
-    
-    if (page) {
-        memcpy(freeBlock, page->data, NUM_ALL_BLOCK);
-        bp->unpinPage(fname, 1, false);
+    Page* root_page = bp->getPage(fname, LOC_GRAPH);
+    if (!root_page) {
+        return INVALID;
+    }
+    std::unique_lock<std::shared_mutex> root_latch(root_page->latch);
+    
+    // Level 1: summary bits point at graph pages that still have a free entry
+    // Level 2: the free entry inside that graph page
+    graph_root* root = (graph_root*)root_page->data;
+    off_t found = INVALID;
+    bool root_dirty = false;
+    for (uint32_t w = 0; w * 64 < root->num_pages && found == INVALID; w++) {
+        while (root->free_summary[w] != 0 && found == INVALID) {
+            uint32_t idx = w * 64 + __builtin_ctzll(root->free_summary[w]);
+            off_t graph_offt = root->pages[idx];
+            Page* page = bp->getPage(fname, graph_offt);
+            if (!page) break;
+            std::shared_lock<std::shared_mutex> latch(page->latch);
+            const char* hit = (const char*)memchr(page->data, BLOCK_FREE, GRAPH_PAGE_BLOCKS);
+            if (hit) found = (off_t)idx * GRAPH_PAGE_BLOCKS + (hit - page->data);
+            latch.unlock();
+            bp->unpinPage(fname, graph_offt, false);
+            
+            if (!hit) {
+                // Stale bit, the page has filled up
+                root->free_summary[w] &= ~(1ULL << (idx % 64));
+                log_range(fname, LOC_GRAPH, root_page->data, (char*)&root->free_summary[w] - root_page->data, sizeof(uint64_t));
+                root_dirty = true;
+            }
+        }
     }
+    root_latch.unlock();
+    bp->unpinPage(fname, LOC_GRAPH, root_dirty);
     
-    // To prevent issues, used blocks exceed actual file size
-    size_t i = getFileSize(fname);
-    i++;
-    for (int j = i; j < NUM_ALL_BLOCK; j++) {
-        freeBlock[j] = BLOCK_UNAVA;
+    if (found == INVALID) {
+        found = this->newBlock(fname);
+        if (found == INVALID) return INVALID;
     }
+    flushBlock(fname, found, type_block);
+    blocks_allocated.add();
+    return found;
 }
 
-char FileManager::get_BlockType(const char* fname, off_t offt) {
-    char* BlockGRAPH = new char[NUM_ALL_BLOCK];
-    get_BlockGraph(fname, BlockGRAPH);
-    char type = BlockGRAPH[offt];
-    delete[] BlockGRAPH;
-    return type;
-}
-
-void FileManager::flush_BlockGraph(Index idx, char* freeBlock) {
+bool FileManager::flushBlock(const char* filename, off_t offt, char type) {
     BufferPool* bp = BufferPool::getInstance();
-    // idx.offt_self here should be LOC_GRAPH (i.e., 1), which is a block index
-    Page* page = bp->getPage(idx.fpath, idx.offt_self);
+    Page* root_page = bp->getPage(filename, LOC_GRAPH);
+    if (!root_page) {
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> root_latch(root_page->latch);
     
-    if (page) {
-        memcpy(page->data, freeBlock, idx.max_size);
-
-        // Write WAL log 
-		// Allocation Graph is crucial
-        std::string table_name = getTableNameFromPath(idx.fpath);
-        WAL::getInstance()->logInsert(table_name, idx.offt_self, page->data, DB_BLOCK_SIZE);
-
-        bp->unpinPage(idx.fpath, idx.offt_self, true);
+    graph_root* root = (graph_root*)root_page->data;
+    if (offt < 0 || offt >= root->num_blocks) {
+        root_latch.unlock();
+        bp->unpinPage(filename, LOC_GRAPH, false);
+        return false;
+    }
+    uint32_t idx = offt / GRAPH_PAGE_BLOCKS;
+    off_t graph_offt = root->pages[idx];
+    
+    Page* page = bp->getPage(filename, graph_offt);
+    if (!page) {
+        root_latch.unlock();
+        bp->unpinPage(filename, LOC_GRAPH, false);
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> latch(page->latch);
+    size_t pos = offt % GRAPH_PAGE_BLOCKS;
+    bool was_node = page->data[pos] == BLOCK_INTER && type != BLOCK_INTER;
+    page->data[pos] = type;
+    bool has_free = (type == BLOCK_FREE) || memchr(page->data, BLOCK_FREE, GRAPH_PAGE_BLOCKS) != NULL;
+    log_range(filename, graph_offt, page->data, pos, 1);
+    latch.unlock();
+    bp->unpinPage(filename, graph_offt, true);
+    
+    {
+        std::lock_guard<std::mutex> lock(map_mtx);
+        vector<char>* types = find_BlockMap(filename);
+        if (types && offt < (off_t)types->size()) {
+            (*types)[offt] = type;
+        }
+    }
+    
+    // Keep the summary bit of this graph page in step
+    uint64_t& word = root->free_summary[idx / 64];
+    uint64_t bit = 1ULL << (idx % 64);
+    bool dirty = false;
+    if (has_free != ((word & bit) != 0)) {
+        if (has_free) word |= bit;
+        else word &= ~bit;
+        log_range(filename, LOC_GRAPH, root_page->data, (char*)&word - root_page->data, sizeof(uint64_t));
+        dirty = true;
+    }
+    root_latch.unlock();
+    bp->unpinPage(filename, LOC_GRAPH, dirty);
+    
+    // A decoded copy of the node must not outlive it. The cache reads the graph while it
+    // decodes, so it is told after the graph latches are let go
+    if (was_node) {
+        NodeCache::getInstance()->invalidate(filename, offt);
     }
+    return true;
 }
 
-off_t FileManager::getFreeBlock(const char* fname, char type_block) {
-    char* BlockGRAPH = new char[NUM_ALL_BLOCK];
-    get_BlockGraph(fname, BlockGRAPH);
-    
-    for (int i = 0; i < NUM_ALL_BLOCK; i++) {
-        if (BlockGRAPH[i] == BLOCK_FREE) {
-            Index index(fname, LOC_GRAPH, NUM_ALL_BLOCK, 1);
-            BlockGRAPH[i] = type_block;
-            flush_BlockGraph(index, BlockGRAPH);
-            delete[] BlockGRAPH;
-            return i;
-        }
-    }
-    
-    int i = this->newBlock(fname);
-    BlockGRAPH[i] = type_block;
-    Index index(fname, LOC_GRAPH, NUM_ALL_BLOCK, 1);
-    flush_BlockGraph(index, BlockGRAPH);
-    delete[] BlockGRAPH;
-    return i;
+bool FileManager::append_Block(const char* filename, off_t offt) {
+    // Write at the position the block graph expects rather than wherever the file ends
+    static const char zero[DB_BLOCK_SIZE] = { 0 };
+    return FileRegistry::getInstance()->writeBlock(filename, offt, zero);
 }
 
-void FileManager::flush_key(void* key[MAXNUM_KEY], Index idx) {
-    FILE* file = fopen(idx.fpath, "rb+");
-    if (fseek(file, idx.offt_self, SEEK_SET) != 0) {
-        perror("Failed to seek");
-        fclose(file);
-    }
-    if (idx.key_kind == INT_KEY) {
-        int temp[MAXNUM_KEY];
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            temp[i] = *(int*)key[i];
-        }
-        fwrite(&temp, sizeof(int), MAXNUM_KEY, file);
+bool FileManager::init_BlockGraph(const char* filename) {
+    // Block 0 is the table header, block 1 the graph root and block 2 the first graph page
+    for (int i = 0; i < 3; i++) {
+        if (!append_Block(filename, i)) return false;
     }
-    else if (idx.key_kind == LL_KEY) {
-        long long temp[MAXNUM_KEY];
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            temp[i] = *(long long*)key[i];
-        }
-        fwrite(&temp, sizeof(long long), MAXNUM_KEY, file);
+    
+    BufferPool* bp = BufferPool::getInstance();
+    Page* page = bp->getPage(filename, 2);
+    if (!page) {
+        return false;
     }
-    else {
-        for (int i = 0; i < MAXNUM_KEY; i++) {
-            char* temp = (char*)key[i];
-            fwrite(temp, sizeof(char), idx.max_size, file);
-        }
+    std::unique_lock<std::shared_mutex> latch(page->latch);
+    memset(page->data, BLOCK_UNAVA, GRAPH_PAGE_BLOCKS);
+    page->data[LOC_TABLE] = BLOCK_TLABE;
+    page->data[LOC_GRAPH] = BLOCK_GRAPH;
+    page->data[2] = BLOCK_GRAPH;
+    log_range(filename, 2, page->data, 0, DB_BLOCK_SIZE);
+    latch.unlock();
+    bp->unpinPage(filename, 2, true);
+    
+    Page* root_page = bp->getPage(filename, LOC_GRAPH);
+    if (!root_page) {
+        return false;
     }
-    fclose(file);
+    std::unique_lock<std::shared_mutex> root_latch(root_page->latch);
+    memset(root_page->data, 0, DB_BLOCK_SIZE);
+    graph_root* root = (graph_root*)root_page->data;
+    root->num_blocks = 3;
+    root->num_pages = 1;
+    root->pages[0] = 2;
+    log_range(filename, LOC_GRAPH, root_page->data, 0, DB_BLOCK_SIZE);
+    root_latch.unlock();
+    bp->unpinPage(filename, LOC_GRAPH, true);
+    return true;
 }
 
-bool FileManager::table_create(const char* path, size_t attr_num, attribute attr[ATTR_MAX_NUM]) {
-    size_t size = 0;
-    int max_key_size = 0;
+bool FileManager::table_create(const char* path, size_t attr_num, attribute attr[ATTR_MAX_NUM], const char* pool, int storage) {
+    // The primary key decides the index key type and width
     KEY_KIND key_type = INT_KEY;
-    
-    switch (key_type) {
-    case INT_KEY:
-        size = sizeof(int);
-        break;
-    case LL_KEY:
-        size = sizeof(long long);
-        break;
-    case STRING_KEY:
-        size = max_key_size;
-        break;
-    default:
-        size = max_key_size;
+    size_t size = sizeof(int);
+    for (size_t i = 0; i < attr_num; i++) {
+        if (_stricmp(attr[i].constraint, "PRIMARY KEY") != 0) continue;
+        key_type = attr[i].key_kind;
+        if (key_type == LL_KEY) size = sizeof(long long);
+        else if (key_type == STRING_KEY) size = attr[i].max_size;
         break;
     }
-
-    FILE* file = fopen(path, "r");
-    if (file) {
-        fclose(file);
-        remove(path);
+    if (size == 0) size = 1;
+    // Keys compare over their whole width, a shorter index key would merge distinct keys
+    if (size > MAXSIZE_KEY) {
+        return false;
     }
+
+    removeFile(path);
     
-    for(int i = 0; i < 6; i++) {
-        newBlock(path);
+    if (!init_BlockGraph(path) || newBlock(path) == INVALID) {
+        return false;
     }
     
     table t;
     strcpy(t.fpath, path);
     t.key_kind = key_type;
     t.m_Depth = 1;
-    t.offt_root = 2;
+    t.offt_root = INVALID;
+    t.offt_leftHead = INVALID;
+    t.offt_rightHead = INVALID;
     t.key_use_block = 1;
     t.value_use_block = 0;
-    for(int i = 0; i < attr_num; i++) {
+    for(size_t i = 0; i < attr_num; i++) {
         t.attr[i] = attr[i];
     }
     t.attr_num = attr_num;
     t.max_key_size = size;
+    t.offt_data_tail = INVALID;
+    memset(t.pool, 0, sizeof(t.pool));
+    strncpy(t.pool, pool, sizeof(t.pool) - 1);
+    t.storage = storage;
 
     flushTable(t, t.fpath, 0);
-
-    char block_graph[NUM_ALL_BLOCK];
-    block_graph[0] = BLOCK_TLABE;
-    block_graph[1] = BLOCK_GRAPH;
-    for(int j = 2; j < 6; j++) {
-        block_graph[j] = BLOCK_FREE;
-    }
-    for (int j = 6; j < NUM_ALL_BLOCK; j++) {
-        block_graph[j] = BLOCK_UNAVA;
-    }
-    
-    Index index(path, LOC_GRAPH, NUM_ALL_BLOCK, 1);
-    flush_BlockGraph(index, block_graph);
     
     return true;
 }
 
 off_t FileManager::newBlock(const char* filename) {
-    FILE* file = fopen(filename, "ab");
-    if(!file){
-        file = fopen(filename, "wb");
-    }
-    char zero[DB_BLOCK_SIZE] = { 0 };
-    fwrite(zero, 1, sizeof(zero), file);
-    off_t now = ftell(file) / DB_BLOCK_SIZE;
-    now--;
-    fclose(file);
-    
-    char* graph = new char[NUM_ALL_BLOCK];
-    get_BlockGraph(filename, graph);
-    graph[now] = BLOCK_FREE;
-    Index index(filename, LOC_GRAPH, NUM_ALL_BLOCK, 1);
-    flush_BlockGraph(index, graph);
-    delete[] graph;
-    
+    BufferPool* bp = BufferPool::getInstance();
+    Page* root_page = bp->getPage(filename, LOC_GRAPH);
+    if (!root_page) {
+        return INVALID;
+    }
+    std::unique_lock<std::shared_mutex> root_latch(root_page->latch);
+    graph_root* root = (graph_root*)root_page->data;
+    off_t now = root->num_blocks;
+    bool new_graph = false;
+    
+    // The graph pages are full, the new block becomes the next graph page
+    if (now / GRAPH_PAGE_BLOCKS >= root->num_pages) {
+        if (root->num_pages >= GRAPH_MAX_PAGES || !append_Block(filename, now)) {
+            root_latch.unlock();
+            bp->unpinPage(filename, LOC_GRAPH, false);
+            return INVALID;
+        }
+        Page* page = bp->getPage(filename, now);
+        if (!page) {
+            root_latch.unlock();
+            bp->unpinPage(filename, LOC_GRAPH, false);
+            return INVALID;
+        }
+        std::unique_lock<std::shared_mutex> latch(page->latch);
+        memset(page->data, BLOCK_UNAVA, GRAPH_PAGE_BLOCKS);
+        page->data[0] = BLOCK_GRAPH;
+        log_range(filename, now, page->data, 0, DB_BLOCK_SIZE);
+        latch.unlock();
+        bp->unpinPage(filename, now, true);
+        
+        root->pages[root->num_pages] = now;
+        log_range(filename, LOC_GRAPH, root_page->data, (char*)&root->pages[root->num_pages] - root_page->data, sizeof(uint32_t));
+        root->num_pages++;
+        root->num_blocks = ++now;
+        new_graph = true;
+    }
+    
+    // The extent ends with the graph page that describes it
+    off_t count = now < EXTENT_MIN_BLOCKS ? EXTENT_MIN_BLOCKS : now;
+    if (count > EXTENT_MAX_BLOCKS) count = EXTENT_MAX_BLOCKS;
+    if (count > GRAPH_PAGE_BLOCKS - now % GRAPH_PAGE_BLOCKS) count = GRAPH_PAGE_BLOCKS - now % GRAPH_PAGE_BLOCKS;
+    
+    uint32_t idx = now / GRAPH_PAGE_BLOCKS;
+    off_t graph_offt = root->pages[idx];
+    Page* page = bp->getPage(filename, graph_offt);
+    if (!page || !FileRegistry::getInstance()->allocateBlocks(filename, now, count)) {
+        root_latch.unlock();
+        if (page) bp->unpinPage(filename, graph_offt, false);
+        bp->unpinPage(filename, LOC_GRAPH, new_graph);
+        return INVALID;
+    }
+    root->num_blocks = now + count;
+    log_range(filename, LOC_GRAPH, root_page->data, 0, 2 * sizeof(uint32_t));
+    
+    // Enter the whole extent as free in one go
+    std::unique_lock<std::shared_mutex> latch(page->latch);
+    size_t pos = now % GRAPH_PAGE_BLOCKS;
+    memset(page->data + pos, BLOCK_FREE, count);
+    log_range(filename, graph_offt, page->data, pos, count);
+    latch.unlock();
+    bp->unpinPage(filename, graph_offt, true);
+    
+    uint64_t& word = root->free_summary[idx / 64];
+    word |= 1ULL << (idx % 64);
+    log_range(filename, LOC_GRAPH, root_page->data, (char*)&word - root_page->data, sizeof(uint64_t));
+    
+    // Grow the cached graph too
+    {
+        std::lock_guard<std::mutex> lock(map_mtx);
+        vector<char>* types = find_BlockMap(filename);
+        if (types) {
+            types->resize(root->num_blocks, BLOCK_FREE);
+            if (new_graph) (*types)[now - 1] = BLOCK_GRAPH;
+        }
+    }
+    root_latch.unlock();
+    bp->unpinPage(filename, LOC_GRAPH, true);
+    
+    blocks_appended.add(count);
+    extents.add();
     return now;
 }
 
@@ -539,105 +475,304 @@ size_t FileManager::getFileSize(const char* fileName) {
     return filesize / DB_BLOCK_SIZE;
 }
 
-bool FileManager::flushBlock(const char* filename, off_t offt, char type) {
-    char* block_graph = new char[NUM_ALL_BLOCK];
-    get_BlockGraph(filename, block_graph);
-    if(offt < 0 || offt >= NUM_ALL_BLOCK) {
-        delete[] block_graph;
+size_t FileManager::get_RecordSize(attribute attr[ATTR_MAX_NUM], int attrnum) {
+    size_t size = 0;
+    for(int i = 0; i < attrnum; i++) {
+        if(attr[i].key_kind == INT_KEY) size += sizeof(int);
+        else if(attr[i].key_kind == LL_KEY) size += sizeof(long long);
+        else if(attr[i].key_kind == STRING_KEY) size += attr[i].max_size;
+    }
+    return size;
+}
+
+void FileManager::log_range(const char* filename, off_t offt, const char* page_data, size_t pos, size_t size) {
+    std::string table_name = getTableNameFromPath(filename);
+    WAL::getInstance()->logInsert(table_name, offt, page_data + pos, size, pos);
+}
+
+off_t FileManager::place_record(const char* filename, off_t offt, size_t size, bool& room) {
+    PageGuard page = BufferPool::getInstance()->writePage(filename, offt);
+    
+    if (!page.valid()) {
+        return INVALID;
+    }
+    
+    data_page* header = page.as<data_page>();
+    data_slot* slots = page.as<data_slot>(sizeof(data_page));
+    
+    // Reuse the space of a deleted record first
+    int slot = -1;
+    for(int i = 0; i < header->slot_count; i++) {
+        if((slots[i].length & SLOT_FREE) && (slots[i].length & ~SLOT_FREE) >= size) {
+            slot = i;
+            break;
+        }
+    }
+    
+    if(slot == -1) {
+        size_t dir_end = sizeof(data_page) + (header->slot_count + 1) * sizeof(data_slot);
+        if(header->free_ptr < dir_end + size || header->slot_count >= (1 << RID_SLOT_BITS) - 1) {
+            return INVALID;
+        }
+        slot = header->slot_count++;
+        header->free_ptr -= size;
+        slots[slot].offset = header->free_ptr;
+    }
+    slots[slot].length = size;
+    header->live_count++;
+    room = header->live_count < header->slot_count;
+    
+    log_range(filename, offt, page.data(), 0, sizeof(data_page));
+    log_range(filename, offt, page.data(), (char*)&slots[slot] - page.data(), sizeof(data_slot));
+    
+    return MAKE_RID(offt, slot);
+}
+
+off_t FileManager::alloc_record(const char* filename, size_t size, off_t& offt_tail) {
+    if(size == 0 || size > DB_BLOCK_SIZE - sizeof(data_page) - sizeof(data_slot)) {
+        return INVALID;
+    }
+    
+    // Try the block rows were last placed in, then blocks with deleted records, before taking a new one
+    bool room;
+    if(offt_tail > LOC_GRAPH && get_BlockType(filename, offt_tail) == BLOCK_DATA) {
+        off_t rid = place_record(filename, offt_tail, size, room);
+        if(rid != INVALID) {
+            if(!room && raw_BlockType(filename, offt_tail) == BLOCK_DATA_ROOM) flushBlock(filename, offt_tail, BLOCK_DATA);
+            records_allocated.add();
+            return rid;
+        }
+    }
+    for(off_t offt = next_Block(filename, LOC_GRAPH + 1, BLOCK_DATA_ROOM); offt != INVALID; offt = next_Block(filename, offt + 1, BLOCK_DATA_ROOM)) {
+        off_t rid = place_record(filename, offt, size, room);
+        // Full now, or the free slots are too small for this record
+        if(!room || rid == INVALID) flushBlock(filename, offt, BLOCK_DATA);
+        if(rid != INVALID) {
+            offt_tail = offt;
+            records_allocated.add();
+            return rid;
+        }
+    }
+    
+    off_t offt = getFreeBlock(filename, BLOCK_DATA);
+    PageGuard page = BufferPool::getInstance()->writePage(filename, offt);
+    if (!page.valid()) {
+        return INVALID;
+    }
+    data_page* header = page.as<data_page>();
+    header->slot_count = 0;
+    header->live_count = 0;
+    header->free_ptr = DB_BLOCK_SIZE;
+    header->reserved = 0;
+    log_range(filename, offt, page.data(), 0, sizeof(data_page));
+    page.release();
+    
+    offt_tail = offt;
+    off_t rid = place_record(filename, offt, size, room);
+    if(rid != INVALID) records_allocated.add();
+    return rid;
+}
+
+bool FileManager::free_record(const char* filename, off_t rid) {
+    off_t offt = RID_BLOCK(rid);
+    int slot = RID_SLOT(rid);
+    PageGuard page = BufferPool::getInstance()->writePage(filename, offt);
+    
+    if (!page.valid()) {
         return false;
     }
-    block_graph[offt] = type;
-    Index index(filename, LOC_GRAPH, NUM_ALL_BLOCK, 1);
-    flush_BlockGraph(index, block_graph);
-    delete[] block_graph;
+    
+    data_page* header = page.as<data_page>();
+    data_slot* slots = page.as<data_slot>(sizeof(data_page));
+    if(slot >= header->slot_count || (slots[slot].length & SLOT_FREE)) {
+        return false;
+    }
+    
+    slots[slot].length |= SLOT_FREE;
+    header->live_count--;
+    bool empty = (header->live_count == 0);
+    
+    log_range(filename, offt, page.data(), 0, sizeof(data_page));
+    log_range(filename, offt, page.data(), (char*)&slots[slot] - page.data(), sizeof(data_slot));
+    page.release();
+    records_freed.add();
+    
+    // The last record is gone, hand the block back; otherwise its slot can take the next row
+    if(empty) flushBlock(filename, offt, BLOCK_FREE);
+    else if(raw_BlockType(filename, offt) == BLOCK_DATA) flushBlock(filename, offt, BLOCK_DATA_ROOM);
     return true;
 }
 
+void FileManager::scan_hint(const char* filename) {
+    FileRegistry* files = FileRegistry::getInstance();
+    uint32_t id = files->getId(filename);
+    if (files->isMapped(id)) {
+        // The kernel reads ahead in the mapping itself
+        files->mappedBlock(id, LOC_GRAPH);
+        files->adviseMapped(id, MADV_SEQUENTIAL);
+        files->adviseMapped(id, MADV_WILLNEED);
+        return;
+    }
+    off_t first = next_Block(filename, LOC_GRAPH + 1, BLOCK_DATA);
+    if (first != INVALID) {
+        BufferPool::getInstance()->readAhead(filename, first);
+    }
+}
+
+const char* FileManager::read_Block(const char* filename, off_t offt, PageGuard& page) {
+    FileRegistry* files = FileRegistry::getInstance();
+    uint32_t id = files->getId(filename);
+    if (files->isMapped(id)) {
+        // A resident page may be newer than the file, it wins. Otherwise the file is current:
+        // pages are written back before they leave the pool
+        page = PageGuard(id, offt, PAGE_READ, true);
+        if (page.valid()) {
+            return page.data();
+        }
+        const char* block = files->mappedBlock(id, offt);
+        if (block) {
+            mapped_reads.add();
+            return block;
+        }
+    }
+    page = PageGuard(id, offt, PAGE_READ);
+    return page.valid() ? page.data() : nullptr;
+}
+
+void FileManager::get_records(const char* filename, off_t offt, vector<off_t>& rids) {
+    PageGuard page;
+    const char* block = read_Block(filename, offt, page);
+    
+    if (!block) {
+        return;
+    }
+    
+    const data_page* header = (const data_page*)block;
+    const data_slot* slots = (const data_slot*)(block + sizeof(data_page));
+    for(int i = 0; i < header->slot_count; i++) {
+        if(!(slots[i].length & SLOT_FREE)) rids.push_back(MAKE_RID(offt, i));
+    }
+}
+
 bool FileManager::flush_data(const char* filename, void* data[ATTR_MAX_NUM], 
-                             attribute attr[ATTR_MAX_NUM], int attrnum, off_t offt) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(filename, offt);
+                             attribute attr[ATTR_MAX_NUM], int attrnum, off_t rid) {
+    off_t offt = RID_BLOCK(rid);
+    PageGuard page = BufferPool::getInstance()->writePage(filename, offt);
     
-    if (!page) {
+    if (!page.valid()) {
+        return false;
+    }
+    
+    data_page* header = page.as<data_page>();
+    data_slot* slot = page.as<data_slot>(sizeof(data_page)) + RID_SLOT(rid);
+    if(RID_SLOT(rid) >= header->slot_count || (slot->length & SLOT_FREE)) {
         return false;
     }
     
-    off_t offset = 0;
+    char* record = page.data() + slot->offset;
     for(int i = 0; i < attrnum; i++) {
         if(attr[i].key_kind == INT_KEY) {
-            int data_int = *(int*)data[i];
-            memcpy(page->data + offset, &data_int, sizeof(int));
-            offset += sizeof(int);
+            memcpy(record, data[i], sizeof(int));
+            record += sizeof(int);
         }
         else if(attr[i].key_kind == LL_KEY) {
-            long long data_long = *(long long*)data[i];
-            memcpy(page->data + offset, &data_long, sizeof(long long));
-            offset += sizeof(long long);
+            memcpy(record, data[i], sizeof(long long));
+            record += sizeof(long long);
         }
         else if(attr[i].key_kind == STRING_KEY) {
-            char* data_string = (char*)data[i];
-            memcpy(page->data + offset, data_string, attr[i].max_size);
-            offset += attr[i].max_size;
+            memcpy(record, data[i], attr[i].max_size);
+            record += attr[i].max_size;
         }
     }
 
-    std::string table_name = getTableNameFromPath(filename);
-    WAL::getInstance()->logInsert(table_name, offt, page->data, DB_BLOCK_SIZE);
+    // Only the record itself goes to the log, not the whole block
+    log_range(filename, offt, page.data(), slot->offset, slot->length);
+    records_written.add();
     
-    bp->unpinPage(filename, offt, true);
     return true;
 }
 
-void FileManager::get_data(const char* filename, void* data[ATTR_MAX_NUM], 
-                           attribute attr[ATTR_MAX_NUM], int attrnum, off_t offt) {
-    BufferPool* bp = BufferPool::getInstance();
-    Page* page = bp->getPage(filename, offt);
+// Values are copied out: callers keep and free them long after the page is unpinned
+bool FileManager::get_data(const char* filename, void* data[ATTR_MAX_NUM], 
+                           attribute attr[ATTR_MAX_NUM], int attrnum, off_t rid) {
+    for(int i = 0; i < attrnum; i++) data[i] = NULL;
+    off_t offt = RID_BLOCK(rid);
+    PageGuard page;
+    const char* block = read_Block(filename, offt, page);
     
-    if (!page) {
-        return;
+    if (!block) {
+        return false;
     }
     
-    off_t offset = 0;
+    const data_page* header = (const data_page*)block;
+    const data_slot* slot = (const data_slot*)(block + sizeof(data_page)) + RID_SLOT(rid);
+    if(RID_SLOT(rid) >= header->slot_count || (slot->length & SLOT_FREE)) {
+        return false;
+    }
+    
+    records_read.add();
+    const char* record = block + slot->offset;
     for(int i = 0; i < attrnum; i++) {
         if(attr[i].key_kind == INT_KEY) {
             int* data_int = new int();
-            memcpy(data_int, page->data + offset, sizeof(int));
+            memcpy(data_int, record, sizeof(int));
             data[i] = data_int;
-            offset += sizeof(int);
+            record += sizeof(int);
         }
         else if(attr[i].key_kind == LL_KEY) {
             long long* data_long = new long long();
-            memcpy(data_long, page->data + offset, sizeof(long long));
+            memcpy(data_long, record, sizeof(long long));
             data[i] = data_long;
-            offset += sizeof(long long);
+            record += sizeof(long long);
         }
         else if(attr[i].key_kind == STRING_KEY) {
-            char* data_string = new char[1024];
-            memcpy(data_string, page->data + offset, attr[i].max_size);
+            char* data_string = new char[1024]();
+            memcpy(data_string, record, attr[i].max_size);
             data[i] = data_string;
-            offset += attr[i].max_size;
+            record += attr[i].max_size;
         }
     }
-    
-    bp->unpinPage(filename, offt, false);
+    return true;
 }
 
 bool FileManager::deleteFile(const char* filename) {
     // Flush all dirty pages first
     BufferPool::getInstance()->flushAllPages();
+    BufferPool::getInstance()->discardFile(filename);
+    // Truncating under a live mapping would fault its readers
+    FileRegistry::getInstance()->closeFile(filename);
     
     FILE* file = fopen(filename, "w");
     fclose(file);
+    drop_BlockMap(filename);
+    NodeCache::getInstance()->drop(filename);
     return true;
 }
 
+bool FileManager::removeFile(const char* filename) {
+    // Nothing cached for the old file may outlive it
+    BufferPool::getInstance()->discardFile(filename);
+    FileRegistry::getInstance()->closeFile(filename);
+    drop_BlockMap(filename);
+    NodeCache::getInstance()->drop(filename);
+    
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        return false;
+    }
+    fclose(file);
+    return remove(filename) == 0;
+}
+
 database FileManager::getDatabase(const std::string& fname) {
     BufferPool* bp = BufferPool::getInstance();
     Page* page = bp->getPage(fname.c_str(), 0);
     
     database db;
     if (page) {
+        std::shared_lock<std::shared_mutex> latch(page->latch);
         memcpy(&db, page->data, sizeof(database));
+        latch.unlock();
         bp->unpinPage(fname.c_str(), 0, false);
     }
     
@@ -660,7 +795,9 @@ bool FileManager::flushDatabase(const std::string& fname, database db) {
     }
     
     if (page) {
+        std::unique_lock<std::shared_mutex> latch(page->latch);
         memcpy(page->data, &db, sizeof(database));
+        latch.unlock();
         bp->unpinPage(fname.c_str(), 0, true);
         // Usually no WAL here, as metadata files are independent of WAL recovery process
         return true;
@@ -668,3 +805,17 @@ bool FileManager::flushDatabase(const std::string& fname, database db) {
     
     return false;
 }
+
+FileManagerStatus FileManager::getStatus() const {
+    FileManagerStatus st;
+    st.records_read = records_read.get();
+    st.mapped_reads = mapped_reads.get();
+    st.records_written = records_written.get();
+    st.records_allocated = records_allocated.get();
+    st.records_freed = records_freed.get();
+    st.blocks_allocated = blocks_allocated.get();
+    st.blocks_appended = blocks_appended.get();
+    st.extents = extents.get();
+    st.block_map_loads = block_map_loads.get();
+    return st;
+}
@@ -2,6 +2,7 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include <cstring>
+#include <cstdint>
 #include <sys/types.h>
 #ifdef _WIN32
     #include <string.h>
@@ -12,10 +13,6 @@
 #endif
 #define DB_HEAD_SIZE 4096 // head size must be pow of 2! File database header size
 #define DB_BLOCK_SIZE 4096 // block size must be pow of 2! File database block size
-#define ORDER_V 2    /* For simplicity, fix v to 2. Actual B+ tree v value should be configurable. Here v is the minimum number of keys in internal nodes */
-#define MAXNUM_KEY (ORDER_V * 2)   /* Maximum number of keys in internal nodes, which is 2v */
-#define MAXNUM_POINTER (MAXNUM_KEY + 1)    /* Maximum number of pointers to subtrees in internal nodes, which is 2v + 1 */
-#define MAXNUM_DATA (ORDER_V * 2)    /* Maximum number of data items in leaf nodes, which is 2v */
 /* Key type */
 typedef int KEY_KIND;    /* For simplicity, defined as int. Actual B+ tree key type should be configurable */
 /* For simplicity, leaf node data also only stores key values */
@@ -25,12 +22,27 @@ typedef int KEY_KIND;    /* For simplicity, defined as int. Actual B+ tree key t
 #include <sys/stat.h>
 #include <stdexcept>
 #include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
 using namespace std;
 #define INT_KEY 1
 #define LL_KEY 2
 #define STRING_KEY 3
 
-#define NUM_ALL_BLOCK 2048 
+/* Block graph (free-space map). Block LOC_GRAPH holds a graph_root listing the graph pages;
+each graph page keeps one BLOCK_* type byte for GRAPH_PAGE_BLOCKS consecutive blocks.
+free_summary has one bit per graph page that still holds a BLOCK_FREE entry, so finding a
+free block scans a few summary words and then a single graph page. */
+#define GRAPH_PAGE_BLOCKS DB_BLOCK_SIZE
+#define GRAPH_MAX_PAGES 960
+#define NUM_ALL_BLOCK ((off_t)GRAPH_PAGE_BLOCKS * GRAPH_MAX_PAGES)    // Maximum number of blocks of a table
+
+/* A full table grows by an extent of free blocks at a time, allocated in the file with one
+fallocate and entered in the block graph with one update. An extent is as large as the
+table already is, so extents double, from EXTENT_MIN_BLOCKS up to EXTENT_MAX_BLOCKS */
+#define EXTENT_MIN_BLOCKS 8
+#define EXTENT_MAX_BLOCKS 1024
 
 #ifndef NULL
     #define NULL 0
@@ -47,10 +59,29 @@ using namespace std;
 #define BLOCK_DATA '5'
 #define BLOCK_UNAVA '6'
 #define BLOCK_FREE '0'
+// A data block holding a deleted record's slot, filled again before the table grows. Only the
+// graph and the allocator see it, get_BlockType reports it as BLOCK_DATA
+#define BLOCK_DATA_ROOM '7'
 
 #define LOC_TABLE 0
 #define LOC_GRAPH 1
 
+/* Read path of a table's data blocks, chosen with CREATE TABLE ... WITH (storage = 'mmap').
+Mapped tables read rows straight from a read-only mapping of the file unless the buffer pool
+holds the block; index nodes and all writes still go through the buffer pool and the WAL */
+#define TABLE_STORAGE_POOL 0
+#define TABLE_STORAGE_MMAP 1
+
+/* Data blocks use a slotted-page layout: a data_page header and the slot directory
+grow from the front of the block, record bytes grow down from the end of it.
+A row is addressed by its record id (block number << RID_SLOT_BITS | slot number),
+which is what leaf nodes store in offt_data. */
+#define RID_SLOT_BITS 16
+#define MAKE_RID(block, slot) (((off_t)(block) << RID_SLOT_BITS) | (off_t)(slot))
+#define RID_BLOCK(rid) ((off_t)(rid) >> RID_SLOT_BITS)
+#define RID_SLOT(rid) ((int)((rid) & ((1 << RID_SLOT_BITS) - 1)))
+#define SLOT_FREE 0x8000    // Set in data_slot.length once the record is deleted
+
 #define ATTR_MAX_NUM 20
 #define MAXSIZE_ATTR_NAME 50
 
@@ -113,12 +144,36 @@ typedef struct {
 	size_t value_use_block;
 	attribute attr[ATTR_MAX_NUM];
 	int attr_num;
+	off_t offt_data_tail;   // Data block new rows are appended to
+	char pool[20];          // Buffer pool partition of the table, empty for default
+	int storage;            // TABLE_STORAGE_*
 }table;
 
+struct graph_root {
+	uint32_t num_blocks;    // Blocks in the table file
+	uint32_t num_pages;     // Graph pages in use
+	uint32_t pages[GRAPH_MAX_PAGES];    // Block number of each graph page
+	uint64_t free_summary[GRAPH_MAX_PAGES / 64];    // Bit i set: graph page i has a free block
+};
+
+struct data_page {
+	uint16_t slot_count;    // Number of entries in the slot directory
+	uint16_t live_count;    // Number of slots holding a record
+	uint16_t free_ptr;      // Start of the record area, records grow downwards
+	uint16_t reserved;
+};
+
+struct data_slot {
+	uint16_t offset;        // Position of the record inside the block
+	uint16_t length;        // Record length, SLOT_FREE is set once the record is deleted
+};
 
+
+/* B+ tree nodes fill one block. The node header is followed by the offset array
+(2v+1 child blocks for an internal node, 2v record ids for a leaf) and then the 2v keys,
+each key_size bytes wide. */
 typedef struct {
 	off_t offt_self;
-	off_t offt_pointers[MAXNUM_POINTER];
 	off_t offt_father;
 	size_t count;
 	NODE_TYPE node_type;
@@ -134,20 +189,21 @@ struct leaf_node {
 	size_t count;
 
 	NODE_TYPE node_type;
-	off_t offt_data[MAXNUM_DATA];
 	leaf_node(){}
 	leaf_node(off_t offt, size_t count, NODE_TYPE node_type,off_t
     offt_father=0, off_t offt_PrevNode=0
-    , off_t offt_NextNode=0, off_t offt_arr[MAXNUM_DATA]=NULL) : offt_self(offt), count(count), node_type(node_type),
+    , off_t offt_NextNode=0) : offt_self(offt), count(count), node_type(node_type),
 		offt_father(offt_father), offt_PrevNode(offt_PrevNode),
 		offt_NextNode(offt_NextNode) {
-		for (int i = 0; i < MAXNUM_DATA; i++) {
-			offt_data[i] = offt_arr[i];
-		}
 		}
 	
 };
 
+/* Order v of the tree for a key width: the largest v whose 2v keys and offsets still fit
+in a block after the (larger) leaf header. Wider string keys are refused at MAXSIZE_KEY, which keeps v >= 2. */
+#define NODE_ORDER(key_size) ((int)((DB_BLOCK_SIZE - sizeof(leaf_node) - sizeof(off_t)) / (2 * (sizeof(off_t) + (key_size)))))
+#define MAXSIZE_KEY 1000
+
 struct Index{
 	char fpath[100];
 	off_t offt_self;
@@ -178,39 +234,113 @@ struct WhereCondition {
 		else value= val;
 	};
 };
+
+// ORDER BY and LIMIT of a SELECT
+struct OrderLimit {
+    string attribute;   // Empty without ORDER BY
+    bool descending;
+    long long limit;    // -1 without LIMIT
+    OrderLimit() : descending(false), limit(-1) {}
+};
+class PageGuard;
+
+// Event counter for SHOW STATUS. Relaxed atomic adds, so counting takes no lock and a
+// report may be a few events behind
+struct StatCounter {
+	std::atomic<uint64_t> value{ 0 };
+	void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// FileManager counters since startup
+struct FileManagerStatus {
+	uint64_t records_read;
+	uint64_t mapped_reads;        // Data blocks read from a mapped file instead of the buffer pool
+	uint64_t records_written;
+	uint64_t records_allocated;
+	uint64_t records_freed;
+	uint64_t blocks_allocated;    // Handed out by getFreeBlock
+	uint64_t blocks_appended;     // Blocks the files grew by
+	uint64_t extents;             // Number of times a file grew
+	uint64_t block_map_loads;     // Block graphs read into the cache
+};
+
 class FileManager {
 
 public:
 
 	static FileManager* getInstance();
 
-	inter_node getCInternalNode(Index idx, void* data[MAXNUM_KEY], off_t offt);
-	bool flushInterNode(inter_node node, Index idx, void** key);
-	leaf_node getLeafNode(Index idx, void* data[MAXNUM_DATA], off_t offt);
-	bool flushLeafNode(leaf_node node, Index idx, void** value);
+	// Nodes edit their keys and offsets in the pinned page, this writes the node structure
+	// (inter_node or leaf_node) in front of them, logs the block and marks it dirty
+	bool flushNode(PageGuard& page, const char* filename, off_t offt, const void* node, size_t node_size);
 	table getTable(const char* filename, off_t offt);
 	bool flushTable(table t, const char* filename, off_t offt);
-	bool table_create(const char* path, size_t attr_num,attribute attr[ATTR_MAX_NUM]);
-	void flush_key(void* key[MAXNUM_KEY], Index idx);
-	void flush_value(void* value[MAXNUM_DATA], Index idx);
-	void get_key(void* key[MAXNUM_KEY], Index idx);
-	void get_value(void* value[MAXNUM_DATA], Index idx);
-	void get_BlockGraph(const char* fname,char* freeBlock);
+	bool table_create(const char* path, size_t attr_num,attribute attr[ATTR_MAX_NUM], const char* pool = "", int storage = TABLE_STORAGE_POOL);
+	// BLOCK_* type of a block, BLOCK_DATA_ROOM is reported as BLOCK_DATA
 	char get_BlockType(const char* fname, off_t offt);
-	void flush_BlockGraph(Index idx, char* freeBlock);
+	// Number of blocks recorded in the block graph
+	off_t get_BlockCount(const char* fname);
+	// First block at or after offt with the given type, INVALID if there is none. BLOCK_DATA
+	// also finds BLOCK_DATA_ROOM blocks
+	off_t next_Block(const char* fname, off_t offt, char type);
 	off_t getFreeBlock(const char* filename,char type_block);
 	bool flushBlock(const char* filename, off_t offt, char type);
 	off_t newBlock(const char* filename);
+	// Forget the cached block graph of a table whose file was removed or rewritten, NULL forgets all
+	void drop_BlockMap(const char* filename);
 	bool deleteFile(const char* filename);
+	// Remove a table file together with its cached pages, descriptor and block graph
+	bool removeFile(const char* filename);
 	// Get total number of blocks in the file
 	size_t getFileSize(const char* fileName);
-	bool flush_data(const char* filename,void* data[ATTR_MAX_NUM], attribute attr[ATTR_MAX_NUM],int attrnum,off_t offt);
-	void get_data(const char* filename, void* data[ATTR_MAX_NUM], attribute attr[ATTR_MAX_NUM], int attrnum, off_t offt);
+	// Rows live in slotted data blocks and are addressed by record id (see MAKE_RID)
+	size_t get_RecordSize(attribute attr[ATTR_MAX_NUM], int attrnum);
+	off_t alloc_record(const char* filename, size_t size, off_t& offt_tail);
+	bool free_record(const char* filename, off_t rid);
+	void get_records(const char* filename, off_t offt, vector<off_t>& rids);
+	// A scan over the data blocks is about to start, let the buffer pool read ahead
+	void scan_hint(const char* filename);
+	bool flush_data(const char* filename,void* data[ATTR_MAX_NUM], attribute attr[ATTR_MAX_NUM],int attrnum,off_t rid);
+	// false, with every data[i] NULL, if rid holds no record
+	bool get_data(const char* filename, void* data[ATTR_MAX_NUM], attribute attr[ATTR_MAX_NUM], int attrnum, off_t rid);
 
 	database getDatabase(const std::string& fname);
 	bool flushDatabase(const std::string& fname, database db);
+	FileManagerStatus getStatus() const;
 	protected:
 	static FileManager* object;
+	StatCounter records_read, mapped_reads, records_written, records_allocated, records_freed;
+	StatCounter blocks_allocated, blocks_appended, extents, block_map_loads;
+	// Data block for reading: the buffer pool's copy if it has one (which may be newer than the file),
+	// else the file mapping of a mapped table, else the block is loaded into the pool. page holds
+	// the pool copy while the caller reads. NULL if the block cannot be read
+	const char* read_Block(const char* filename, off_t offt, PageGuard& page);
+	// Place a record of size bytes in the given data block, INVALID if it does not fit.
+	// room tells whether a deleted record's slot is still free in the block afterwards
+	off_t place_record(const char* filename, off_t offt, size_t size, bool& room);
+	void log_range(const char* filename, off_t offt, const char* page_data, size_t pos, size_t size);
+	// Write an empty block graph (table, graph root and first graph page) to a new file
+	bool init_BlockGraph(const char* filename);
+	// Write a zeroed block at offt, growing the file
+	bool append_Block(const char* filename, off_t offt);
+
+	/* In-memory copy of each table's block graph, one type byte per block. It is loaded
+	from the graph pages on first use and kept in step by flushBlock and newBlock, so
+	get_BlockType and next_Block never touch the buffer pool. last_map remembers the
+	table asked for last, which is nearly always the one asked for next. map_mtx guards
+	all three and the maps' contents; it is taken after a graph page latch, never before. */
+	std::mutex map_mtx;
+	map<string, vector<char>, less<>> block_maps;
+	string last_map_name;
+	vector<char>* last_map = NULL;
+	// Cached block graph of a table, loaded on a miss; NULL if the file has no graph. lock
+	// holds map_mtx, it is let go while the graph pages are read
+	vector<char>* get_BlockMap(const char* filename, std::unique_lock<std::mutex>& lock);
+	// Type byte of a block as the graph holds it, BLOCK_DATA_ROOM included
+	char raw_BlockType(const char* filename, off_t offt);
+	// Cached block graph of a table if it is loaded, NULL otherwise. Called with map_mtx held
+	vector<char>* find_BlockMap(const char* filename);
 	
 
 };
\ No newline at end of file
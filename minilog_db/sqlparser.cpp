@@ -112,6 +112,13 @@ vector<string> splitCondition(const std::string& condition) {
     return parts;
 }
 
+// Rewrite "a BETWEEN x AND y" as "a >= x AND a <= y". The AND stays, so the AND/OR list
+// recorded from the original clause still lines up with the conditions
+static string expandBetween(const string& clause) {
+    regex patternBetween(R"((\w+)\s+BETWEEN\s+('[^']*'|"[^"]*"|\S+)\s+AND\s+('[^']*'|"[^"]*"|\S+))", std::regex_constants::icase);
+    return regex_replace(clause, patternBetween, "$1 >= $2 AND $1 <= $3");
+}
+
 vector<WhereCondition> parseWhereClause(const std::string& whereClause) {
     vector<WhereCondition> conditions;
     if (trim(whereClause).empty()) return conditions;
@@ -123,6 +130,7 @@ vector<WhereCondition> parseWhereClause(const std::string& whereClause) {
     string clause = whereClause;
     // Remove trailing semicolon
     if (!clause.empty() && clause.back() == ';') clause.pop_back();
+    clause = expandBetween(clause);
 
     // Simplified handling: assume only AND or only OR, or mixed but split sequentially
     // A more complete method would be to traverse the string and record positions
@@ -153,6 +161,32 @@ vector<WhereCondition> parseWhereClause(const std::string& whereClause) {
     return conditions;
 }
 
+// Start of the trailing ORDER BY / LIMIT of a SELECT, the WHERE clause ends there
+static size_t findSelectTail(const string& sql) {
+    regex patternTail(R"((\s+ORDER\s+BY\s+\w+(\s+(ASC|DESC))?)?(\s+LIMIT\s+\d{1,18})?\s*;?\s*$)", std::regex_constants::icase);
+    smatch matches;
+    if (regex_search(sql, matches, patternTail)) {
+        return matches.position(0);
+    }
+    return sql.length();
+}
+
+OrderLimit parseOrderLimit(const std::string& sql) {
+    OrderLimit order;
+    string tail = sql.substr(findSelectTail(sql));
+    regex patternOrder(R"(\bORDER\s+BY\s+(\w+)(\s+(ASC|DESC))?)", std::regex_constants::icase);
+    regex patternLimit(R"(\bLIMIT\s+(\d{1,18}))", std::regex_constants::icase);
+    smatch matches;
+    if (regex_search(tail, matches, patternOrder)) {
+        order.attribute = matches[1];
+        order.descending = matches[3].matched && toUpper(matches[3]) == "DESC";
+    }
+    if (regex_search(tail, matches, patternLimit)) {
+        order.limit = stoll(matches[1]);
+    }
+    return order;
+}
+
 vector<WhereCondition> parseSelectStatement(const std::string& sql, vector<string>& attributeNames, vector<LOGIC>& Logics) {
     // 1. Extract part between SELECT and FROM (attributes)
     size_t selectPos = findKeyword(sql, "SELECT");
@@ -178,7 +212,9 @@ vector<WhereCondition> parseSelectStatement(const std::string& sql, vector<strin
         return vector<WhereCondition>();
     }
 
-    string wherePart = sql.substr(wherePos + 5); // Skip "WHERE"
+    // Skip "WHERE", stop at ORDER BY / LIMIT
+    size_t tailPos = findSelectTail(sql);
+    string wherePart = tailPos > wherePos + 5 ? sql.substr(wherePos + 5, tailPos - (wherePos + 5)) : "";
     
     // 3. Extract logic operators (AND/OR)
     // Note: This needs to be synchronized with parseWhereClause. parseWhereClause is responsible for splitting conditions,
@@ -269,12 +305,46 @@ vector<WhereCondition> parseUpdateStatement(const std::string& sql, vector<Where
     return vector<WhereCondition>();
 }
 
+// Start of a trailing "WITH (...)" clause of CREATE TABLE, npos if there is none
+static size_t findTableOptions(const string& sql) {
+    regex patternWith(R"(\)\s*(WITH\s*\([^()]*\))\s*;?\s*$)", std::regex_constants::icase);
+    smatch matches;
+    if (regex_search(sql, matches, patternWith)) {
+        return matches.position(1);
+    }
+    return string::npos;
+}
+
+map<string, string> parseTableOptions(const std::string& sql) {
+    map<string, string> options;
+    size_t withPos = findTableOptions(sql);
+    if (withPos == string::npos) {
+        return options;
+    }
+    size_t start = sql.find('(', withPos);
+    size_t end = sql.find(')', start);
+    istringstream optionStream(sql.substr(start + 1, end - start - 1));
+    string option;
+    while (getline(optionStream, option, ',')) {
+        size_t eq = option.find('=');
+        if (eq == string::npos) continue;
+        string key = trim(option.substr(0, eq));
+        string value = trim(option.substr(eq + 1));
+        if (value.size() >= 2 && (value[0] == '\'' || value[0] == '"') && value.back() == value[0]) {
+            value = value.substr(1, value.size() - 2);
+        }
+        transform(key.begin(), key.end(), key.begin(), ::tolower);
+        options[key] = value;
+    }
+    return options;
+}
+
 vector<attribute> parseCreateTableStatement(const std::string& sql) {
     vector<attribute> attr_arry;
     string columnsPart;
-    // More robust regex: find content of first parenthesis
+    // More robust regex: find content of first parenthesis, up to the WITH clause if there is one
     size_t start = sql.find('(');
-    size_t end = sql.rfind(')');
+    size_t end = sql.rfind(')', findTableOptions(sql));
     
     if (start == string::npos || end == string::npos || start >= end) {
         return attr_arry;
@@ -8,9 +8,13 @@ namespace SQL {
     string extractTableName(const std::string& sql);
     string extractJoinTableName(const std::string& sql);
     vector<attribute> parseCreateTableStatement(const std::string& sql);
+    // Options of CREATE TABLE ... WITH (key = 'value', ...), keys lower-cased and quotes removed
+    map<string, string> parseTableOptions(const std::string& sql);
     vector<vector<string>> parseInsertStatement(const std::string& sql);
     vector<WhereCondition> parseSelectStatement(const std::string& sql,vector<string>&attributeNames,vector<LOGIC>&Logics);
     vector<WhereCondition> parseWhereClause(const std::string& whereClause);
+    // Trailing ORDER BY <column> [ASC|DESC] and LIMIT <n> of a SELECT
+    OrderLimit parseOrderLimit(const std::string& sql);
     vector<WhereCondition> parseDeleteStatement(const std::string& sql,vector<LOGIC>& logic);
     vector<WhereCondition> parseUpdateStatement(const std::string& sql,vector<WhereCondition>& set_attributes);
     vector<WhereCondition> parseSetStatement(const std::string& s);
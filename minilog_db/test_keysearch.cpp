@@ -0,0 +1,113 @@
+#include <iostream>
+#include <cstdlib>
+#include <climits>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "KeySearch.h"
+
+using namespace std;
+
+void check(bool ok, const string& desc) {
+    if (!ok) {
+        cerr << "[Failed] " << desc << endl;
+        exit(1);
+    }
+    cout << "[Passed] " << desc << endl;
+}
+
+// The same order KeySearch uses, key_size bytes apart
+int compare_key(const char* a, const char* b, KEY_KIND key_kind, size_t key_size) {
+    if (key_kind == INT_KEY) {
+        int x, y;
+        memcpy(&x, a, sizeof(int));
+        memcpy(&y, b, sizeof(int));
+        return (x > y) - (x < y);
+    }
+    if (key_kind == LL_KEY) {
+        long long x, y;
+        memcpy(&x, a, sizeof(long long));
+        memcpy(&y, b, sizeof(long long));
+        return (x > y) - (x < y);
+    }
+    return strncmp(a, b, key_size);
+}
+
+// Keys picked from a small range so that lookups hit, miss and land on duplicates
+void random_key(mt19937& rng, char* out, KEY_KIND key_kind, size_t key_size) {
+    memset(out, 0, key_size);
+    if (key_kind == INT_KEY) {
+        int v = (int)(rng() % 200) - 100;
+        if (rng() % 50 == 0) v = (rng() % 2) ? INT_MIN : INT_MAX;
+        memcpy(out, &v, sizeof(int));
+    } else if (key_kind == LL_KEY) {
+        long long v = (long long)(rng() % 200) - 100;
+        if (rng() % 50 == 0) v = (rng() % 2) ? LLONG_MIN : LLONG_MAX;
+        else v *= 10000000000LL;
+        memcpy(out, &v, sizeof(long long));
+    } else {
+        size_t len = 1 + rng() % (key_size - 1);
+        for (size_t i = 0; i < len; i++) out[i] = 'a' + rng() % 3;
+    }
+}
+
+// Random sorted nodes against a linear scan, true if every answer agrees
+bool compare_with_scan(KEY_KIND key_kind, size_t key_size, int rounds) {
+    mt19937 rng(key_kind * 1000 + (int)key_size);
+    for (int r = 0; r < rounds; r++) {
+        int count = (r % 4 == 0) ? (int)(rng() % 8) : (int)(rng() % 300);
+        vector<vector<char>> sorted(count, vector<char>(key_size));
+        for (auto& key : sorted) random_key(rng, key.data(), key_kind, key_size);
+        sort(sorted.begin(), sorted.end(), [&](const vector<char>& a, const vector<char>& b) {
+            return compare_key(a.data(), b.data(), key_kind, key_size) < 0;
+        });
+        vector<char> keys(count * key_size + 1);
+        for (int i = 0; i < count; i++) memcpy(keys.data() + i * key_size, sorted[i].data(), key_size);
+
+        for (int q = 0; q < 20; q++) {
+            vector<char> key(key_size);
+            random_key(rng, key.data(), key_kind, key_size);
+            int lower = 0, upper = 0, found = -1;
+            for (int i = 0; i < count; i++) {
+                int c = compare_key(keys.data() + i * key_size, key.data(), key_kind, key_size);
+                if (c < 0) lower++;
+                if (c <= 0) upper++;
+                if (c == 0 && found < 0) found = i;
+            }
+            if (keyLowerBound(keys.data(), count, key.data(), key_kind, key_size) != lower ||
+                keyUpperBound(keys.data(), count, key.data(), key_kind, key_size) != upper ||
+                keyFind(keys.data(), count, key.data(), key_kind, key_size) != found) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    cout << "========================================" << endl;
+    cout << "  Key Search Test Suite " << endl;
+    cout << "========================================" << endl;
+
+    const char* names[] = { "auto", "scalar", "SSE", "AVX2" };
+    for (int width = KEY_SEARCH_AUTO; width <= KEY_SEARCH_AVX2; width++) {
+        if (!keySearchUseWidth(width)) {
+            cout << "[Skipped] " << names[width] << " counting, not supported here" << endl;
+            continue;
+        }
+        string with = string(" (") + names[width] + ")";
+        check(compare_with_scan(INT_KEY, sizeof(int), 400), "INT keys match a linear scan" + with);
+        check(compare_with_scan(LL_KEY, sizeof(long long), 400), "BIGINT keys match a linear scan" + with);
+    }
+    keySearchUseWidth(KEY_SEARCH_AUTO);
+
+    // Keys wider than their type or made of text take the generic search
+    check(compare_with_scan(INT_KEY, 12, 400), "INT keys in 12 byte slots match a linear scan");
+    check(compare_with_scan(STRING_KEY, 8, 400), "Short string keys match a linear scan");
+    check(compare_with_scan(STRING_KEY, 40, 400), "Long string keys match a linear scan");
+
+    cout << "All key search tests passed!" << endl;
+    return 0;
+}
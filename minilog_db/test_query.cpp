@@ -0,0 +1,216 @@
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "DataBase.h"
+#include "WAL.h"
+#include "BPTree.h"
+
+using namespace std;
+
+const string DB_NAME = "query_test_db";
+const string TABLE_NAME = "range_table";
+const string WIDE_TABLE = "wide_table";
+const int ROWS = 300;
+
+// Helper: Clean up environment
+void clean_env() {
+    string cmd = "rm -f " + DB_NAME + ".* " + TABLE_NAME + ".* " + WIDE_TABLE + ".*";
+    system(cmd.c_str());
+}
+
+void check(bool ok, const string& desc) {
+    if (!ok) {
+        cerr << "[Failed] " << desc << endl;
+        exit(1);
+    }
+    cout << "[Passed] " << desc << endl;
+}
+
+// Collects what the statements print while it lives
+struct Capture {
+    ostringstream out;
+    streambuf* old;
+    Capture() : old(cout.rdbuf(out.rdbuf())) {}
+    ~Capture() { cout.rdbuf(old); }
+};
+
+// Runs a SELECT of the id column and returns the ids in the order printed
+vector<int> select_ids(DataBase& db, const string& where) {
+    string printed;
+    {
+        Capture capture;
+        db.select("SELECT id FROM " + TABLE_NAME + " " + where + ";");
+        printed = capture.out.str();
+    }
+
+    vector<int> ids;
+    istringstream lines(printed);
+    string line;
+    while (getline(lines, line)) {
+        if (line.size() > 1 && line[0] == '|' && (isdigit(line[1]) || line[1] == '-')) {
+            ids.push_back(atoi(line.c_str() + 1));
+        }
+    }
+    return ids;
+}
+
+vector<int> id_run(int first, int last) {
+    vector<int> ids;
+    for (int id = first; id <= last; id++) ids.push_back(id);
+    return ids;
+}
+
+// =====================================
+// Primary key ranges read the leaf chain
+// =====================================
+void test_key_ranges(DataBase& db) {
+    vector<int> ids = select_ids(db, "WHERE id BETWEEN 50 AND 60");
+    check(ids == id_run(50, 60), "BETWEEN returns its keys in order");
+
+    check(select_ids(db, "WHERE id > 295") == id_run(296, ROWS), "An open upper range stops at the last key");
+    check(select_ids(db, "WHERE id >= 10 AND id < 15") == id_run(10, 14), "Inclusive and exclusive bounds");
+    check(select_ids(db, "WHERE id > 20 AND id > 25 AND id <= 30") == id_run(26, 30), "The tighter of two bounds wins");
+    check(select_ids(db, "WHERE id > 100 AND v < 1100") == id_run(101, 109), "Other conditions filter the range");
+    check(select_ids(db, "WHERE id > 400").empty(), "A range past the last key is empty");
+    check(select_ids(db, "WHERE id > 60 AND id < 50").empty(), "An inverted range is empty");
+
+    // Deleting a range leaves the chain around it intact
+    {
+        Capture capture;
+        db.Delete("DELETE FROM " + TABLE_NAME + " WHERE id BETWEEN 100 AND 199;");
+    }
+    vector<int> expect = id_run(95, 99);
+    vector<int> after = id_run(200, 205);
+    expect.insert(expect.end(), after.begin(), after.end());
+    check(select_ids(db, "WHERE id >= 95 AND id <= 205") == expect, "A range reads across deleted keys");
+
+    // The key column can't change in place, the leaf would keep the old key
+    {
+        Capture capture;
+        db.Update("UPDATE " + TABLE_NAME + " SET id = 1000 WHERE id = 5;");
+    }
+    check(select_ids(db, "WHERE id = 5") == vector<int>{ 5 } && select_ids(db, "WHERE id = 1000").empty(),
+          "Updating the primary key is refused");
+}
+
+// =====================================
+// ORDER BY the primary key and LIMIT
+// =====================================
+void test_order_limit(DataBase& db) {
+    vector<int> all = select_ids(db, "ORDER BY id");
+    check(is_sorted(all.begin(), all.end()) && all.size() == 200, "ORDER BY id returns every row in key order");
+
+    vector<int> desc = select_ids(db, "ORDER BY id DESC");
+    reverse(all.begin(), all.end());
+    check(desc == all, "ORDER BY id DESC returns them in reverse");
+
+    check(select_ids(db, "ORDER BY id LIMIT 3") == id_run(1, 3), "LIMIT stops after the first keys");
+    check(select_ids(db, "ORDER BY id DESC LIMIT 5") == vector<int>({ 300, 299, 298, 297, 296 }),
+          "LIMIT with DESC takes the last keys");
+    check(select_ids(db, "WHERE id < 20 ORDER BY id DESC LIMIT 4") == vector<int>({ 19, 18, 17, 16 }),
+          "A range, DESC and LIMIT together");
+    check(select_ids(db, "WHERE id >= 96 ORDER BY id LIMIT 6") == vector<int>({ 96, 97, 98, 99, 200, 201 }),
+          "An ordered walk with LIMIT skips deleted keys");
+    check(select_ids(db, "WHERE v > 2950 ORDER BY id DESC") == vector<int>({ 300, 299, 298, 297, 296 }),
+          "Conditions on other columns filter the ordered walk");
+    check(select_ids(db, "ORDER BY id LIMIT 0").empty(), "LIMIT 0 returns nothing");
+    check(select_ids(db, "WHERE id = 7 LIMIT 0").empty(), "LIMIT 0 holds for a key lookup too");
+
+    vector<int> limited = select_ids(db, "WHERE v >= 0 LIMIT 10");
+    check(limited.size() == 10, "LIMIT without ORDER BY still caps a scan");
+}
+
+// =====================================
+// String keys keep their full width
+// =====================================
+void test_wide_keys(DataBase& db) {
+    bool created;
+    {
+        Capture capture;
+        created = db.createTable("CREATE TABLE " + WIDE_TABLE + "(name VARCHAR(2000) PRIMARY KEY, v INT);");
+    }
+    check(!created, "A primary key wider than MAXSIZE_KEY is refused");
+
+    // Two keys that only differ in their last byte are both kept
+    string prefix(998, 'k');
+    string printed;
+    {
+        Capture capture;
+        db.createTable("CREATE TABLE " + WIDE_TABLE + "(name VARCHAR(1000) PRIMARY KEY, v INT);");
+        db.insert("INSERT INTO " + WIDE_TABLE + " (name, v) VALUES('" + prefix + "a', 1);");
+        db.insert("INSERT INTO " + WIDE_TABLE + " (name, v) VALUES('" + prefix + "b', 2);");
+        db.select("SELECT v FROM " + WIDE_TABLE + " WHERE v > 0;");
+        printed = capture.out.str();
+    }
+    check(printed.find("|1") != string::npos && printed.find("|2") != string::npos,
+          "Keys sharing a long prefix are distinct");
+
+    // Four keys to a node, the splits run up through several internal levels
+    vector<int> order = id_run(3, 202);
+    shuffle(order.begin(), order.end(), mt19937(11));
+    {
+        Capture capture;
+        for (int v : order) {
+            db.insert("INSERT INTO " + WIDE_TABLE + " (name, v) VALUES('" + prefix.substr(0, 990) + to_string(1000 + v) +
+                      "', " + to_string(v) + ");");
+        }
+        db.select("SELECT v FROM " + WIDE_TABLE + " WHERE v > 0;");
+        printed = capture.out.str();
+    }
+    size_t rows = 0;
+    for (size_t at = printed.find("\n|"); at != string::npos; at = printed.find("\n|", at + 1)) {
+        if (isdigit(printed[at + 2])) rows++;
+    }
+    check(rows == 202, "Every key inserted through internal splits is read back (" + to_string(rows) + ")");
+
+    BPlusTree* bp = new BPlusTree(WIDE_TABLE + ".bin");
+    bool found = true;
+    for (int v : order) {
+        vector<char> key(1000, 0);
+        string name = prefix.substr(0, 990) + to_string(1000 + v);
+        memcpy(key.data(), name.c_str(), name.size());
+        found = found && bp->Search(key.data()) != INVALID;
+    }
+    delete bp;
+    check(found, "Every key is found by a descent from the root");
+}
+
+int main() {
+    cout << "========================================" << endl;
+    cout << "  Query Test Suite " << endl;
+    cout << "========================================" << endl;
+
+    clean_env();
+    if (!RecoveryManager::getInstance()->init(DB_NAME)) {
+        cerr << "RecoveryManager initialization failed!" << endl;
+        return 1;
+    }
+
+    DataBase db;
+    strcpy(db.db.db_name, DB_NAME.c_str());
+    db.db.table_num = 0;
+    {
+        Capture capture;
+        db.createTable("CREATE TABLE " + TABLE_NAME + "(id INT PRIMARY KEY, name VARCHAR(16), v INT);");
+        // Out of key order, so the leaves split all over
+        vector<int> order = id_run(1, ROWS);
+        shuffle(order.begin(), order.end(), mt19937(7));
+        for (int id : order) {
+            db.insert("INSERT INTO " + TABLE_NAME + " (id, name, v) VALUES(" + to_string(id) + ", 'row', " +
+                      to_string(id * 10) + ");");
+        }
+    }
+
+    test_key_ranges(db);
+    test_order_limit(db);
+    test_wide_keys(db);
+
+    clean_env();
+    cout << "All query tests passed!" << endl;
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <cstdlib>
+#include <unistd.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include "BufferPool.h"
+#include "Replacer.h"
+#include "CompressedCache.h"
+#include "DataBase.h"
+#include "WAL.h"
+#include "BPTree.h"
+
+using namespace std;
+
+const string DB_NAME = "storage_test_db";
+const string TABLE_NAME = "slot_table";
+const string HOT_TABLE = "hot_table";
+const string COLD_TABLE = "cold_table";
+const string BULK_TABLE = "bulk_table";
+
+// Helper: Clean up environment
+void clean_env() {
+    string cmd = "rm -f " + DB_NAME + ".* " + TABLE_NAME + ".* " + HOT_TABLE + ".* " + COLD_TABLE + ".* " +
+                 BULK_TABLE + ".*";
+    system(cmd.c_str());
+}
+
+void check(bool ok, const string& desc) {
+    if (!ok) {
+        cerr << "[Failed] " << desc << endl;
+        exit(1);
+    }
+    cout << "[Passed] " << desc << endl;
+}
+
+// Data blocks of the table, BLOCK_DATA_ROOM included
+int count_data_blocks(const string& bin_file) {
+    FileManager* fm = FileManager::getInstance();
+    int count = 0;
+    for (off_t i = fm->next_Block(bin_file.c_str(), 0, BLOCK_DATA); i != INVALID; i = fm->next_Block(bin_file.c_str(), i + 1, BLOCK_DATA)) {
+        count++;
+    }
+    return count;
+}
+
+// =====================================
+// Deleted records' slots are reused
+// =====================================
+void test_slot_reuse() {
+    DataBase db;
+    strcpy(db.db.db_name, DB_NAME.c_str());
+    db.db.table_num = 0;
+    string bin_file = TABLE_NAME + ".bin";
+
+    db.createTable("CREATE TABLE " + TABLE_NAME + "(id INT PRIMARY KEY, name VARCHAR(32), val INT);");
+    for (int id = 1; id <= 800; id++) {
+        db.insert("INSERT INTO " + TABLE_NAME + " (id, name, val) VALUES(" + to_string(id) + ", 'row', " + to_string(id * 10) + ");");
+    }
+    int blocks = count_data_blocks(bin_file);
+    check(blocks > 1, "Rows spread over several data blocks (" + to_string(blocks) + ")");
+
+    BPlusTree* bp = new BPlusTree(bin_file);
+    int first = 1;
+    off_t deleted_rid = bp->Search(&first);
+    delete bp;
+
+    // Every odd row goes, no block becomes empty
+    for (int id = 1; id <= 800; id += 2) {
+        db.Delete("DELETE FROM " + TABLE_NAME + " WHERE id = " + to_string(id) + ";");
+    }
+    check(count_data_blocks(bin_file) == blocks, "Deleting leaves the data blocks in place");
+
+    bp = new BPlusTree(bin_file);
+    void* data[ATTR_MAX_NUM];
+    bool found = bp->Get_Data(data, deleted_rid);
+    check(!found && data[0] == NULL && data[2] == NULL, "A deleted record id reads nothing");
+    delete bp;
+
+    // The new rows fill the freed slots instead of growing the table
+    for (int id = 1001; id <= 1400; id++) {
+        db.insert("INSERT INTO " + TABLE_NAME + " (id, name, val) VALUES(" + to_string(id) + ", 'new', " + to_string(id * 10) + ");");
+    }
+    check(count_data_blocks(bin_file) == blocks, "Inserting after deletes reuses the freed slots");
+
+    bp = new BPlusTree(bin_file);
+    bool all = true;
+    for (int id = 2; id <= 1400; id++) {
+        bool live = (id <= 800 && id % 2 == 0) || id > 1000;
+        off_t rid = bp->Search(&id);
+        if (!live) {
+            all = all && rid == INVALID;
+            continue;
+        }
+        all = all && rid != INVALID && bp->Get_Data(data, rid) && *(int*)data[2] == id * 10;
+    }
+    check(all, "Every live row reads back its own values");
+    delete bp;
+}
+
+// Resident pages of the buffer pool partition called name
+size_t partition_pages(const string& name) {
+    for (const PartitionStatus& part : BufferPool::getInstance()->getPartitions()) {
+        if (part.name == name) return part.pages;
+    }
+    return 0;
+}
+
+// The quota the shards of the pool enforce for the partition called name
+PartitionStatus partition_quota(const string& name) {
+    for (const PartitionStatus& part : BufferPool::getInstance()->getPartitions()) {
+        if (part.name == name) return part;
+    }
+    return PartitionStatus{ name, 0, 0, 0 };
+}
+
+// Pull every data block of the table through the pool
+void read_table(const string& bin_file) {
+    FileManager* fm = FileManager::getInstance();
+    for (off_t i = fm->next_Block(bin_file.c_str(), 0, BLOCK_DATA); i != INVALID; i = fm->next_Block(bin_file.c_str(), i + 1, BLOCK_DATA)) {
+        PageGuard page = BufferPool::getInstance()->readPage(bin_file.c_str(), i);
+    }
+}
+
+void fill_table(DataBase& db, const string& table, int rows) {
+    for (int id = 1; id <= rows; id++) {
+        db.insert("INSERT INTO " + table + " (id, name, val) VALUES(" + to_string(id) + ", 'row', " + to_string(id) + ");");
+    }
+}
+
+// =====================================
+// Partitions keep their quotas
+// =====================================
+void test_partition_quotas() {
+    // Quotas that don't divide over the shards add up to what was configured
+    PartitionStatus odd = partition_quota("odd");
+    check(odd.min_pages == 13 && odd.max_pages == 35, "Quotas that are not a multiple of the shards are kept (" +
+          to_string(odd.min_pages) + ", " + to_string(odd.max_pages) + ")");
+    check(partition_quota("hot").min_pages == 68, "The hot minimum is kept whole");
+    check(partition_quota("tiny").max_pages == BUFFER_POOL_MIN_SIZE, "A maximum below the smallest pool is raised");
+
+    DataBase db;
+    strcpy(db.db.db_name, DB_NAME.c_str());
+    db.db.table_num = 0;
+
+    // Two rows to a block, so the tables outgrow the small pool main configured
+    db.createTable("CREATE TABLE " + COLD_TABLE + "(id INT PRIMARY KEY, name VARCHAR(1800), val INT) WITH (pool = 'cold');");
+    db.createTable("CREATE TABLE " + HOT_TABLE + "(id INT PRIMARY KEY, name VARCHAR(1800), val INT) WITH (pool = 'hot');");
+    db.createTable("CREATE TABLE " + BULK_TABLE + "(id INT PRIMARY KEY, name VARCHAR(1800), val INT);");
+
+    fill_table(db, COLD_TABLE, 200);
+    check(count_data_blocks(COLD_TABLE + ".bin") > 64, "The cold table is larger than its partition");
+    read_table(COLD_TABLE + ".bin");
+    check(partition_pages("cold") <= 64, "A partition at its maximum replaces its own pages (" +
+          to_string(partition_pages("cold")) + " resident)");
+
+    fill_table(db, HOT_TABLE, 320);
+    read_table(HOT_TABLE + ".bin");
+    check(partition_pages("hot") >= 68, "The hot table fills its minimum");
+
+    // A scan of a default table needs every frame it can get, the hot minimum stays
+    fill_table(db, BULK_TABLE, 600);
+    check(count_data_blocks(BULK_TABLE + ".bin") > 256, "The bulk table is larger than the pool");
+    read_table(BULK_TABLE + ".bin");
+    read_table(BULK_TABLE + ".bin");
+    check(partition_pages("hot") >= 68, "Other partitions' misses leave a minimum in place (" +
+          to_string(partition_pages("hot")) + " resident)");
+    check(partition_pages("cold") <= 64, "The maximum still holds after the scan");
+}
+
+// Frames in front of a replacer, just enough to drive it with page keys
+struct ReplacerPool {
+    Replacer* replacer;
+    vector<uint64_t> page_of;
+    unordered_map<uint64_t, int> frame_of;
+    int used;
+
+    ReplacerPool(int kind, int frames) : replacer(Replacer::create(kind, frames)), page_of(frames), used(0) {}
+    ~ReplacerPool() { delete replacer; }
+
+    // Pin and unpin the page as a read does, loading it on a miss
+    void request(uint64_t key) {
+        auto hit = frame_of.find(key);
+        if (hit != frame_of.end()) {
+            replacer->setEvictable(hit->second, false);
+            replacer->accessed(hit->second);
+            replacer->setEvictable(hit->second, true);
+            return;
+        }
+        int frame;
+        if (used < (int)page_of.size()) {
+            frame = used++;
+        } else {
+            frame = replacer->victim();
+            frame_of.erase(page_of[frame]);
+        }
+        page_of[frame] = key;
+        frame_of[key] = frame;
+        replacer->loaded(frame, key);
+        replacer->setEvictable(frame, true);
+    }
+
+    bool resident(uint64_t key) const { return frame_of.count(key) > 0; }
+};
+
+// =====================================
+// 2Q keeps hot pages through scans
+// =====================================
+void test_two_queue() {
+    // A1in is a FIFO: hits while a page is in it don't move it
+    {
+        ReplacerPool pool(REPLACER_2Q, 16);
+        for (uint64_t key = 1; key <= 16; key++) pool.request(key);
+        pool.request(1);
+        pool.request(17);
+        check(!pool.resident(1) && pool.resident(2), "A1in evicts in load order whatever was touched since");
+    }
+
+    // A page asked for again after leaving A1in goes to Am, where a scan can't reach it
+    {
+        ReplacerPool pool(REPLACER_2Q, 16);
+        pool.request(1);
+        for (uint64_t key = 2; key <= 17; key++) pool.request(key);
+        check(!pool.resident(1), "A first touch alone doesn't keep a page");
+        pool.request(1);
+        pool.request(1);
+        for (uint64_t key = 100; key < 100 + 4 * 16; key++) pool.request(key);
+        check(pool.resident(1), "A scan of four times the pool leaves a twice-touched page resident");
+    }
+
+    // A victim that fails to flush stays first in line and leaves no ghost behind
+    {
+        ReplacerPool pool(REPLACER_2Q, 8);
+        for (uint64_t key = 1; key <= 8; key++) pool.request(key);
+        int frame = pool.replacer->victim();
+        pool.replacer->reinstate(frame);
+        check(pool.replacer->victim() == frame, "A reinstated frame is the next victim again");
+        pool.replacer->reinstate(frame);
+        for (uint64_t key = 20; key < 28; key++) pool.request(key);
+        check(!pool.resident(1), "A reinstated page is not promoted to Am");
+    }
+}
+
+// Compress src within cap bytes and decode it again, the encoded length or 0 if it did not fit.
+// Sets ok to whether the decoded bytes equal src
+size_t rle_round_trip(const vector<char>& src, size_t cap, bool& ok) {
+    vector<char> packed(cap), unpacked(src.size());
+    size_t len = rleCompress(src.data(), src.size(), packed.data(), cap);
+    ok = len > 0 && rleDecompress(packed.data(), len, unpacked.data(), unpacked.size()) && unpacked == src;
+    return len;
+}
+
+// =====================================
+// Run-length coding of compressed pages
+// =====================================
+void test_rle() {
+    bool ok;
+    vector<char> zeros(DB_BLOCK_SIZE, 0);
+    size_t len = rle_round_trip(zeros, COMPRESSED_PAGE_MAX, ok);
+    check(ok && len < 128, "An all-zero block round-trips in " + to_string(len) + " bytes");
+
+    mt19937 rng(5);
+    vector<char> noise(DB_BLOCK_SIZE);
+    for (char& c : noise) c = (char)rng();
+    vector<char> packed(COMPRESSED_PAGE_MAX);
+    check(rleCompress(noise.data(), noise.size(), packed.data(), packed.size()) == 0,
+          "A random block does not fit in COMPRESSED_PAGE_MAX");
+    len = rle_round_trip(noise, 2 * DB_BLOCK_SIZE, ok);
+    check(ok, "A random block round-trips given room");
+
+    vector<char> run(RLE_MAX_RUN, 'r');
+    len = rle_round_trip(run, 16, ok);
+    check(ok && len == 2, "A run of exactly RLE_MAX_RUN bytes is one token");
+    run.push_back('r');
+    len = rle_round_trip(run, 16, ok);
+    check(ok && len == 4, "One byte more starts a second run");
+
+    // No three equal bytes in a row, so nothing but literals
+    vector<char> literal(RLE_MAX_LITERAL);
+    for (size_t i = 0; i < literal.size(); i++) literal[i] = (char)(i * 7);
+    len = rle_round_trip(literal, 2 * RLE_MAX_LITERAL, ok);
+    check(ok && len == RLE_MAX_LITERAL + 1, "A literal run of exactly RLE_MAX_LITERAL bytes is one token");
+    literal.push_back('x');
+    len = rle_round_trip(literal, 2 * RLE_MAX_LITERAL, ok);
+    check(ok && len == RLE_MAX_LITERAL + 3, "One byte more starts a second literal run");
+
+    vector<char> unpacked(DB_BLOCK_SIZE);
+    len = rleCompress(zeros.data(), zeros.size(), packed.data(), packed.size());
+    check(!rleDecompress(packed.data(), len - 1, unpacked.data(), unpacked.size()),
+          "A truncated encoding is rejected");
+}
+
+int main() {
+    cout << "========================================" << endl;
+    cout << "  Storage Test Suite " << endl;
+    cout << "========================================" << endl;
+
+    clean_env();
+    // A small pool with a partition kept at least 68 frames and one held to at most 64, eight
+    // a shard, more than an insert pins at once. A shard whose share is all pinned goes over
+    // its maximum, so no background writer either, it pins the pages it writes
+    BufferPoolConfig config;
+    config.set("pool_pages", "256");
+    config.set("writer_interval_ms", "0");
+    config.set("partition", "hot 68");
+    config.set("partition", "cold 0 64");
+    config.set("partition", "odd 13 35");
+    config.set("partition", "tiny 0 10");
+    BufferPool::configure(config);
+    if (!RecoveryManager::getInstance()->init(DB_NAME)) {
+        cerr << "RecoveryManager initialization failed!" << endl;
+        return 1;
+    }
+
+    test_rle();
+    test_two_queue();
+    test_slot_reuse();
+    test_partition_quotas();
+
+    clean_env();
+    cout << "All storage tests passed!" << endl;
+    return 0;
+}